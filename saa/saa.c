@@ -33,12 +33,14 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "saa_priv.h"
 #include <X11/fonts/fontstruct.h>
 #include "regionstr.h"
 #include "saa.h"
 #include "saa_priv.h"
+#include "saa_box.h"
 
 #ifdef SAA_DEVPRIVATEKEYREC
 DevPrivateKeyRec saa_screen_index;
@@ -111,14 +113,30 @@ saa_download_from_hw(PixmapPtr pix, RegionPtr readback)
     struct saa_screen_priv *sscreen = saa_screen(pix->drawable.pScreen);
     struct saa_driver *driver = sscreen->driver;
     struct saa_pixmap *spix = saa_pixmap(pix);
+    unsigned long dirty = 0;
     void *addr;
     Bool ret;
 
     if (spix->mapped_access)
 	driver->release_from_cpu(driver, pix, spix->mapped_access);
 
+    /*
+     * The driver reads back the part of @readback that is dirty in
+     * hardware and removes it from dirty_hw, so the shrinkage of
+     * dirty_hw is what was actually migrated.
+     */
+    if (sscreen->fallback_count)
+	dirty = saa_boxes_area(REGION_RECTS(&spix->dirty_hw),
+			       REGION_NUM_RECTS(&spix->dirty_hw));
+
     ret = driver->download_from_hw(driver, pix, readback);
 
+    if (dirty)
+	sscreen->fallback_readback += (unsigned long long)
+	    (dirty - saa_boxes_area(REGION_RECTS(&spix->dirty_hw),
+				    REGION_NUM_RECTS(&spix->dirty_hw))) *
+	    (pix->drawable.bitsPerPixel >> 3);
+
     if (spix->mapped_access) {
 	addr = driver->sync_for_cpu(driver, pix, spix->mapped_access);
 	if (addr != NULL)
@@ -139,8 +157,27 @@ saa_prepare_access_pixmap(PixmapPtr pix, saa_access_t access,
     saa_access_t map_access = 0;
     Bool ret = TRUE;
 
-    if (read_reg && REGION_NOTEMPTY(pScreen, read_reg))
-	ret = saa_download_from_hw(pix, read_reg);
+    saa_pixmap_used(pix, FALSE, saa_migration_needed(&spix->dirty_hw,
+						     read_reg));
+
+    if (read_reg && REGION_NOTEMPTY(pScreen, read_reg)) {
+	struct saa_tiles *tiles = NULL;
+	RegionPtr tiled = NULL;
+
+	/*
+	 * For tiled pixmaps, read back whole tiles, which gives fewer and
+	 * larger transfers, and makes subsequent nearby reads free.
+	 */
+	if (REGION_NOTEMPTY(pScreen, &spix->dirty_hw))
+	    tiles = saa_pixmap_tiles(pix, spix);
+	if (tiles)
+	    tiled = saa_tiles_round_region(pScreen, tiles, read_reg);
+
+	ret = saa_download_from_hw(pix, (tiled) ? tiled : read_reg);
+
+	if (tiled)
+	    REGION_DESTROY(pScreen, tiled);
+    }
 
     if (!ret) {
 	LogMessage(X_ERROR, "Prepare access pixmap failed.\n");
@@ -154,6 +191,12 @@ saa_prepare_access_pixmap(PixmapPtr pix, saa_access_t access,
 
     if (map_access) {
 	if (spix->auth_loc != saa_loc_override) {
+	    /*
+	     * Tell the driver about the new software access once, before
+	     * mapping, so that it may move the pixmap to software.
+	     */
+	    if (driver->saa_minor >= 7 && driver->sw_access)
+		driver->sw_access(driver, pix, map_access);
 	    (void)driver->sync_for_cpu(driver, pix, map_access);
 	    spix->addr = driver->map(driver, pix, map_access);
 	} else
@@ -418,16 +461,20 @@ saa_validate_gc(GCPtr pGC, unsigned long changes, DrawablePtr pDrawable)
 
     /* Calls to Create/DestroyPixmap have to be identified as special, so
      * up sscreen->fallback_count.
+     * This isn't a fallback the client asked for, so outside of one,
+     * readbacks are credited to ValidateGC rather than to a fallback.
      */
 
-    sscreen->fallback_count++;
+    if (sscreen->fallback_count++ == 0)
+	sscreen->fallback_readback = 0;
     saa_swap(sgc, pGC, funcs);
     (*pGC->funcs->ValidateGC) (pGC, changes, pDrawable);
     saa_swap(sgc, pGC, funcs);
 
     if (finish_current_tile && pGC->tile.pixmap)
 	saa_fad_write(&pGC->tile.pixmap->drawable, SAA_ACCESS_W);
-    sscreen->fallback_count--;
+    if (--sscreen->fallback_count == 0)
+	sscreen->validate_gc_readback += sscreen->fallback_readback;
 
     if (pTile)
 	saa_fad_read(&pTile->drawable);
@@ -589,6 +636,88 @@ saa_set_fallback_debug(ScreenPtr screen, Bool enable)
     sscreen->fallback_debug = enable;
 }
 
+/**
+ * saa_set_dirty_tiles - Enable tile bitmaps for the dirty regions of
+ * large pixmaps.
+ */
+void
+saa_set_dirty_tiles(ScreenPtr screen, Bool enable)
+{
+    struct saa_screen_priv *sscreen = saa_screen(screen);
+
+    sscreen->dirty_tiles = enable;
+}
+
+/**
+ * saa_set_fallback_threads - Set the number of worker threads used to
+ * split large software fallbacks into bands.
+ *
+ * @screen: The screen.
+ * @num_threads: Number of worker threads. 0 renders all software
+ * fallbacks on the server thread.
+ *
+ * Returns FALSE if the threads couldn't be started, in which case
+ * software fallbacks stay single-threaded.
+ */
+Bool
+saa_set_fallback_threads(ScreenPtr screen, unsigned int num_threads)
+{
+    struct saa_screen_priv *sscreen = saa_screen(screen);
+
+    saa_threads_takedown(sscreen);
+    if (num_threads == 0)
+	return TRUE;
+
+    return saa_threads_init(sscreen, num_threads);
+}
+
+static const char *saa_fallback_op_names[SAA_OP_NUM] = {
+    "FillSpans", "SetSpans", "PutImage", "CopyNtoN", "CopyArea",
+    "CopyPlane", "PolyPoint", "PolyLines", "PolySegment", "PolyArc",
+    "PolyFillRect", "ImageGlyphBlt", "PolyGlyphBlt", "PushPixels",
+    "CopyWindow", "GetImage", "GetSpans", "Composite", "AddTraps"
+};
+
+/**
+ * saa_fallback_report - Log software fallback statistics.
+ *
+ * @screen: The screen.
+ * @verb: Log verbosity of the messages.
+ * @reset: Clear the statistics after logging them.
+ *
+ * For each operation that fell back to software, logs the number of
+ * fallbacks, the time spent in them and the amount of data read back
+ * from hardware for them. Readbacks of GC tiles and stipples outside of
+ * a fallback are logged separately for ValidateGC.
+ */
+void
+saa_fallback_report(ScreenPtr screen, int verb, Bool reset)
+{
+    struct saa_screen_priv *sscreen = saa_screen(screen);
+    int i;
+
+    for (i = 0; i < SAA_OP_NUM; ++i) {
+	struct saa_fallback_stat *stat = &sscreen->fallback_stats[i];
+
+	if (!stat->count)
+	    continue;
+
+	LogMessageVerb(X_INFO, verb, "Software fallback %s: %lu calls, "
+		       "%llu ms, %llu KiB read back.\n",
+		       saa_fallback_op_names[i], stat->count,
+		       stat->usecs / 1000ULL, stat->readback_bytes >> 10);
+    }
+
+    if (sscreen->validate_gc_readback)
+	LogMessageVerb(X_INFO, verb, "ValidateGC: %llu KiB read back.\n",
+		       sscreen->validate_gc_readback >> 10);
+
+    if (reset) {
+	memset(sscreen->fallback_stats, 0, sizeof(sscreen->fallback_stats));
+	sscreen->validate_gc_readback = 0;
+    }
+}
+
 /**
  * saa_close_screen() unwraps its wrapped screen functions and tears down SAA's
  * screen private, before calling down to the next CloseScreen.
@@ -599,6 +728,10 @@ saa_close_screen(CLOSE_SCREEN_ARGS_DECL)
     struct saa_screen_priv *sscreen = saa_screen(pScreen);
     struct saa_driver *driver = sscreen->driver;
 
+#ifdef RENDER
+    saa_render_release(pScreen);
+#endif
+
     if (pScreen->devPrivate) {
 	/* Destroy the pixmap created by miScreenInit() *before*
 	 * chaining up as we finalize ourselves here and so this
@@ -620,6 +753,8 @@ saa_close_screen(CLOSE_SCREEN_ARGS_DECL)
     saa_render_takedown(pScreen);
 #endif
     saa_unaccel_takedown(pScreen);
+    saa_threads_takedown(sscreen);
+    saa_fallback_report(pScreen, 3, FALSE);
     driver->takedown(driver);
 
     free(sscreen);
@@ -738,11 +873,12 @@ saa_driver_init(ScreenPtr screen, struct saa_driver * saa_driver)
     return TRUE;
 }
 
+/*
+ * The glyph cache creates its resources on first use, so there's
+ * nothing to set up here.
+ */
 Bool
 saa_resources_init(ScreenPtr screen)
 {
-/*    if (!saa_glyphs_init(screen))
-	return FALSE;
-*/
     return TRUE;
 }
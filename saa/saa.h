@@ -47,7 +47,7 @@
 #include "../src/compat-api.h"
 
 #define SAA_VERSION_MAJOR 0
-#define SAA_VERSION_MINOR 1
+#define SAA_VERSION_MINOR 8
 
 #define SAA_ACCESS_R (1 << 0)
 #define SAA_ACCESS_W (1 << 1)
@@ -56,6 +56,14 @@
 #define SAA_PIXMAP_HINT_CREATE_HW (1 << 25)
 #define SAA_PIXMAP_PREFER_SHADOW  (1 << 0)
 
+/*
+ * saa_driver flags.
+ * SAA_DRIVER_CA_OVER_TWO_PASS: The driver never accelerates a
+ * component-alpha Over in one pass, so SAA doesn't offer it before
+ * splitting it into an OutReverse and an Add.
+ */
+#define SAA_DRIVER_CA_OVER_TWO_PASS (1 << 0)
+
 typedef unsigned int saa_access_t;
 
 enum saa_pixmap_loc {
@@ -63,6 +71,18 @@ enum saa_pixmap_loc {
     saa_loc_override,
 };
 
+/*
+ * Pixmaps that keep migrating between software and hardware are
+ * pinned to one side for a while.
+ */
+enum saa_pixmap_pin {
+    saa_pin_none,
+    saa_pin_sw,
+    saa_pin_hw,
+};
+
+struct saa_tiles;
+
 struct saa_pixmap {
     PixmapPtr pixmap;
     int read_access;
@@ -78,7 +98,19 @@ struct saa_pixmap {
     enum saa_pixmap_loc auth_loc;
     PictFormatShort src_format;
     PictFormatShort dst_format;
-    uint32_t pad[16];
+    enum saa_pixmap_pin pin;
+    unsigned int migrations;
+    unsigned int window_migrations;
+    unsigned int window_sw;
+    unsigned int window_hw;
+    CARD32 window_start;
+    struct saa_tiles *tiles;
+    /*
+     * Scratch pixmaps are rewritten in software before each use by
+     * hardware, so uploads to them don't count as migrations.
+     */
+    Bool scratch;
+    uint32_t pad[7];
 };
 
 struct saa_driver {
@@ -126,7 +158,33 @@ struct saa_driver {
     void (*composite_done) (struct saa_driver *driver);
 
     void (*takedown) (struct saa_driver * driver);
-    uint32_t pad[16];
+
+    /* Since SAA_VERSION_MINOR 3 */
+    Bool (*copy_share) (struct saa_driver * driver, PixmapPtr src_pixmap,
+			PixmapPtr dst_pixmap);
+
+    /* Since SAA_VERSION_MINOR 4 */
+    Bool (*solid_prepare) (struct saa_driver * driver, PixmapPtr pixmap,
+			   int alu, Pixel plane_mask, Pixel fg);
+    void (*solid) (struct saa_driver * driver, int x1, int y1, int x2, int y2);
+    void (*solid_done) (struct saa_driver * driver);
+
+    /* Since SAA_VERSION_MINOR 5 */
+    Bool (*put_image) (struct saa_driver * driver, PixmapPtr pixmap,
+		       RegionPtr region, int x, int y, char *bits,
+		       int pitch);
+
+    /* Since SAA_VERSION_MINOR 6 */
+    Bool (*get_image) (struct saa_driver * driver, PixmapPtr pixmap,
+		       BoxPtr box, char *d, int pitch);
+
+    /* Since SAA_VERSION_MINOR 7 */
+    void (*sw_access) (struct saa_driver * driver, PixmapPtr pixmap,
+		       saa_access_t access);
+
+    /* Since SAA_VERSION_MINOR 8 */
+    uint32_t flags;
+    uint32_t pad[8];
 };
 
 extern _X_EXPORT PixmapPtr
@@ -186,12 +244,27 @@ saa_op_reads_destination(CARD8 op);
 extern _X_EXPORT void
 saa_set_fallback_debug(ScreenPtr screen, Bool enable);
 
+extern _X_EXPORT void
+saa_set_dirty_tiles(ScreenPtr screen, Bool enable);
+
+extern _X_EXPORT Bool
+saa_set_fallback_threads(ScreenPtr screen, unsigned int num_threads);
+
+extern _X_EXPORT void
+saa_fallback_report(ScreenPtr screen, int verb, Bool reset);
+
+extern _X_EXPORT void
+saa_pixmap_tiles_invalidate(PixmapPtr pixmap);
+
 extern _X_EXPORT
 struct saa_pixmap *saa_get_saa_pixmap(PixmapPtr pPixmap);
 
 extern _X_EXPORT Bool
 saa_add_damage(PixmapPtr pixmap);
 
+extern _X_EXPORT enum saa_pixmap_pin
+saa_pixmap_get_pin(PixmapPtr pixmap);
+
 extern _X_EXPORT struct saa_driver *
 saa_get_driver(ScreenPtr pScreen);
 
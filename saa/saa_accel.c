@@ -32,6 +32,47 @@
 #include "saa_priv.h"
 #include <mi.h>
 
+/*
+ * saa_copy_shareable - Whether a copy replaces the entire destination pixmap
+ * with the entire source pixmap, so that the driver may share the source
+ * contents instead of copying them.
+ */
+static Bool
+saa_copy_shareable(struct saa_driver *driver,
+		   PixmapPtr pSrcPixmap, PixmapPtr pDstPixmap, GCPtr pGC,
+		   RegionPtr src_reg, RegionPtr dst_reg)
+{
+    ScreenPtr pScreen = pDstPixmap->drawable.pScreen;
+    BoxPtr src_box = REGION_EXTENTS(pScreen, src_reg);
+    BoxPtr dst_box = REGION_EXTENTS(pScreen, dst_reg);
+
+    (void)pScreen;
+
+    if (driver->saa_minor < 3 || !driver->copy_share)
+	return FALSE;
+
+    if (pSrcPixmap == pDstPixmap ||
+	pSrcPixmap->drawable.width != pDstPixmap->drawable.width ||
+	pSrcPixmap->drawable.height != pDstPixmap->drawable.height ||
+	pSrcPixmap->drawable.depth != pDstPixmap->drawable.depth ||
+	pSrcPixmap->drawable.bitsPerPixel !=
+	pDstPixmap->drawable.bitsPerPixel)
+	return FALSE;
+
+    if (pGC && (pGC->alu != GXcopy ||
+		!SAA_PM_IS_SOLID(&pDstPixmap->drawable, pGC->planemask)))
+	return FALSE;
+
+    return (REGION_NUM_RECTS(src_reg) == 1 &&
+	    REGION_NUM_RECTS(dst_reg) == 1 &&
+	    src_box->x1 == 0 && src_box->y1 == 0 &&
+	    src_box->x2 == pSrcPixmap->drawable.width &&
+	    src_box->y2 == pSrcPixmap->drawable.height &&
+	    dst_box->x1 == 0 && dst_box->y1 == 0 &&
+	    dst_box->x2 == pDstPixmap->drawable.width &&
+	    dst_box->y2 == pDstPixmap->drawable.height);
+}
+
 Bool
 saa_hw_copy_nton(DrawablePtr pSrcDrawable,
 		 DrawablePtr pDstDrawable,
@@ -48,6 +89,7 @@ saa_hw_copy_nton(DrawablePtr pSrcDrawable,
     int dst_off_x, dst_off_y;
     RegionRec dst_reg, *src_reg;
     int ordering;
+    Bool src_migrate;
     Bool ret = TRUE;
 
     (void)pScreen;
@@ -65,6 +107,10 @@ saa_hw_copy_nton(DrawablePtr pSrcDrawable,
 	dst_spix->auth_loc != saa_loc_driver)
 	return FALSE;
 
+    if (saa_pixmap_get_pin(pSrcPixmap) == saa_pin_sw ||
+	saa_pixmap_get_pin(pDstPixmap) == saa_pin_sw)
+	return FALSE;
+
 
     ordering = (nbox == 1 || (dx > 0 && dy > 0) ||
 		(pDstDrawable != pSrcDrawable &&
@@ -81,6 +127,22 @@ saa_hw_copy_nton(DrawablePtr pSrcDrawable,
     REGION_TRANSLATE(pScreen, src_reg, dx + src_off_x, dy + src_off_y);
     REGION_TRANSLATE(pScreen, &dst_reg, dst_off_x, dst_off_y);
 
+    src_migrate = saa_migration_needed(&src_spix->dirty_shadow, src_reg);
+
+    /*
+     * Full pixmap copies, like double-buffer swaps and backing store
+     * snapshots, may share the source contents until either pixmap
+     * is written to.
+     */
+    if (saa_copy_shareable(driver, pSrcPixmap, pDstPixmap, pGC,
+			   src_reg, &dst_reg) &&
+	driver->copy_share(driver, pSrcPixmap, pDstPixmap)) {
+	saa_pixmap_dirty(pDstPixmap, TRUE, &dst_reg);
+	saa_pixmap_used(pSrcPixmap, TRUE, src_migrate);
+	saa_pixmap_used(pDstPixmap, TRUE, FALSE);
+	goto out;
+    }
+
     if (!(driver->copy_prepare) (driver, pSrcPixmap, pDstPixmap,
 				 reverse ? -1 : 1,
 				 upsidedown ? -1 : 1,
@@ -100,6 +162,9 @@ saa_hw_copy_nton(DrawablePtr pSrcDrawable,
 
     (driver->copy_done) (driver);
     saa_pixmap_dirty(pDstPixmap, TRUE, &dst_reg);
+    saa_pixmap_used(pSrcPixmap, TRUE, src_migrate);
+    if (pDstPixmap != pSrcPixmap)
+	saa_pixmap_used(pDstPixmap, TRUE, FALSE);
     goto out;
 
  fallback:
@@ -151,3 +216,297 @@ saa_copy_area(DrawablePtr pSrcDrawable, DrawablePtr pDstDrawable, GCPtr pGC,
 		    dstx, dsty, saa_copy_nton, 0, NULL);
 #endif
 }
+
+/*
+ * saa_hw_fill_solid - Fill a region, in screen coordinates, with a solid
+ * pixel value using the driver solid fill hooks.
+ */
+static Bool
+saa_hw_fill_solid(DrawablePtr pDrawable, RegionPtr region, int alu,
+		  Pixel plane_mask, Pixel fg)
+{
+    ScreenPtr pScreen = pDrawable->pScreen;
+    struct saa_driver *driver = saa_screen(pScreen)->driver;
+    PixmapPtr pPixmap;
+    struct saa_pixmap *spix;
+    int xoff, yoff;
+    BoxPtr pbox;
+    int nbox;
+
+    if (driver->saa_minor < 4 || !driver->solid_prepare)
+	return FALSE;
+
+    pPixmap = saa_get_pixmap(pDrawable, &xoff, &yoff);
+    spix = saa_pixmap(pPixmap);
+
+    if (spix->auth_loc != saa_loc_driver ||
+	saa_pixmap_get_pin(pPixmap) == saa_pin_sw)
+	return FALSE;
+
+    if (!driver->solid_prepare(driver, pPixmap, alu, plane_mask, fg))
+	return FALSE;
+
+    REGION_TRANSLATE(pScreen, region, xoff, yoff);
+    pbox = REGION_RECTS(region);
+    nbox = REGION_NUM_RECTS(region);
+
+    for (; nbox > 0; --nbox, ++pbox)
+	driver->solid(driver, pbox->x1, pbox->y1, pbox->x2, pbox->y2);
+
+    driver->solid_done(driver);
+    saa_pixmap_dirty(pPixmap, TRUE, region);
+    saa_pixmap_used(pPixmap, TRUE, FALSE);
+
+    return TRUE;
+}
+
+/*
+ * saa_hw_fill_tiled - Fill a region, in screen coordinates, with the GC
+ * tile by copying the tile pixmap once for every tile position touched.
+ * Only used for fills that replace the destination, so that a fallback
+ * after a partial fill still gives the correct result.
+ */
+static Bool
+saa_hw_fill_tiled(DrawablePtr pDrawable, GCPtr pGC, RegionPtr region)
+{
+    ScreenPtr pScreen = pDrawable->pScreen;
+    PixmapPtr pTile = pGC->tile.pixmap;
+    int tw = pTile->drawable.width;
+    int th = pTile->drawable.height;
+    int org_x = pDrawable->x + pGC->patOrg.x;
+    int org_y = pDrawable->y + pGC->patOrg.y;
+    BoxPtr ext = REGION_EXTENTS(pScreen, region);
+    int c1, r1, c2, r2, c, r;
+    RegionRec tile_reg;
+    BoxRec tile_box;
+    Bool ret = TRUE;
+
+    if (pGC->alu != GXcopy || !SAA_PM_IS_SOLID(pDrawable, pGC->planemask))
+	return FALSE;
+
+    c1 = saa_floor_div(ext->x1 - org_x, tw);
+    c2 = saa_floor_div(ext->x2 - 1 - org_x, tw);
+    r1 = saa_floor_div(ext->y1 - org_y, th);
+    r2 = saa_floor_div(ext->y2 - 1 - org_y, th);
+
+    if ((c2 - c1 + 1) * (r2 - r1 + 1) > SAA_COPY_MAX_TILES)
+	return FALSE;
+
+    REGION_NULL(pScreen, &tile_reg);
+    for (r = r1; ret && r <= r2; ++r) {
+	for (c = c1; ret && c <= c2; ++c) {
+	    tile_box.x1 = org_x + c * tw;
+	    tile_box.y1 = org_y + r * th;
+	    tile_box.x2 = tile_box.x1 + tw;
+	    tile_box.y2 = tile_box.y1 + th;
+
+	    REGION_RESET(pScreen, &tile_reg, &tile_box);
+	    REGION_INTERSECT(pScreen, &tile_reg, &tile_reg, region);
+	    if (!REGION_NOTEMPTY(pScreen, &tile_reg))
+		continue;
+
+	    ret = saa_hw_copy_nton(&pTile->drawable, pDrawable, pGC,
+				   REGION_RECTS(&tile_reg),
+				   REGION_NUM_RECTS(&tile_reg),
+				   -tile_box.x1, -tile_box.y1, FALSE, FALSE);
+	}
+    }
+    REGION_UNINIT(pScreen, &tile_reg);
+
+    return ret;
+}
+
+/**
+ * saa_poly_fill_rect - PolyFillRect using driver solid fills and copies.
+ *
+ * @pDrawable: The drawable on which to fill.
+ * @pGC: Pointer to the GC to use.
+ * @nrect: Number of rectangles to fill.
+ * @prect: Pointer to rectangles to fill.
+ *
+ * Solid fills, and tiled fills with a moderate number of tiles, of pixmaps
+ * whose contents live with the driver are done without CPU access, so that
+ * for example window background clears on hardware-resident windows never
+ * need a readback. Everything else falls back to software.
+ */
+void
+saa_poly_fill_rect(DrawablePtr pDrawable, GCPtr pGC,
+		   int nrect, xRectangle * prect)
+{
+    ScreenPtr pScreen = pDrawable->pScreen;
+    struct saa_screen_priv *sscreen = saa_screen(pScreen);
+    RegionPtr region;
+    Bool ret = FALSE;
+
+    if (sscreen->fallback_count || nrect == 0)
+	goto fallback;
+
+    if (pGC->fillStyle != FillSolid && pGC->fillStyle != FillTiled)
+	goto fallback;
+
+    region = RECTS_TO_REGION(pScreen, nrect, prect, CT_UNSORTED);
+    if (!region)
+	goto fallback;
+
+    REGION_TRANSLATE(pScreen, region, pDrawable->x, pDrawable->y);
+    REGION_INTERSECT(pScreen, region, region, pGC->pCompositeClip);
+
+    if (!REGION_NOTEMPTY(pScreen, region))
+	ret = TRUE;
+    else if (pGC->fillStyle == FillSolid)
+	ret = saa_hw_fill_solid(pDrawable, region, pGC->alu,
+				pGC->planemask, pGC->fgPixel);
+    else if (pGC->tileIsPixel)
+	ret = saa_hw_fill_solid(pDrawable, region, pGC->alu,
+				pGC->planemask, pGC->tile.pixel);
+    else
+	ret = saa_hw_fill_tiled(pDrawable, pGC, region);
+
+    REGION_DESTROY(pScreen, region);
+
+    if (ret)
+	return;
+
+ fallback:
+    saa_check_poly_fill_rect(pDrawable, pGC, nrect, prect);
+}
+
+/**
+ * saa_put_image - PutImage writing directly to driver-resident pixmaps.
+ *
+ * @pDrawable: The drawable to write to.
+ * @pGC: Pointer to the GC to use.
+ * @depth: Depth of the image.
+ * @x: Image destination x coordinate, relative to the drawable.
+ * @y: Image destination y coordinate, relative to the drawable.
+ * @w: Image width.
+ * @h: Image height.
+ * @leftPad: Number of bits to skip at the start of each image line.
+ * @format: Image format.
+ * @bits: Image data.
+ *
+ * ZPixmap images that replace the destination contents are handed to the
+ * driver, which may write them straight into its copy of the pixmap. That
+ * avoids both a readback and a later upload of the software shadow.
+ * Everything else falls back to software.
+ */
+void
+saa_put_image(DrawablePtr pDrawable, GCPtr pGC, int depth, int x, int y,
+	      int w, int h, int leftPad, int format, char *bits)
+{
+    ScreenPtr pScreen = pDrawable->pScreen;
+    struct saa_screen_priv *sscreen = saa_screen(pScreen);
+    struct saa_driver *driver = sscreen->driver;
+    PixmapPtr pPixmap;
+    struct saa_pixmap *spix;
+    RegionRec region;
+    BoxRec box;
+    int xoff, yoff;
+    Bool ret;
+
+    if (sscreen->fallback_count || driver->saa_minor < 5 ||
+	!driver->put_image)
+	goto fallback;
+
+    if (format != ZPixmap || depth != pDrawable->depth ||
+	pDrawable->bitsPerPixel < 8 || pGC->alu != GXcopy ||
+	!SAA_PM_IS_SOLID(pDrawable, pGC->planemask))
+	goto fallback;
+
+    pPixmap = saa_get_pixmap(pDrawable, &xoff, &yoff);
+    spix = saa_pixmap(pPixmap);
+
+    if (spix->auth_loc != saa_loc_driver ||
+	saa_pixmap_get_pin(pPixmap) == saa_pin_sw)
+	goto fallback;
+
+    box.x1 = pDrawable->x + x;
+    box.y1 = pDrawable->y + y;
+    box.x2 = box.x1 + w;
+    box.y2 = box.y1 + h;
+
+    REGION_INIT(pScreen, &region, &box, 1);
+    REGION_INTERSECT(pScreen, &region, &region, pGC->pCompositeClip);
+    if (!REGION_NOTEMPTY(pScreen, &region)) {
+	REGION_UNINIT(pScreen, &region);
+	return;
+    }
+
+    REGION_TRANSLATE(pScreen, &region, xoff, yoff);
+    ret = driver->put_image(driver, pPixmap, &region,
+			    box.x1 + xoff, box.y1 + yoff, bits,
+			    PixmapBytePad(w, depth));
+    if (ret) {
+	saa_pixmap_dirty(pPixmap, TRUE, &region);
+	saa_pixmap_used(pPixmap, TRUE, FALSE);
+    }
+    REGION_UNINIT(pScreen, &region);
+
+    if (ret)
+	return;
+
+ fallback:
+    saa_check_put_image(pDrawable, pGC, depth, x, y, w, h, leftPad, format,
+			bits);
+}
+
+/**
+ * saa_get_image - GetImage reading directly from driver-resident pixmaps.
+ *
+ * @pDrawable: The drawable to read from.
+ * @x: Image x coordinate, relative to the drawable.
+ * @y: Image y coordinate, relative to the drawable.
+ * @w: Image width.
+ * @h: Image height.
+ * @format: Image format.
+ * @planeMask: Planes to read.
+ * @d: Image data destination.
+ *
+ * ZPixmap reads of all planes are offered to the driver, which may copy
+ * just the requested box out of its copy of the pixmap, without reading
+ * back into the software shadow. Everything else falls back to software.
+ */
+void
+saa_get_image(DrawablePtr pDrawable, int x, int y, int w, int h,
+	      unsigned int format, unsigned long planeMask, char *d)
+{
+    ScreenPtr pScreen = pDrawable->pScreen;
+    struct saa_screen_priv *sscreen = saa_screen(pScreen);
+    struct saa_driver *driver = sscreen->driver;
+    PixmapPtr pPixmap;
+    struct saa_pixmap *spix;
+    BoxRec box;
+    int xoff, yoff;
+
+    if (sscreen->fallback_count || driver->saa_minor < 6 ||
+	!driver->get_image || w <= 0 || h <= 0)
+	goto fallback;
+
+    if (format != ZPixmap || pDrawable->bitsPerPixel < 8 ||
+	!SAA_PM_IS_SOLID(pDrawable, planeMask))
+	goto fallback;
+
+    pPixmap = saa_get_pixmap(pDrawable, &xoff, &yoff);
+    spix = saa_pixmap(pPixmap);
+
+    if (spix->auth_loc != saa_loc_driver ||
+	saa_pixmap_get_pin(pPixmap) == saa_pin_sw)
+	goto fallback;
+
+    box.x1 = pDrawable->x + x + xoff;
+    box.y1 = pDrawable->y + y + yoff;
+    box.x2 = box.x1 + w;
+    box.y2 = box.y1 + h;
+
+    if (box.x1 < 0 || box.y1 < 0 ||
+	box.x2 > pPixmap->drawable.width ||
+	box.y2 > pPixmap->drawable.height)
+	goto fallback;
+
+    if (driver->get_image(driver, pPixmap, &box, d,
+			  PixmapBytePad(w, pDrawable->depth)))
+	return;
+
+ fallback:
+    saa_check_get_image(pDrawable, x, y, w, h, format, planeMask, d);
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2013 VMWare, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL TUNGSTEN GRAPHICS AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Box array helpers shared by saa and the drivers using it. The loops are
+ * kept free of branches and aliasing, so that the compiler can vectorise
+ * them.
+ */
+
+#ifndef _SAA_BOX_H_
+#define _SAA_BOX_H_
+
+#include <xorg-server.h>
+#include <X11/Xproto.h>
+#include <regionstr.h>
+
+/*
+ * saa_boxes_to_rects - Convert boxes to X rectangles.
+ */
+static inline void
+saa_boxes_to_rects(xRectangle *restrict rects, const BoxRec *restrict boxes,
+		   unsigned int num)
+{
+    unsigned int i;
+
+    for (i = 0; i < num; ++i) {
+	rects[i].x = boxes[i].x1;
+	rects[i].y = boxes[i].y1;
+	rects[i].width = boxes[i].x2 - boxes[i].x1;
+	rects[i].height = boxes[i].y2 - boxes[i].y1;
+    }
+}
+
+/*
+ * saa_boxes_translate - Copy boxes, translating them by @dx, @dy.
+ * @dst and @src may not overlap.
+ */
+static inline void
+saa_boxes_translate(BoxPtr restrict dst, const BoxRec *restrict src,
+		    unsigned int num, int dx, int dy)
+{
+    unsigned int i;
+
+    for (i = 0; i < num; ++i) {
+	dst[i].x1 = src[i].x1 + dx;
+	dst[i].y1 = src[i].y1 + dy;
+	dst[i].x2 = src[i].x2 + dx;
+	dst[i].y2 = src[i].y2 + dy;
+    }
+}
+
+/*
+ * saa_boxes_area - Sum of the areas of boxes, in pixels.
+ */
+static inline unsigned long
+saa_boxes_area(const BoxRec *boxes, unsigned int num)
+{
+    unsigned long area = 0;
+    unsigned int i;
+
+    for (i = 0; i < num; ++i)
+	area += (unsigned long) (boxes[i].x2 - boxes[i].x1) *
+	    (boxes[i].y2 - boxes[i].y1);
+
+    return area;
+}
+
+/*
+ * saa_boxes_rows - Compute the rows covered by a non-empty box array.
+ */
+static inline void
+saa_boxes_rows(const BoxRec *boxes, unsigned int num, int *y1, int *y2)
+{
+    int min_y = boxes[0].y1;
+    int max_y = boxes[0].y2;
+    unsigned int i;
+
+    for (i = 1; i < num; ++i) {
+	min_y = (boxes[i].y1 < min_y) ? boxes[i].y1 : min_y;
+	max_y = (boxes[i].y2 > max_y) ? boxes[i].y2 : max_y;
+    }
+
+    *y1 = min_y;
+    *y2 = max_y;
+}
+
+/*
+ * saa_box_clamp_rows - Clamp the rows of a box to @y1 - @y2.
+ *
+ * Returns FALSE if the clamped box is empty.
+ */
+static inline Bool
+saa_box_clamp_rows(const BoxRec *box, int y1, int y2, int *cy1, int *cy2)
+{
+    *cy1 = (box->y1 > y1) ? box->y1 : y1;
+    *cy2 = (box->y2 < y2) ? box->y2 : y2;
+
+    return (*cy1 < *cy2);
+}
+
+#endif
@@ -0,0 +1,769 @@
+/*
+ * Copyright 2013 VMWare, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL TUNGSTEN GRAPHICS AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Glyph cache. Glyphs are kept in one atlas picture per glyph format,
+ * divided into fixed size cells that are recycled in LRU order. A glyph
+ * run whose glyphs all fit in the atlas is rendered with a single driver
+ * composite operation, using the atlas as mask and one rectangle per
+ * glyph. Runs we can't handle that way are left to miGlyphs.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "saa_priv.h"
+#include "saa.h"
+
+#ifdef RENDER
+#include <mipict.h>
+
+#define SAA_GLYPH_CELL_SIZE 32
+#define SAA_GLYPH_ATLAS_COLS 32
+#define SAA_GLYPH_ATLAS_ROWS 16
+#define SAA_GLYPH_ATLAS_CELLS (SAA_GLYPH_ATLAS_COLS * SAA_GLYPH_ATLAS_ROWS)
+#define SAA_GLYPH_ATLAS_WIDTH (SAA_GLYPH_ATLAS_COLS * SAA_GLYPH_CELL_SIZE)
+#define SAA_GLYPH_ATLAS_HEIGHT (SAA_GLYPH_ATLAS_ROWS * SAA_GLYPH_CELL_SIZE)
+#define SAA_GLYPH_HASH_SIZE 1024
+
+/*
+ * The LRU list is circular, with a sentinel after the last cell.
+ */
+#define SAA_GLYPH_LRU SAA_GLYPH_ATLAS_CELLS
+
+#define SAA_GLYPH_NEEDS_COMPONENT(f) \
+    (PICT_FORMAT_A(f) != 0 && PICT_FORMAT_RGB(f) != 0)
+
+enum saa_glyph_format {
+    saa_glyph_a8,
+    saa_glyph_a8r8g8b8,
+    saa_glyph_num_formats
+};
+
+struct saa_glyph_cell {
+    GlyphPtr glyph;
+    int hash_next;
+    int lru_prev;
+    int lru_next;
+    unsigned int serial;
+};
+
+struct saa_glyph_atlas {
+    PictFormatShort format;
+    int depth;
+    PicturePtr picture;
+    Bool failed;
+    int hash[SAA_GLYPH_HASH_SIZE];
+    struct saa_glyph_cell cells[SAA_GLYPH_ATLAS_CELLS + 1];
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+};
+
+/*
+ * A glyph to be copied into the atlas.
+ */
+struct saa_glyph_upload {
+    PicturePtr picture;
+    int cell;
+};
+
+struct saa_glyphs {
+    struct saa_glyph_atlas atlas[saa_glyph_num_formats];
+    unsigned int serial;
+    unsigned long runs;
+    unsigned long fallbacks;
+
+    /* Scratch arrays, reused between runs. */
+    BoxPtr boxes;
+    DDXPointPtr mask_off;
+    unsigned int size;
+    struct saa_glyph_upload *uploads;
+    unsigned int num_uploads;
+};
+
+static inline unsigned int
+saa_glyph_hash(GlyphPtr glyph)
+{
+    unsigned long key = (unsigned long) glyph;
+
+    return (key ^ (key >> 12)) >> 4 & (SAA_GLYPH_HASH_SIZE - 1);
+}
+
+static void
+saa_glyph_lru_unlink(struct saa_glyph_atlas *atlas, int i)
+{
+    struct saa_glyph_cell *cell = &atlas->cells[i];
+
+    atlas->cells[cell->lru_prev].lru_next = cell->lru_next;
+    atlas->cells[cell->lru_next].lru_prev = cell->lru_prev;
+}
+
+static void
+saa_glyph_lru_insert(struct saa_glyph_atlas *atlas, int i, int after)
+{
+    struct saa_glyph_cell *cell = &atlas->cells[i];
+
+    cell->lru_prev = after;
+    cell->lru_next = atlas->cells[after].lru_next;
+    atlas->cells[cell->lru_next].lru_prev = i;
+    atlas->cells[after].lru_next = i;
+}
+
+static void
+saa_glyph_atlas_init(struct saa_glyph_atlas *atlas, PictFormatShort format,
+		     int depth)
+{
+    int i;
+
+    memset(atlas, 0, sizeof(*atlas));
+    atlas->format = format;
+    atlas->depth = depth;
+
+    for (i = 0; i < SAA_GLYPH_HASH_SIZE; ++i)
+	atlas->hash[i] = -1;
+
+    atlas->cells[SAA_GLYPH_LRU].lru_prev = SAA_GLYPH_LRU;
+    atlas->cells[SAA_GLYPH_LRU].lru_next = SAA_GLYPH_LRU;
+    for (i = 0; i < SAA_GLYPH_ATLAS_CELLS; ++i)
+	saa_glyph_lru_insert(atlas, i, atlas->cells[SAA_GLYPH_LRU].lru_prev);
+}
+
+/*
+ * saa_glyph_atlas_create - Create the atlas picture on first use.
+ */
+static Bool
+saa_glyph_atlas_create(ScreenPtr pScreen, struct saa_glyph_atlas *atlas)
+{
+    PictFormatPtr pict_format;
+    PixmapPtr pixmap;
+    CARD32 component_alpha;
+    int error;
+
+    if (atlas->picture)
+	return TRUE;
+    if (atlas->failed)
+	return FALSE;
+
+    atlas->failed = TRUE;
+    pict_format = PictureMatchFormat(pScreen, atlas->depth, atlas->format);
+    if (!pict_format)
+	return FALSE;
+
+    pixmap = (*pScreen->CreatePixmap) (pScreen, SAA_GLYPH_ATLAS_WIDTH,
+				       SAA_GLYPH_ATLAS_HEIGHT, atlas->depth,
+				       0);
+    if (!pixmap)
+	return FALSE;
+
+    component_alpha = SAA_GLYPH_NEEDS_COMPONENT(pict_format->format);
+    atlas->picture = CreatePicture(0, &pixmap->drawable, pict_format,
+				   CPComponentAlpha, &component_alpha,
+				   serverClient, &error);
+    (*pScreen->DestroyPixmap) (pixmap);
+    if (!atlas->picture)
+	return FALSE;
+
+    atlas->failed = FALSE;
+    return TRUE;
+}
+
+static int
+saa_glyph_lookup(struct saa_glyph_atlas *atlas, GlyphPtr glyph)
+{
+    int i;
+
+    for (i = atlas->hash[saa_glyph_hash(glyph)]; i >= 0;
+	 i = atlas->cells[i].hash_next) {
+	if (atlas->cells[i].glyph == glyph)
+	    return i;
+    }
+
+    return -1;
+}
+
+static void
+saa_glyph_unhash(struct saa_glyph_atlas *atlas, int i)
+{
+    int *link = &atlas->hash[saa_glyph_hash(atlas->cells[i].glyph)];
+
+    while (*link != i)
+	link = &atlas->cells[*link].hash_next;
+
+    *link = atlas->cells[i].hash_next;
+    atlas->cells[i].glyph = NULL;
+}
+
+/*
+ * saa_glyph_cell_free - Empty a cell and make it the next one to be reused.
+ */
+static void
+saa_glyph_cell_free(struct saa_glyph_atlas *atlas, int i)
+{
+    saa_glyph_unhash(atlas, i);
+    atlas->cells[i].serial = 0;
+    saa_glyph_lru_unlink(atlas, i);
+    saa_glyph_lru_insert(atlas, i, atlas->cells[SAA_GLYPH_LRU].lru_prev);
+}
+
+/*
+ * saa_glyph_get_cell - Find or allocate the atlas cell of a glyph.
+ *
+ * Returns the cell index, or -1 if all cells are in use by the current
+ * run. @miss is set if the glyph has to be copied into the cell.
+ */
+static int
+saa_glyph_get_cell(struct saa_glyph_atlas *atlas, GlyphPtr glyph,
+		   unsigned int serial, Bool *miss)
+{
+    struct saa_glyph_cell *cell;
+    unsigned int hash;
+    int i;
+
+    i = saa_glyph_lookup(atlas, glyph);
+    *miss = (i < 0);
+    if (i >= 0) {
+	atlas->hits++;
+    } else {
+	i = atlas->cells[SAA_GLYPH_LRU].lru_prev;
+	if (atlas->cells[i].serial == serial)
+	    return -1;
+
+	if (atlas->cells[i].glyph) {
+	    saa_glyph_unhash(atlas, i);
+	    atlas->evictions++;
+	}
+
+	hash = saa_glyph_hash(glyph);
+	atlas->cells[i].glyph = glyph;
+	atlas->cells[i].hash_next = atlas->hash[hash];
+	atlas->hash[hash] = i;
+	atlas->misses++;
+    }
+
+    cell = &atlas->cells[i];
+    cell->serial = serial;
+    saa_glyph_lru_unlink(atlas, i);
+    saa_glyph_lru_insert(atlas, i, SAA_GLYPH_LRU);
+
+    return i;
+}
+
+static Bool
+saa_glyphs_reserve(struct saa_glyphs *sglyphs, unsigned int num)
+{
+    BoxPtr boxes;
+    DDXPointPtr mask_off;
+    struct saa_glyph_upload *uploads;
+
+    if (num <= sglyphs->size)
+	return TRUE;
+
+    num = (num < 256) ? 256 : num * 2;
+    boxes = realloc(sglyphs->boxes, num * sizeof(*boxes));
+    if (!boxes)
+	return FALSE;
+    sglyphs->boxes = boxes;
+
+    mask_off = realloc(sglyphs->mask_off, num * sizeof(*mask_off));
+    if (!mask_off)
+	return FALSE;
+    sglyphs->mask_off = mask_off;
+
+    uploads = realloc(sglyphs->uploads, num * sizeof(*uploads));
+    if (!uploads)
+	return FALSE;
+    sglyphs->uploads = uploads;
+
+    sglyphs->size = num;
+    return TRUE;
+}
+
+/*
+ * saa_glyph_upload - Copy the glyphs of a run that missed the cache into
+ * the atlas shadow. They are migrated to hardware with the next
+ * composite operation that uses the atlas.
+ */
+static Bool
+saa_glyph_upload(struct saa_glyphs *sglyphs, struct saa_glyph_atlas *atlas)
+{
+    PixmapPtr atlas_pix = (PixmapPtr) atlas->picture->pDrawable;
+    ScreenPtr pScreen = atlas_pix->drawable.pScreen;
+    struct saa_pixmap *spix = saa_pixmap(atlas_pix);
+    unsigned int cpp = atlas_pix->drawable.bitsPerPixel >> 3;
+    xRectangle *rects;
+    RegionPtr region;
+    unsigned int i;
+    int y;
+
+    rects = malloc(sglyphs->num_uploads * sizeof(*rects));
+    if (!rects)
+	return FALSE;
+
+    if (!saa_prepare_access_pixmap(atlas_pix, SAA_ACCESS_W, NULL)) {
+	free(rects);
+	return FALSE;
+    }
+
+    for (i = 0; i < sglyphs->num_uploads; ++i) {
+	struct saa_glyph_upload *upload = &sglyphs->uploads[i];
+	DrawablePtr draw = upload->picture->pDrawable;
+	PixmapPtr glyph_pix = (PixmapPtr) draw;
+	int x1 = (upload->cell % SAA_GLYPH_ATLAS_COLS) * SAA_GLYPH_CELL_SIZE;
+	int y1 = (upload->cell / SAA_GLYPH_ATLAS_COLS) * SAA_GLYPH_CELL_SIZE;
+	const uint8_t *src;
+	uint8_t *dst;
+
+	rects[i].x = x1;
+	rects[i].y = y1;
+	rects[i].width = draw->width;
+	rects[i].height = draw->height;
+
+	if (!saa_pad_read(draw)) {
+	    saa_finish_access_pixmap(atlas_pix, SAA_ACCESS_W);
+	    free(rects);
+	    return FALSE;
+	}
+
+	src = glyph_pix->devPrivate.ptr;
+	dst = (uint8_t *) atlas_pix->devPrivate.ptr +
+	    y1 * atlas_pix->devKind + x1 * cpp;
+	for (y = 0; y < draw->height; ++y) {
+	    memcpy(dst, src, draw->width * cpp);
+	    src += glyph_pix->devKind;
+	    dst += atlas_pix->devKind;
+	}
+
+	saa_fad_read(draw);
+    }
+
+    saa_finish_access_pixmap(atlas_pix, SAA_ACCESS_W);
+
+    region = RECTS_TO_REGION(pScreen, sglyphs->num_uploads, rects,
+			     CT_UNSORTED);
+    free(rects);
+    if (!region)
+	return FALSE;
+
+    if (spix->damage)
+	saa_pixmap_dirty(atlas_pix, FALSE, region);
+    REGION_DESTROY(pScreen, region);
+
+    return TRUE;
+}
+
+/*
+ * saa_glyph_add_box - Clip a glyph box against the destination clip and
+ * add the result to the run.
+ */
+static Bool
+saa_glyph_add_box(ScreenPtr pScreen, struct saa_glyphs *sglyphs,
+		  unsigned int *num, RegionPtr clip, BoxPtr box,
+		  int mask_dx, int mask_dy)
+{
+    BoxPtr clip_box;
+    int n;
+
+    switch (RECT_IN_REGION(pScreen, clip, box)) {
+    case rgnOUT:
+	return TRUE;
+    case rgnIN:
+	clip_box = box;
+	n = 1;
+	break;
+    default:
+	clip_box = REGION_RECTS(clip);
+	n = REGION_NUM_RECTS(clip);
+	break;
+    }
+
+    for (; n > 0; --n, ++clip_box) {
+	BoxRec b;
+
+	b.x1 = max(box->x1, clip_box->x1);
+	b.y1 = max(box->y1, clip_box->y1);
+	b.x2 = min(box->x2, clip_box->x2);
+	b.y2 = min(box->y2, clip_box->y2);
+	if (b.x1 >= b.x2 || b.y1 >= b.y2)
+	    continue;
+
+	if (!saa_glyphs_reserve(sglyphs, *num + 1))
+	    return FALSE;
+
+	sglyphs->boxes[*num] = b;
+	sglyphs->mask_off[*num].x = mask_dx;
+	sglyphs->mask_off[*num].y = mask_dy;
+	(*num)++;
+    }
+
+    return TRUE;
+}
+
+/*
+ * saa_glyphs_atlas_run - Render a glyph run from the glyph atlas.
+ *
+ * Returns FALSE if the run can't be rendered that way, in which case
+ * nothing has been rendered.
+ */
+static Bool
+saa_glyphs_atlas_run(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+		     PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+		     int nlist, GlyphListPtr list, GlyphPtr *glyphs)
+{
+    ScreenPtr pScreen = pDst->pDrawable->pScreen;
+    struct saa_screen_priv *sscreen = saa_screen(pScreen);
+    struct saa_glyphs *sglyphs = sscreen->glyphs;
+    struct saa_driver *driver = sscreen->driver;
+    struct saa_glyph_atlas *atlas = NULL;
+    RegionPtr clip = pDst->pCompositeClip;
+    PixmapPtr dst_pix, src_pix = NULL, atlas_pix;
+    int dst_off_x, dst_off_y, src_off_x = 0, src_off_y = 0;
+    int src_dx, src_dy;
+    int x, y, xDst, yDst;
+    BoxRec extents, box;
+    RegionRec src_reg, atlas_reg;
+    RegionPtr dst_reg;
+    unsigned int num = 0, i;
+    Bool src_migrate = FALSE, dst_migrate = FALSE;
+    Bool ret = FALSE;
+    GlyphListPtr l;
+    GlyphPtr *g;
+    int n;
+
+    if (!driver->composite_prepare || pDst->alphaMap || pSrc->alphaMap)
+	return FALSE;
+
+    /*
+     * Sources are either solid or repeating, so that they don't clip
+     * the run.
+     */
+    if (pSrc->pDrawable ? !pSrc->repeat :
+	(!pSrc->pSourcePict ||
+	 pSrc->pSourcePict->type != SourcePictTypeSolidFill))
+	return FALSE;
+
+    /*
+     * With a mask format, rendering glyph by glyph is equivalent only
+     * if the glyphs don't overlap and pixels outside of the glyphs are
+     * left alone by the operator.
+     */
+    if (maskFormat && op != PictOpOver && op != PictOpAdd)
+	return FALSE;
+
+    sglyphs->serial++;
+    sglyphs->num_uploads = 0;
+    extents.x1 = extents.y1 = MAXSHORT;
+    extents.x2 = extents.y2 = MINSHORT;
+
+    dst_pix = saa_get_pixmap(pDst->pDrawable, &dst_off_x, &dst_off_y);
+    if (saa_pixmap(dst_pix)->auth_loc != saa_loc_driver ||
+	saa_pixmap_get_pin(dst_pix) == saa_pin_sw)
+	return FALSE;
+
+    /*
+     * First pass: Look up or allocate atlas cells, and compute the
+     * clipped glyph boxes in destination pixmap coordinates.
+     */
+    x = y = 0;
+    for (l = list, g = glyphs, n = nlist; n > 0; --n, ++l) {
+	int len;
+
+	x += l->xOff;
+	y += l->yOff;
+	for (len = l->len; len > 0; --len, ++g) {
+	    GlyphPtr glyph = *g;
+	    PicturePtr glyph_pict = GetGlyphPicture(glyph, pScreen);
+	    enum saa_glyph_format format;
+	    Bool miss;
+	    int cell;
+
+	    if (glyph_pict && glyph->info.width && glyph->info.height) {
+		if (glyph->info.width > SAA_GLYPH_CELL_SIZE ||
+		    glyph->info.height > SAA_GLYPH_CELL_SIZE)
+		    goto out_release;
+
+		switch (glyph_pict->format) {
+		case PICT_a8:
+		    format = saa_glyph_a8;
+		    break;
+		case PICT_a8r8g8b8:
+		    format = saa_glyph_a8r8g8b8;
+		    break;
+		default:
+		    goto out_release;
+		}
+
+		if (!atlas) {
+		    atlas = &sglyphs->atlas[format];
+		    if (maskFormat && maskFormat->format != atlas->format)
+			goto out_release;
+		    if (!saa_glyph_atlas_create(pScreen, atlas))
+			goto out_release;
+		} else if (atlas != &sglyphs->atlas[format])
+		    goto out_release;
+
+		box.x1 = x - glyph->info.x + pDst->pDrawable->x;
+		box.y1 = y - glyph->info.y + pDst->pDrawable->y;
+		box.x2 = box.x1 + glyph->info.width;
+		box.y2 = box.y1 + glyph->info.height;
+
+		if (maskFormat) {
+		    if (box.x1 < extents.x2 && box.x2 > extents.x1 &&
+			box.y1 < extents.y2 && box.y2 > extents.y1)
+			goto out_release;
+		    extents.x1 = min(extents.x1, box.x1);
+		    extents.y1 = min(extents.y1, box.y1);
+		    extents.x2 = max(extents.x2, box.x2);
+		    extents.y2 = max(extents.y2, box.y2);
+		}
+
+		if (!saa_glyphs_reserve(sglyphs, sglyphs->num_uploads + 1))
+		    goto out_release;
+		cell = saa_glyph_get_cell(atlas, glyph, sglyphs->serial, &miss);
+		if (cell < 0)
+		    goto out_release;
+		if (miss) {
+		    sglyphs->uploads[sglyphs->num_uploads].picture = glyph_pict;
+		    sglyphs->uploads[sglyphs->num_uploads++].cell = cell;
+		}
+
+		if (!saa_glyph_add_box(pScreen, sglyphs, &num, clip, &box,
+				       (cell % SAA_GLYPH_ATLAS_COLS) *
+				       SAA_GLYPH_CELL_SIZE - box.x1,
+				       (cell / SAA_GLYPH_ATLAS_COLS) *
+				       SAA_GLYPH_CELL_SIZE - box.y1))
+		    goto out_release;
+	    }
+
+	    x += glyph->info.xOff;
+	    y += glyph->info.yOff;
+	}
+    }
+
+    if (!atlas)
+	return FALSE;
+
+    /*
+     * A miss leaves a cell allocated for the glyph, so the glyph must
+     * be uploaded even if nothing of it is visible.
+     */
+    if (sglyphs->num_uploads && !saa_glyph_upload(sglyphs, atlas))
+	goto out_release;
+
+    if (num == 0)
+	return TRUE;
+
+    atlas_pix = (PixmapPtr) atlas->picture->pDrawable;
+    if (saa_pixmap(atlas_pix)->auth_loc != saa_loc_driver ||
+	saa_pixmap_get_pin(atlas_pix) == saa_pin_sw)
+	return FALSE;
+
+    for (i = 0; i < num; ++i) {
+	sglyphs->boxes[i].x1 += dst_off_x;
+	sglyphs->boxes[i].y1 += dst_off_y;
+	sglyphs->boxes[i].x2 += dst_off_x;
+	sglyphs->boxes[i].y2 += dst_off_y;
+    }
+
+    dst_reg = saa_boxes_to_region(pScreen, num, sglyphs->boxes, CT_UNSORTED);
+    if (!dst_reg)
+	return FALSE;
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = atlas_pix->drawable.width;
+    box.y2 = atlas_pix->drawable.height;
+    REGION_INIT(pScreen, &atlas_reg, &box, 1);
+
+    REGION_NULL(pScreen, &src_reg);
+    if (pSrc->pDrawable) {
+	src_pix = saa_get_pixmap(pSrc->pDrawable, &src_off_x, &src_off_y);
+	if (saa_pixmap(src_pix)->auth_loc != saa_loc_driver ||
+	    saa_pixmap_get_pin(src_pix) == saa_pin_sw)
+	    goto out;
+
+	box.x1 = pSrc->pDrawable->x + src_off_x;
+	box.y1 = pSrc->pDrawable->y + src_off_y;
+	box.x2 = box.x1 + pSrc->pDrawable->width;
+	box.y2 = box.y1 + pSrc->pDrawable->height;
+	REGION_RESET(pScreen, &src_reg, &box);
+	src_migrate = saa_migration_needed(&saa_pixmap(src_pix)->dirty_shadow,
+					   &src_reg);
+    }
+
+    if (saa_op_reads_destination(op))
+	dst_migrate = saa_migration_needed(&saa_pixmap(dst_pix)->dirty_shadow,
+					   dst_reg);
+
+    if (!driver->composite_prepare(driver, op, pSrc, atlas->picture, pDst,
+				   src_pix, atlas_pix, dst_pix,
+				   (src_pix) ? &src_reg : NULL, &atlas_reg,
+				   dst_reg))
+	goto out;
+
+    /*
+     * Source coordinates follow the destination, as in miGlyphs.
+     */
+    xDst = list->xOff;
+    yDst = list->yOff;
+    src_dx = xSrc - xDst - pDst->pDrawable->x - dst_off_x;
+    src_dy = ySrc - yDst - pDst->pDrawable->y - dst_off_y;
+    if (src_pix) {
+	src_dx += pSrc->pDrawable->x + src_off_x;
+	src_dy += pSrc->pDrawable->y + src_off_y;
+    }
+
+    for (i = 0; i < num; ++i) {
+	BoxPtr b = &sglyphs->boxes[i];
+
+	driver->composite(driver, b->x1 + src_dx, b->y1 + src_dy,
+			  b->x1 - dst_off_x + sglyphs->mask_off[i].x,
+			  b->y1 - dst_off_y + sglyphs->mask_off[i].y,
+			  b->x1, b->y1, b->x2 - b->x1, b->y2 - b->y1);
+    }
+
+    driver->composite_done(driver);
+    saa_pixmap_dirty(dst_pix, TRUE, dst_reg);
+    if (src_pix)
+	saa_pixmap_used(src_pix, TRUE, src_migrate);
+    /*
+     * Uploads of new glyphs are expected, and don't count as atlas
+     * migrations.
+     */
+    saa_pixmap_used(atlas_pix, TRUE, FALSE);
+    saa_pixmap_used(dst_pix, TRUE, dst_migrate);
+    ret = TRUE;
+
+  out:
+    REGION_UNINIT(pScreen, &src_reg);
+    REGION_UNINIT(pScreen, &atlas_reg);
+    REGION_DESTROY(pScreen, dst_reg);
+    return ret;
+
+  out_release:
+    /*
+     * Release the cells allocated for glyphs that didn't make it into
+     * the atlas.
+     */
+    for (i = 0; i < sglyphs->num_uploads; ++i)
+	saa_glyph_cell_free(atlas, sglyphs->uploads[i].cell);
+    return FALSE;
+}
+
+void
+saa_glyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+	   PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+	   int nlist, GlyphListPtr list, GlyphPtr *glyphs)
+{
+    struct saa_screen_priv *sscreen = saa_screen(pDst->pDrawable->pScreen);
+    struct saa_glyphs *sglyphs = sscreen->glyphs;
+
+    if (sglyphs && nlist > 0) {
+	sglyphs->runs++;
+	if (saa_glyphs_atlas_run(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+				 nlist, list, glyphs))
+	    return;
+	sglyphs->fallbacks++;
+    }
+
+    miGlyphs(op, pSrc, pDst, maskFormat, xSrc, ySrc, nlist, list, glyphs);
+}
+
+/*
+ * saa_unrealize_glyph - Drop a glyph that is being freed from the atlases.
+ */
+void
+saa_unrealize_glyph(ScreenPtr pScreen, GlyphPtr glyph)
+{
+    struct saa_glyphs *sglyphs = saa_screen(pScreen)->glyphs;
+    int i, cell;
+
+    if (sglyphs) {
+	for (i = 0; i < saa_glyph_num_formats; ++i) {
+	    struct saa_glyph_atlas *atlas = &sglyphs->atlas[i];
+
+	    cell = saa_glyph_lookup(atlas, glyph);
+	    if (cell < 0)
+		continue;
+
+	    saa_glyph_cell_free(atlas, cell);
+	}
+    }
+
+    miUnrealizeGlyph(pScreen, glyph);
+}
+
+/**
+ * saa_glyphs_init - Set up the glyph cache of a screen.
+ *
+ * The atlas pictures are created on first use.
+ */
+Bool
+saa_glyphs_init(ScreenPtr pScreen)
+{
+    struct saa_screen_priv *sscreen = saa_screen(pScreen);
+    struct saa_glyphs *sglyphs;
+
+    sglyphs = calloc(1, sizeof(*sglyphs));
+    if (!sglyphs)
+	return FALSE;
+
+    saa_glyph_atlas_init(&sglyphs->atlas[saa_glyph_a8], PICT_a8, 8);
+    saa_glyph_atlas_init(&sglyphs->atlas[saa_glyph_a8r8g8b8],
+			 PICT_a8r8g8b8, 32);
+    sscreen->glyphs = sglyphs;
+
+    return TRUE;
+}
+
+void
+saa_glyphs_takedown(ScreenPtr pScreen)
+{
+    struct saa_screen_priv *sscreen = saa_screen(pScreen);
+    struct saa_glyphs *sglyphs = sscreen->glyphs;
+    unsigned long hits = 0, misses = 0, evictions = 0;
+    int i;
+
+    if (!sglyphs)
+	return;
+
+    for (i = 0; i < saa_glyph_num_formats; ++i) {
+	struct saa_glyph_atlas *atlas = &sglyphs->atlas[i];
+
+	if (atlas->picture)
+	    FreePicture(atlas->picture, 0);
+	hits += atlas->hits;
+	misses += atlas->misses;
+	evictions += atlas->evictions;
+    }
+
+    LogMessageVerb(X_INFO, 3, "Glyph cache: %lu runs, %lu runs not "
+		   "accelerated, %lu hits, %lu misses, %lu evictions.\n",
+		   sglyphs->runs, sglyphs->fallbacks, hits, misses, evictions);
+
+    free(sglyphs->boxes);
+    free(sglyphs->mask_off);
+    free(sglyphs->uploads);
+    free(sglyphs);
+    sscreen->glyphs = NULL;
+}
+#endif
@@ -0,0 +1,291 @@
+/*
+ * Copyright 2013 VMWare, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL TUNGSTEN GRAPHICS AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Gradient cache. Our drivers can't sample gradient source pictures, so
+ * composite operations with a gradient source used to fall back to
+ * software as a whole, reading back the destination. Instead, the part
+ * of the gradient an operation needs is rendered once in software into a
+ * pixmap, which is then used as the source of an accelerated operation.
+ * The pixmaps are kept, keyed by gradient parameters and area, so that
+ * repeated draws of the same gradient reuse the copy the driver already
+ * holds.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "saa_priv.h"
+#include "saa.h"
+
+#ifdef RENDER
+#define SAA_GRADIENT_ENTRIES 16
+
+/*
+ * Largest area we cache, in pixels.
+ */
+#define SAA_GRADIENT_MAX_PIXELS (256 * 1024)
+
+/*
+ * Everything that determines the gradient pixels, except the color stops.
+ * Zero-filled before use so that keys can be compared with memcmp().
+ */
+struct saa_gradient_key {
+    unsigned int type;
+    xFixed geometry[6];
+    int nstops;
+    unsigned int repeat;
+    unsigned int repeat_type;
+    Bool has_transform;
+    PictTransform transform;
+};
+
+struct saa_gradient_entry {
+    struct saa_gradient_key key;
+    PictGradientStopPtr stops;
+    PicturePtr picture;
+    int x;
+    int y;
+    int width;
+    int height;
+    unsigned int serial;
+};
+
+struct saa_gradients {
+    struct saa_gradient_entry entries[SAA_GRADIENT_ENTRIES];
+    unsigned int serial;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+/*
+ * saa_gradient_key - Compute the key of a gradient source picture.
+ * Returns FALSE if the picture isn't a gradient.
+ */
+static Bool
+saa_gradient_key(PicturePtr pict, struct saa_gradient_key *key)
+{
+    SourcePictPtr source = pict->pSourcePict;
+
+    memset(key, 0, sizeof(*key));
+    key->type = source->type;
+    switch (source->type) {
+    case SourcePictTypeLinear:
+	key->geometry[0] = source->linear.p1.x;
+	key->geometry[1] = source->linear.p1.y;
+	key->geometry[2] = source->linear.p2.x;
+	key->geometry[3] = source->linear.p2.y;
+	break;
+    case SourcePictTypeRadial:
+	key->geometry[0] = source->radial.c1.x;
+	key->geometry[1] = source->radial.c1.y;
+	key->geometry[2] = source->radial.c1.radius;
+	key->geometry[3] = source->radial.c2.x;
+	key->geometry[4] = source->radial.c2.y;
+	key->geometry[5] = source->radial.c2.radius;
+	break;
+    case SourcePictTypeConical:
+	key->geometry[0] = source->conical.center.x;
+	key->geometry[1] = source->conical.center.y;
+	key->geometry[2] = source->conical.angle;
+	break;
+    default:
+	return FALSE;
+    }
+
+    key->nstops = source->gradient.nstops;
+    key->repeat = pict->repeat;
+    key->repeat_type = pict->repeatType;
+    if (pict->transform) {
+	key->has_transform = TRUE;
+	key->transform = *pict->transform;
+    }
+
+    return TRUE;
+}
+
+static void
+saa_gradient_entry_free(struct saa_gradient_entry *entry)
+{
+    if (entry->picture)
+	FreePicture(entry->picture, 0);
+    free(entry->stops);
+    memset(entry, 0, sizeof(*entry));
+}
+
+/*
+ * saa_gradient_render - Render an area of a gradient into a new picture.
+ */
+static PicturePtr
+saa_gradient_render(ScreenPtr pScreen, PicturePtr pSrc,
+		    int x, int y, int width, int height)
+{
+    PictFormatPtr pict_format;
+    PixmapPtr pixmap;
+    PicturePtr pict;
+    RegionRec region;
+    BoxRec box;
+    int error;
+
+    pict_format = PictureMatchFormat(pScreen, 32, PICT_a8r8g8b8);
+    if (!pict_format)
+	return NULL;
+
+    pixmap = (*pScreen->CreatePixmap) (pScreen, width, height, 32, 0);
+    if (!pixmap)
+	return NULL;
+
+    pict = CreatePicture(0, &pixmap->drawable, pict_format, 0, NULL,
+			 serverClient, &error);
+    (*pScreen->DestroyPixmap) (pixmap);
+    if (!pict)
+	return NULL;
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = width;
+    box.y2 = height;
+    REGION_INIT(pScreen, &region, &box, 1);
+    saa_check_composite(PictOpSrc, pSrc, NULL, pict, x, y, 0, 0, 0, 0,
+			width, height, NULL, NULL, &region);
+    REGION_UNINIT(pScreen, &region);
+
+    return pict;
+}
+
+/**
+ * saa_gradient_source - Look up or render a pixmap copy of a gradient.
+ *
+ * @pScreen: The screen.
+ * @pSrc: The gradient source picture.
+ * @x, @y, @width, @height: The area of the gradient, in source picture
+ * coordinates.
+ * @x_off, @y_off: Returns the position of @x, @y in the returned picture.
+ *
+ * Returns a picture without transform or repeat holding the area of the
+ * gradient, or NULL if the picture isn't a gradient, the area is too
+ * large, or on failure. The picture is owned by the cache, and stays
+ * valid until the next call.
+ */
+PicturePtr
+saa_gradient_source(ScreenPtr pScreen, PicturePtr pSrc,
+		    int x, int y, int width, int height,
+		    int *x_off, int *y_off)
+{
+    struct saa_gradients *sgradients = saa_screen(pScreen)->gradients;
+    struct saa_gradient_entry *entry, *victim = NULL;
+    struct saa_gradient_key key;
+    size_t stops_size;
+    int i;
+
+    if (!sgradients || pSrc->pDrawable || !pSrc->pSourcePict ||
+	pSrc->alphaMap || width <= 0 || height <= 0 ||
+	(unsigned long) width * height > SAA_GRADIENT_MAX_PIXELS)
+	return NULL;
+
+    if (!saa_gradient_key(pSrc, &key) || key.nstops <= 0)
+	return NULL;
+
+    stops_size = key.nstops * sizeof(PictGradientStop);
+    for (i = 0; i < SAA_GRADIENT_ENTRIES; ++i) {
+	entry = &sgradients->entries[i];
+
+	if (!entry->picture) {
+	    victim = entry;
+	    continue;
+	}
+
+	if (memcmp(&entry->key, &key, sizeof(key)) == 0 &&
+	    memcmp(entry->stops, pSrc->pSourcePict->gradient.stops,
+		   stops_size) == 0 &&
+	    x >= entry->x && y >= entry->y &&
+	    x + width <= entry->x + entry->width &&
+	    y + height <= entry->y + entry->height) {
+	    sgradients->hits++;
+	    goto out_found;
+	}
+
+	if (!victim || (victim->picture &&
+			(int) (entry->serial - victim->serial) < 0))
+	    victim = entry;
+    }
+
+    sgradients->misses++;
+    entry = victim;
+    saa_gradient_entry_free(entry);
+
+    entry->stops = malloc(stops_size);
+    if (!entry->stops)
+	return NULL;
+    memcpy(entry->stops, pSrc->pSourcePict->gradient.stops, stops_size);
+
+    entry->picture = saa_gradient_render(pScreen, pSrc, x, y, width, height);
+    if (!entry->picture) {
+	saa_gradient_entry_free(entry);
+	return NULL;
+    }
+
+    entry->key = key;
+    entry->x = x;
+    entry->y = y;
+    entry->width = width;
+    entry->height = height;
+
+  out_found:
+    entry->serial = ++sgradients->serial;
+    *x_off = x - entry->x;
+    *y_off = y - entry->y;
+    return entry->picture;
+}
+
+/**
+ * saa_gradients_init - Set up the gradient cache of a screen.
+ */
+Bool
+saa_gradients_init(ScreenPtr pScreen)
+{
+    struct saa_screen_priv *sscreen = saa_screen(pScreen);
+
+    sscreen->gradients = calloc(1, sizeof(*sscreen->gradients));
+    return (sscreen->gradients != NULL);
+}
+
+void
+saa_gradients_takedown(ScreenPtr pScreen)
+{
+    struct saa_screen_priv *sscreen = saa_screen(pScreen);
+    struct saa_gradients *sgradients = sscreen->gradients;
+    int i;
+
+    if (!sgradients)
+	return;
+
+    for (i = 0; i < SAA_GRADIENT_ENTRIES; ++i)
+	saa_gradient_entry_free(&sgradients->entries[i]);
+
+    LogMessageVerb(X_INFO, 3, "Gradient cache: %lu hits, %lu misses.\n",
+		   sgradients->hits, sgradients->misses);
+
+    free(sgradients);
+    sscreen->gradients = NULL;
+}
+#endif
@@ -134,6 +134,7 @@ saa_destroy_pixmap(PixmapPtr pPixmap)
 
 	REGION_UNINIT(pScreen, &spix->dirty_hw);
 	REGION_UNINIT(pScreen, &spix->dirty_shadow);
+	saa_tiles_destroy(spix);
 	spix->damage = NULL;
     }
 
@@ -193,22 +194,111 @@ saa_pixmap_dirty(PixmapPtr pixmap, Bool hw, RegionPtr reg)
 {
     struct saa_pixmap *spix = saa_pixmap(pixmap);
     struct saa_screen_priv *sscreen = saa_screen(pixmap->drawable.pScreen);
+    RegionPtr dirty = (hw) ? &spix->dirty_hw : &spix->dirty_shadow;
+    RegionPtr other = (hw) ? &spix->dirty_shadow : &spix->dirty_hw;
+    struct saa_tiles *tiles = saa_pixmap_tiles(pixmap, spix);
+    Bool overlap = TRUE;
 
-    if (hw) {
-	REGION_UNION(pixmap->drawable.pScreen, &spix->dirty_hw,
-		     &spix->dirty_hw, reg);
-	REGION_SUBTRACT(pixmap->drawable.pScreen, &spix->dirty_shadow,
-			&spix->dirty_shadow, reg);
-    } else {
-	REGION_UNION(pixmap->drawable.pScreen, &spix->dirty_shadow,
-		     &spix->dirty_shadow, reg);
-	REGION_SUBTRACT(pixmap->drawable.pScreen, &spix->dirty_hw,
-			&spix->dirty_hw, reg);
+    /*
+     * With tile bitmaps, skip the subtraction if the new damage
+     * can't intersect the opposite dirty region.
+     */
+    if (tiles) {
+	overlap = saa_tiles_mark(tiles, hw, reg);
+	if (!REGION_NOTEMPTY(pixmap->drawable.pScreen, other)) {
+	    saa_tiles_clear(tiles, !hw);
+	    overlap = FALSE;
+	}
     }
 
+    REGION_UNION(pixmap->drawable.pScreen, dirty, dirty, reg);
+    if (overlap)
+	REGION_SUBTRACT(pixmap->drawable.pScreen, other, other, reg);
+
     sscreen->driver->damage(sscreen->driver, pixmap, hw, reg);
 }
 
+/*
+ * Migration tracking. A pixmap that migrates between software and
+ * hardware SAA_MIGRATE_PIN times within SAA_MIGRATE_WINDOW milliseconds
+ * is pinned to the side that used it the most during that window,
+ * for SAA_PIN_TIME milliseconds.
+ */
+#define SAA_MIGRATE_WINDOW 1000
+#define SAA_MIGRATE_PIN    8
+#define SAA_PIN_TIME       5000
+
+static void
+saa_migrate_window(PixmapPtr pixmap, struct saa_pixmap *spix, CARD32 now)
+{
+    CARD32 elapsed = now - spix->window_start;
+
+    if (spix->pin != saa_pin_none) {
+	if (elapsed < SAA_PIN_TIME)
+	    return;
+	LogMessageVerb(X_INFO, 7, "Unpinning pixmap %p.\n", pixmap);
+	spix->pin = saa_pin_none;
+    } else if (elapsed < SAA_MIGRATE_WINDOW)
+	return;
+
+    spix->window_start = now;
+    spix->window_migrations = 0;
+    spix->window_sw = 0;
+    spix->window_hw = 0;
+}
+
+/**
+ * saa_pixmap_get_pin - Return the current pinning state of a pixmap.
+ */
+enum saa_pixmap_pin
+saa_pixmap_get_pin(PixmapPtr pixmap)
+{
+    struct saa_pixmap *spix = saa_pixmap(pixmap);
+
+    if (spix->pin != saa_pin_none)
+	saa_migrate_window(pixmap, spix, GetTimeInMillis());
+
+    return spix->pin;
+}
+
+/**
+ * saa_pixmap_used - Record that a pixmap was used by software or hardware.
+ *
+ * @pixmap: The pixmap.
+ * @hw: Whether it was used by hardware.
+ * @migrated: Whether the use required migrating contents.
+ */
+void
+saa_pixmap_used(PixmapPtr pixmap, Bool hw, Bool migrated)
+{
+    struct saa_pixmap *spix = saa_pixmap(pixmap);
+    CARD32 now = GetTimeInMillis();
+
+    saa_migrate_window(pixmap, spix, now);
+
+    if (hw)
+	spix->window_hw++;
+    else
+	spix->window_sw++;
+
+    if (!migrated || spix->scratch)
+	return;
+
+    spix->migrations++;
+    if (++spix->window_migrations < SAA_MIGRATE_PIN ||
+	spix->pin != saa_pin_none)
+	return;
+
+    spix->pin = (spix->window_sw >= spix->window_hw) ?
+	saa_pin_sw : saa_pin_hw;
+    spix->window_start = now;
+
+    LogMessageVerb(X_INFO, 7, "Pinning pixmap %p in %s after %u "
+		   "migrations.\n", pixmap,
+		   (spix->pin == saa_pin_sw) ? "software" : "hardware",
+		   spix->migrations);
+}
+
 void
 saa_drawable_dirty(DrawablePtr draw, Bool hw, RegionPtr reg)
 {
@@ -58,6 +58,10 @@
 #ifdef RENDER
 #include "glyphstr.h"
 #endif
+#include <sys/time.h>
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
 #include "damage.h"
 
 #define SAA_INVALID_ADDRESS \
@@ -69,6 +73,38 @@ struct saa_gc_priv {
     GCFuncs *saved_funcs;
 };
 
+/*
+ * Software fallback entry points, for fallback statistics.
+ */
+enum saa_fallback_op {
+    SAA_OP_FILL_SPANS,
+    SAA_OP_SET_SPANS,
+    SAA_OP_PUT_IMAGE,
+    SAA_OP_COPY_NTON,
+    SAA_OP_COPY_AREA,
+    SAA_OP_COPY_PLANE,
+    SAA_OP_POLY_POINT,
+    SAA_OP_POLY_LINES,
+    SAA_OP_POLY_SEGMENT,
+    SAA_OP_POLY_ARC,
+    SAA_OP_POLY_FILL_RECT,
+    SAA_OP_IMAGE_GLYPH_BLT,
+    SAA_OP_POLY_GLYPH_BLT,
+    SAA_OP_PUSH_PIXELS,
+    SAA_OP_COPY_WINDOW,
+    SAA_OP_GET_IMAGE,
+    SAA_OP_GET_SPANS,
+    SAA_OP_COMPOSITE,
+    SAA_OP_ADD_TRAPS,
+    SAA_OP_NUM
+};
+
+struct saa_fallback_stat {
+    unsigned long count;
+    unsigned long long usecs;
+    unsigned long long readback_bytes;
+};
+
 struct saa_screen_priv {
     struct saa_driver *driver;
     CreateGCProcPtr saved_CreateGC;
@@ -92,8 +128,20 @@ struct saa_screen_priv {
     SourceValidateProcPtr saved_SourceValidate;
 #endif
     Bool fallback_debug;
+    Bool dirty_tiles;
+    struct saa_threads *threads;
+    struct saa_glyphs *glyphs;
+    struct saa_gradients *gradients;
+#ifdef RENDER
+    PicturePtr scratch_mask;
+#endif
 
     unsigned int fallback_count;
+    enum saa_fallback_op fallback_op;
+    unsigned long long fallback_start;
+    unsigned long long fallback_readback;
+    struct saa_fallback_stat fallback_stats[SAA_OP_NUM];
+    unsigned long long validate_gc_readback;
 
     RegionRec srcReg;
     RegionRec maskReg;
@@ -114,6 +162,66 @@ do {								\
 #define SAA_FALLBACK(x)
 #endif
 
+/*
+ * Optional USDT probes, for use with systemtap, bpftrace or LTTng.
+ */
+#ifdef HAVE_SYS_SDT_H
+#define SAA_PROBE1(name, a)	DTRACE_PROBE1(saa, name, a)
+#define SAA_PROBE3(name, a, b, c) DTRACE_PROBE3(saa, name, a, b, c)
+#else
+#define SAA_PROBE1(name, a)
+#define SAA_PROBE3(name, a, b, c)
+#endif
+
+static inline unsigned long long
+saa_time_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (unsigned long long) tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+/*
+ * saa_fallback_enter - Mark the start of a software fallback.
+ *
+ * Fallbacks may nest, for example through CreatePixmap or ValidateGC.
+ * Only the outermost one is accounted for, so that readbacks are
+ * attributed to the operation the client asked for.
+ */
+static inline void
+saa_fallback_enter(struct saa_screen_priv *sscreen, enum saa_fallback_op op)
+{
+    if (sscreen->fallback_count++ != 0)
+	return;
+
+    sscreen->fallback_op = op;
+    sscreen->fallback_start = saa_time_us();
+    sscreen->fallback_readback = 0;
+    SAA_PROBE1(fallback_start, op);
+}
+
+/*
+ * saa_fallback_leave - Mark the end of a software fallback.
+ */
+static inline void
+saa_fallback_leave(struct saa_screen_priv *sscreen)
+{
+    struct saa_fallback_stat *stat;
+    unsigned long long usecs;
+
+    if (--sscreen->fallback_count != 0)
+	return;
+
+    stat = &sscreen->fallback_stats[sscreen->fallback_op];
+    usecs = saa_time_us() - sscreen->fallback_start;
+    stat->count++;
+    stat->usecs += usecs;
+    stat->readback_bytes += sscreen->fallback_readback;
+    SAA_PROBE3(fallback_done, sscreen->fallback_op, usecs,
+	       sscreen->fallback_readback);
+}
+
 /*
  * Some macros to deal with function wrapping.
  */
@@ -192,6 +300,13 @@ extern void
 saa_check_fill_spans(DrawablePtr pDrawable, GCPtr pGC, int nspans,
 		     DDXPointPtr ppt, int *pwidth, int fSorted);
 extern void
+saa_check_put_image(DrawablePtr pDrawable, GCPtr pGC, int depth,
+		    int x, int y, int w, int h, int leftPad, int format,
+		    char *bits);
+extern void
+saa_check_get_image(DrawablePtr pDrawable, int x, int y, int w, int h,
+		    unsigned int format, unsigned long planeMask, char *d);
+extern void
 saa_check_poly_fill_rect(DrawablePtr pDrawable, GCPtr pGC,
 			 int nrect, xRectangle * prect);
 extern RegionPtr
@@ -219,10 +334,25 @@ saa_hw_copy_nton(DrawablePtr pSrcDrawable,
 		 BoxPtr pbox,
 		 int nbox, int dx, int dy, Bool reverse, Bool upsidedown);
 
+extern void
+saa_poly_fill_rect(DrawablePtr pDrawable, GCPtr pGC,
+		   int nrect, xRectangle * prect);
+
+extern void
+saa_put_image(DrawablePtr pDrawable, GCPtr pGC, int depth, int x, int y,
+	      int w, int h, int leftPad, int format, char *bits);
+
+extern void
+saa_get_image(DrawablePtr pDrawable, int x, int y, int w, int h,
+	      unsigned int format, unsigned long planeMask, char *d);
+
 #ifdef RENDER
 extern void
 saa_render_setup(ScreenPtr pScreen);
 
+extern void
+saa_render_release(ScreenPtr pScreen);
+
 extern void
 saa_render_takedown(ScreenPtr pScreen);
 
@@ -259,9 +389,109 @@ saa_pix_damage_pending(struct saa_pixmap *spix)
     return (spix->damage ? DamagePendingRegion(spix->damage) : NULL);
 }
 
+/*
+ * Conservative check whether using @reg requires migrating contents
+ * from @dirty.
+ */
+static inline Bool
+saa_migration_needed(RegionPtr dirty, RegionPtr reg)
+{
+    return (reg && REGION_NOTEMPTY(pScreen, dirty) &&
+	    REGION_NOTEMPTY(pScreen, reg) &&
+	    RECT_IN_REGION(pScreen, dirty, REGION_EXTENTS(pScreen, reg)) != rgnOUT);
+}
+
+extern void
+saa_pixmap_used(PixmapPtr pixmap, Bool hw, Bool migrated);
+
+/*
+ * Largest number of tiles a repeating source or a fill tile may be
+ * expanded into with hardware copies. Small tiles covering large areas
+ * are better left to the CPU.
+ */
+#define SAA_COPY_MAX_TILES 16
+
+/*
+ * saa_floor_div - Integer division rounding towards minus infinity.
+ */
+static inline int
+saa_floor_div(int a, int b)
+{
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+/*
+ * saa_tiles.c
+ */
+extern struct saa_tiles *
+saa_pixmap_tiles(PixmapPtr pixmap, struct saa_pixmap *spix);
+
+extern void
+saa_tiles_destroy(struct saa_pixmap *spix);
+
+extern Bool
+saa_tiles_mark(struct saa_tiles *tiles, Bool hw, RegionPtr reg);
+
+extern void
+saa_tiles_clear(struct saa_tiles *tiles, Bool hw);
+
+extern RegionPtr
+saa_tiles_round_region(ScreenPtr pScreen, const struct saa_tiles *tiles,
+		       RegionPtr reg);
+
+/*
+ * saa_threads.c
+ */
+extern Bool
+saa_threads_init(struct saa_screen_priv *sscreen, unsigned int num_threads);
+
+extern void
+saa_threads_takedown(struct saa_screen_priv *sscreen);
+
+extern Bool
+saa_threads_fill_rect(DrawablePtr pDrawable, GCPtr pGC,
+		      int nrect, xRectangle *prect);
+
+extern Bool
+saa_threads_copy(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+		 BoxPtr pbox, int nbox, int dx, int dy);
+
 extern RegionPtr
 saa_boxes_to_region(ScreenPtr pScreen, int nbox, BoxPtr pbox, int ordering);
 
+/*
+ * saa_glyphs.c
+ */
+#ifdef RENDER
+extern Bool
+saa_glyphs_init(ScreenPtr pScreen);
+
+extern void
+saa_glyphs_takedown(ScreenPtr pScreen);
+
+extern void
+saa_glyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+	   PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+	   int nlist, GlyphListPtr list, GlyphPtr *glyphs);
+
+extern void
+saa_unrealize_glyph(ScreenPtr pScreen, GlyphPtr glyph);
+
+/*
+ * saa_gradients.c
+ */
+extern Bool
+saa_gradients_init(ScreenPtr pScreen);
+
+extern void
+saa_gradients_takedown(ScreenPtr pScreen);
+
+extern PicturePtr
+saa_gradient_source(ScreenPtr pScreen, PicturePtr pSrc,
+		    int x, int y, int width, int height,
+		    int *x_off, int *y_off);
+#endif
+
 
 Bool
 saa_compute_composite_regions(ScreenPtr pScreen,
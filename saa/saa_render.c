@@ -27,6 +27,7 @@
  * Author: Michel Dänzer <michel@tungstengraphics.com>
  * Author: Thomas Hellstrom <thellstrom@vmware.com>
  */
+#include <string.h>
 #include "saa.h"
 #include "saa_priv.h"
 
@@ -83,9 +84,228 @@ saa_create_alpha_picture(ScreenPtr pScreen,
     return pPicture;
 }
 
+/*
+ * Largest scratch mask, in pixels, kept between trapezoid and triangle
+ * calls. Larger masks are allocated per call.
+ */
+#define SAA_SCRATCH_MASK_MAX (1024 * 1024)
+#define SAA_SCRATCH_MASK_ALIGN 64
+
+/*
+ * An alpha mask for software rasterization of trapezoids and triangles.
+ */
+struct saa_mask {
+    PicturePtr pict;
+    saa_access_t access;
+    Bool scratch;
+    int width;
+    int height;
+};
+
+/*
+ * saa_scratch_mask - Return the screen's scratch mask picture, reallocating
+ * it if it has the wrong format or is too small.
+ */
+static PicturePtr
+saa_scratch_mask(ScreenPtr pScreen, PictFormatPtr pPictFormat,
+		 int width, int height)
+{
+    struct saa_screen_priv *sscreen = saa_screen(pScreen);
+    PicturePtr pict = sscreen->scratch_mask;
+    PixmapPtr pPixmap;
+    int error;
+
+    if (pict && pict->pFormat == pPictFormat &&
+	pict->pDrawable->width >= width && pict->pDrawable->height >= height)
+	return pict;
+
+    /*
+     * Grow, rather than shrink, a mask of the right format.
+     */
+    if (pict && pict->pFormat == pPictFormat &&
+	(unsigned long) max(width, pict->pDrawable->width) *
+	max(height, pict->pDrawable->height) <= SAA_SCRATCH_MASK_MAX) {
+	width = max(width, pict->pDrawable->width);
+	height = max(height, pict->pDrawable->height);
+    }
+
+    if (pict) {
+	FreePicture(pict, 0);
+	sscreen->scratch_mask = NULL;
+    }
+
+    width = (width + SAA_SCRATCH_MASK_ALIGN - 1) & ~(SAA_SCRATCH_MASK_ALIGN - 1);
+    height = (height + SAA_SCRATCH_MASK_ALIGN - 1) &
+	~(SAA_SCRATCH_MASK_ALIGN - 1);
+
+    pPixmap = (*pScreen->CreatePixmap) (pScreen, width, height,
+					pPictFormat->depth, 0);
+    if (!pPixmap)
+	return NULL;
+
+    saa_pixmap(pPixmap)->scratch = TRUE;
+    pict = CreatePicture(0, &pPixmap->drawable, pPictFormat,
+			 0, 0, serverClient, &error);
+    (*pScreen->DestroyPixmap) (pPixmap);
+    sscreen->scratch_mask = pict;
+
+    return pict;
+}
+
+/*
+ * saa_mask_begin - Set up a cleared alpha mask of @width x @height for
+ * software rasterization.
+ *
+ * Masks up to SAA_SCRATCH_MASK_MAX pixels use the screen's scratch mask.
+ * That avoids allocating a pixmap, and, once the driver has set up
+ * hardware storage for it, an upload buffer, for every call. Only the
+ * rasterized area is cleared and marked dirty, so only that area is
+ * uploaded.
+ */
+static Bool
+saa_mask_begin(ScreenPtr pScreen, PicturePtr pDst, PictFormatPtr pPictFormat,
+	       int width, int height, struct saa_mask *mask)
+{
+    PixmapPtr pPixmap;
+    unsigned int stride;
+    uint8_t *row;
+    int y;
+
+    mask->width = width;
+    mask->height = height;
+
+    if ((unsigned long) width * height > SAA_SCRATCH_MASK_MAX) {
+	mask->scratch = FALSE;
+	mask->pict = saa_create_alpha_picture(pScreen, pDst, pPictFormat,
+					      width, height);
+	if (!mask->pict)
+	    return FALSE;
+
+	if (!saa_pad_write(mask->pict->pDrawable, NULL, FALSE,
+			   &mask->access)) {
+	    FreePicture(mask->pict, 0);
+	    return FALSE;
+	}
+
+	return TRUE;
+    }
+
+    mask->scratch = TRUE;
+    mask->access = SAA_ACCESS_W;
+    mask->pict = saa_scratch_mask(pScreen, pPictFormat, width, height);
+    if (!mask->pict)
+	return FALSE;
+
+    pPixmap = (PixmapPtr) mask->pict->pDrawable;
+    if (!saa_prepare_access_pixmap(pPixmap, SAA_ACCESS_W, NULL))
+	return FALSE;
+
+    stride = (width * pPixmap->drawable.bitsPerPixel + 7) >> 3;
+    row = pPixmap->devPrivate.ptr;
+    for (y = 0; y < height; ++y, row += pPixmap->devKind)
+	memset(row, 0, stride);
+
+    return TRUE;
+}
+
+/*
+ * saa_mask_end - Finish software rasterization into an alpha mask.
+ */
+static void
+saa_mask_end(ScreenPtr pScreen, struct saa_mask *mask)
+{
+    PixmapPtr pPixmap = (PixmapPtr) mask->pict->pDrawable;
+    RegionRec region;
+    BoxRec box;
+
+    if (!mask->scratch) {
+	saa_fad_write(mask->pict->pDrawable, mask->access);
+	return;
+    }
+
+    saa_finish_access_pixmap(pPixmap, mask->access);
+    if (!saa_pixmap(pPixmap)->damage)
+	return;
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = mask->width;
+    box.y2 = mask->height;
+    REGION_INIT(pScreen, &region, &box, 1);
+    saa_pixmap_dirty(pPixmap, FALSE, &region);
+    REGION_UNINIT(pScreen, &region);
+}
+
+static void
+saa_mask_release(struct saa_mask *mask)
+{
+    if (!mask->scratch)
+	FreePicture(mask->pict, 0);
+}
+
+/*
+ * saa_picture_is_solid - Whether a source picture has the same value
+ * everywhere, so that its origin doesn't matter.
+ */
+static Bool
+saa_picture_is_solid(PicturePtr pict)
+{
+    if (pict->pDrawable)
+	return (pict->repeat && !pict->transform &&
+		pict->pDrawable->width == 1 && pict->pDrawable->height == 1);
+
+    return (pict->pSourcePict &&
+	    pict->pSourcePict->type == SourcePictTypeSolidFill);
+}
+
+/*
+ * saa_box_add_disjoint - Add a box to the extents of a set of boxes.
+ *
+ * Returns FALSE if the box intersects the extents, which is a
+ * conservative check that the box may intersect any of the boxes.
+ */
+static Bool
+saa_box_add_disjoint(BoxPtr extents, const BoxRec *box)
+{
+    if (box->x1 >= box->x2 || box->y1 >= box->y2)
+	return TRUE;
+
+    if (extents->x1 < extents->x2 &&
+	box->x1 < extents->x2 && box->x2 > extents->x1 &&
+	box->y1 < extents->y2 && box->y2 > extents->y1)
+	return FALSE;
+
+    if (extents->x1 >= extents->x2) {
+	*extents = *box;
+	return TRUE;
+    }
+
+    extents->x1 = min(extents->x1, box->x1);
+    extents->y1 = min(extents->y1, box->y1);
+    extents->x2 = max(extents->x2, box->x2);
+    extents->y2 = max(extents->y2, box->y2);
+    return TRUE;
+}
+
+/*
+ * saa_can_batch - Whether primitives rendered without a mask format can
+ * be rasterized into a single mask.
+ *
+ * That gives the same result as compositing them one by one if the
+ * operator leaves pixels outside of the primitives alone, the source
+ * doesn't depend on the per-primitive source origin, and no pixel is
+ * touched by more than one primitive.
+ */
+static Bool
+saa_can_batch(CARD8 op, PicturePtr pSrc, int num)
+{
+    return (num > 1 && (op == PictOpOver || op == PictOpAdd) &&
+	    saa_picture_is_solid(pSrc));
+}
+
 /**
- * saa_trapezoids is essentially a copy of miTrapezoids that uses
- * saa_create_alpha_picture instead of miCreateAlphaPicture.
+ * saa_trapezoids is essentially a copy of miTrapezoids that rasterizes
+ * into an saa_mask instead of an miCreateAlphaPicture picture.
  *
  * The problem with miCreateAlphaPicture is that it calls PolyFillRect
  * to initialize the contents after creating the pixmap, which
@@ -104,10 +324,9 @@ saa_trapezoids(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
     BoxRec bounds;
 
     if (maskFormat) {
-	PicturePtr pPicture;
+	struct saa_mask mask;
 	INT16 xDst, yDst;
 	INT16 xRel, yRel;
-	saa_access_t access;
 
 	miTrapezoidBounds(ntrap, traps, &bounds);
 
@@ -117,38 +336,53 @@ saa_trapezoids(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
 	xDst = traps[0].left.p1.x >> 16;
 	yDst = traps[0].left.p1.y >> 16;
 
-	pPicture = saa_create_alpha_picture(pScreen, pDst, maskFormat,
-					    bounds.x2 - bounds.x1,
-					    bounds.y2 - bounds.y1);
-	if (!pPicture)
+	if (!saa_mask_begin(pScreen, pDst, maskFormat,
+			    bounds.x2 - bounds.x1, bounds.y2 - bounds.y1,
+			    &mask))
 	    return;
 
-	if (saa_pad_write(pPicture->pDrawable, NULL, FALSE, &access)) {
-	    for (; ntrap; ntrap--, traps++)
-		(*ps->RasterizeTrapezoid) (pPicture, traps,
-					   -bounds.x1, -bounds.y1);
-	    saa_fad_write(pPicture->pDrawable, access);
-	}
+	for (; ntrap; ntrap--, traps++)
+	    (*ps->RasterizeTrapezoid) (mask.pict, traps,
+				       -bounds.x1, -bounds.y1);
+	saa_mask_end(pScreen, &mask);
 
 	xRel = bounds.x1 + xSrc - xDst;
 	yRel = bounds.y1 + ySrc - yDst;
-	CompositePicture(op, pSrc, pPicture, pDst,
+	CompositePicture(op, pSrc, mask.pict, pDst,
 			 xRel, yRel, 0, 0, bounds.x1, bounds.y1,
 			 bounds.x2 - bounds.x1, bounds.y2 - bounds.y1);
-	FreePicture(pPicture, 0);
+	saa_mask_release(&mask);
     } else {
 	if (pDst->polyEdge == PolyEdgeSharp)
 	    maskFormat = PictureMatchFormat(pScreen, 1, PICT_a1);
 	else
 	    maskFormat = PictureMatchFormat(pScreen, 8, PICT_a8);
+
+	if (saa_can_batch(op, pSrc, ntrap)) {
+	    BoxRec extents = { 0, 0, 0, 0 };
+	    int i;
+
+	    for (i = 0; i < ntrap; ++i) {
+		miTrapezoidBounds(1, &traps[i], &bounds);
+		if (!saa_box_add_disjoint(&extents, &bounds))
+		    break;
+	    }
+
+	    if (i == ntrap) {
+		saa_trapezoids(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+			       ntrap, traps);
+		return;
+	    }
+	}
+
 	for (; ntrap; ntrap--, traps++)
 	    saa_trapezoids(op, pSrc, pDst, maskFormat, xSrc, ySrc, 1, traps);
     }
 }
 
 /**
- * saa_triangles is essentially a copy of miTriangles that uses
- * saa_create_alpha_picture instead of miCreateAlphaPicture.
+ * saa_triangles is essentially a copy of miTriangles that rasterizes
+ * into an saa_mask instead of an miCreateAlphaPicture picture.
  *
  * The problem with miCreateAlphaPicture is that it calls PolyFillRect
  * to initialize the contents after creating the pixmap, which
@@ -166,10 +400,9 @@ saa_triangles(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
     BoxRec bounds;
 
     if (maskFormat) {
-	PicturePtr pPicture;
+	struct saa_mask mask;
 	INT16 xDst, yDst;
 	INT16 xRel, yRel;
-	saa_access_t access;
 
 	miTriangleBounds(ntri, tris, &bounds);
 
@@ -179,34 +412,83 @@ saa_triangles(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
 	xDst = tris[0].p1.x >> 16;
 	yDst = tris[0].p1.y >> 16;
 
-	pPicture = saa_create_alpha_picture(pScreen, pDst, maskFormat,
-					    bounds.x2 - bounds.x1,
-					    bounds.y2 - bounds.y1);
-	if (!pPicture)
+	if (!saa_mask_begin(pScreen, pDst, maskFormat,
+			    bounds.x2 - bounds.x1, bounds.y2 - bounds.y1,
+			    &mask))
 	    return;
 
-	if (saa_pad_write(pPicture->pDrawable, NULL, FALSE, &access)) {
-	    (*ps->AddTriangles) (pPicture, -bounds.x1, -bounds.y1, ntri, tris);
-	    saa_fad_write(pPicture->pDrawable, access);
-	}
+	(*ps->AddTriangles) (mask.pict, -bounds.x1, -bounds.y1, ntri, tris);
+	saa_mask_end(pScreen, &mask);
 
 	xRel = bounds.x1 + xSrc - xDst;
 	yRel = bounds.y1 + ySrc - yDst;
-	CompositePicture(op, pSrc, pPicture, pDst,
+	CompositePicture(op, pSrc, mask.pict, pDst,
 			 xRel, yRel, 0, 0, bounds.x1, bounds.y1,
 			 bounds.x2 - bounds.x1, bounds.y2 - bounds.y1);
-	FreePicture(pPicture, 0);
+	saa_mask_release(&mask);
     } else {
 	if (pDst->polyEdge == PolyEdgeSharp)
 	    maskFormat = PictureMatchFormat(pScreen, 1, PICT_a1);
 	else
 	    maskFormat = PictureMatchFormat(pScreen, 8, PICT_a8);
 
+	if (saa_can_batch(op, pSrc, ntri)) {
+	    BoxRec extents = { 0, 0, 0, 0 };
+	    int i;
+
+	    for (i = 0; i < ntri; ++i) {
+		miTriangleBounds(1, &tris[i], &bounds);
+		if (!saa_box_add_disjoint(&extents, &bounds))
+		    break;
+	    }
+
+	    if (i == ntri) {
+		saa_triangles(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+			      ntri, tris);
+		return;
+	    }
+	}
+
 	for (; ntri; ntri--, tris++)
 	    saa_triangles(op, pSrc, pDst, maskFormat, xSrc, ySrc, 1, tris);
     }
 }
 
+/*
+ * saa_is_ca_over - Whether an operation is a component-alpha Over, which
+ * drivers typically can't do in one pass, since it needs both the source
+ * alpha and the source color as blend factors.
+ */
+static inline Bool
+saa_is_ca_over(CARD8 op, PicturePtr pMask)
+{
+    return (op == PictOpOver && pMask && pMask->componentAlpha &&
+	    PICT_FORMAT_RGB(pMask->format) != 0);
+}
+
+static void
+saa_driver_composite_rects(struct saa_driver *driver, RegionPtr dst_reg,
+			   int xSrc, int ySrc, int xMask, int yMask)
+{
+    BoxPtr pbox = REGION_RECTS(dst_reg);
+    int nbox = REGION_NUM_RECTS(dst_reg);
+
+    while (nbox--) {
+	driver->composite(driver,
+			  pbox->x1 + xSrc,
+			  pbox->y1 + ySrc,
+			  pbox->x1 + xMask,
+			  pbox->y1 + yMask,
+			  pbox->x1,
+			  pbox->y1,
+			  pbox->x2 - pbox->x1,
+			  pbox->y2 - pbox->y1);
+	pbox++;
+    }
+
+    driver->composite_done(driver);
+}
+
 static Bool
 saa_driver_composite(CARD8		op,
 		     PicturePtr	pSrc,
@@ -225,72 +507,142 @@ saa_driver_composite(CARD8		op,
 		     RegionPtr dst_reg)
 {
     struct saa_screen_priv *sscreen = saa_screen(pDst->pDrawable->pScreen);
-    BoxPtr pbox;
-    int nbox;
     int src_off_x, src_off_y, mask_off_x, mask_off_y, dst_off_x, dst_off_y;
     PixmapPtr src_pix = NULL, mask_pix = NULL, dst_pix;
     struct saa_driver *driver = sscreen->driver;
+    Bool src_migrate = FALSE, mask_migrate = FALSE, dst_migrate = FALSE;
+    Bool two_pass;
+    int x_src, y_src, x_mask, y_mask, x_dst, y_dst;
 
     if (!driver->composite_prepare)
 	return FALSE;
 
+    /*
+     * Drivers don't see alpha maps. Source and mask alpha maps are
+     * staged by saa_alpha_map_composite().
+     */
+    if (pSrc->alphaMap || (pMask && pMask->alphaMap) || pDst->alphaMap)
+	return FALSE;
+
     dst_pix = saa_get_pixmap(pDst->pDrawable, &dst_off_x, &dst_off_y);
-    if (saa_pixmap(dst_pix)->auth_loc != saa_loc_driver)
+    if (saa_pixmap(dst_pix)->auth_loc != saa_loc_driver ||
+	saa_pixmap_get_pin(dst_pix) == saa_pin_sw)
 	return FALSE;
 
     if (pMask && pMask->pDrawable) {
 	mask_pix = saa_get_pixmap(pMask->pDrawable, &mask_off_x, &mask_off_y);
-	if (saa_pixmap(mask_pix)->auth_loc != saa_loc_driver)
+	if (saa_pixmap(mask_pix)->auth_loc != saa_loc_driver ||
+	    saa_pixmap_get_pin(mask_pix) == saa_pin_sw)
 	    return FALSE;
+	mask_migrate = saa_migration_needed(&saa_pixmap(mask_pix)->dirty_shadow,
+					    mask_reg);
     }
     if (pSrc->pDrawable) {
 	src_pix = saa_get_pixmap(pSrc->pDrawable, &src_off_x, &src_off_y);
-	if (saa_pixmap(src_pix)->auth_loc != saa_loc_driver)
+	if (saa_pixmap(src_pix)->auth_loc != saa_loc_driver ||
+	    saa_pixmap_get_pin(src_pix) == saa_pin_sw)
 	    return FALSE;
+	src_migrate = saa_migration_needed(&saa_pixmap(src_pix)->dirty_shadow,
+					   src_reg);
     }
+    if (saa_op_reads_destination(op))
+	dst_migrate = saa_migration_needed(&saa_pixmap(dst_pix)->dirty_shadow,
+					   dst_reg);
 
-    if (!driver->composite_prepare(driver, op, pSrc, pMask, pDst,
+    /*
+     * A component-alpha Over the driver rejects is done as an OutReverse
+     * followed by an Add. Drivers that never accelerate it in one pass
+     * may ask to skip that attempt.
+     */
+    two_pass = saa_is_ca_over(op, pMask) && driver->saa_minor >= 8 &&
+	(driver->flags & SAA_DRIVER_CA_OVER_TWO_PASS);
+    if (two_pass ||
+	!driver->composite_prepare(driver, op, pSrc, pMask, pDst,
 				   src_pix, mask_pix, dst_pix,
-				   src_reg, mask_reg, dst_reg))
-	return FALSE;
-
-    nbox = REGION_NUM_RECTS(dst_reg);
-    pbox = REGION_RECTS(dst_reg);
+				   src_reg, mask_reg, dst_reg)) {
+	if (!saa_is_ca_over(op, pMask) ||
+	    !driver->composite_prepare(driver, PictOpOutReverse, pSrc, pMask,
+				       pDst, src_pix, mask_pix, dst_pix,
+				       src_reg, mask_reg, dst_reg))
+	    return FALSE;
+	two_pass = TRUE;
+    }
 
-    xDst += pDst->pDrawable->x + dst_off_x;
-    yDst += pDst->pDrawable->y + dst_off_y;
+    x_dst = xDst + pDst->pDrawable->x + dst_off_x;
+    y_dst = yDst + pDst->pDrawable->y + dst_off_y;
+    x_src = y_src = x_mask = y_mask = 0;
 
     if (src_pix) {
-	xSrc += pSrc->pDrawable->x + src_off_x - xDst;
-	ySrc += pSrc->pDrawable->y + src_off_y - yDst;
+	x_src = xSrc + pSrc->pDrawable->x + src_off_x - x_dst;
+	y_src = ySrc + pSrc->pDrawable->y + src_off_y - y_dst;
     }
     if (mask_pix) {
-	xMask += pMask->pDrawable->x + mask_off_x - xDst;
-	yMask += pMask->pDrawable->y + mask_off_y - yDst;
+	x_mask = xMask + pMask->pDrawable->x + mask_off_x - x_dst;
+	y_mask = yMask + pMask->pDrawable->y + mask_off_y - y_dst;
     }
 
-    while (nbox--) {
-	driver->composite(driver,
-			  pbox->x1 + xSrc,
-			  pbox->y1 + ySrc,
-			  pbox->x1 + xMask,
-			  pbox->y1 + yMask,
-			  pbox->x1,
-			  pbox->y1,
-			  pbox->x2 - pbox->x1,
-			  pbox->y2 - pbox->y1);
-	pbox++;
+    saa_driver_composite_rects(driver, dst_reg, x_src, y_src,
+			       x_mask, y_mask);
+    saa_pixmap_dirty(dst_pix, TRUE, dst_reg);
+
+    if (two_pass) {
+	if (driver->composite_prepare(driver, PictOpAdd, pSrc, pMask, pDst,
+				      src_pix, mask_pix, dst_pix,
+				      src_reg, mask_reg, dst_reg))
+	    saa_driver_composite_rects(driver, dst_reg, x_src, y_src,
+				       x_mask, y_mask);
+	else {
+	    /*
+	     * The first pass is already done. Finish in software.
+	     */
+	    saa_check_composite(PictOpAdd, pSrc, pMask, pDst, xSrc, ySrc,
+				xMask, yMask, xDst, yDst, width, height,
+				src_reg, mask_reg, dst_reg);
+	}
     }
 
-    driver->composite_done(driver);
-    saa_pixmap_dirty(dst_pix, TRUE, dst_reg);
+    if (src_pix)
+	saa_pixmap_used(src_pix, TRUE, src_migrate);
+    if (mask_pix)
+	saa_pixmap_used(mask_pix, TRUE, mask_migrate);
+    saa_pixmap_used(dst_pix, TRUE, dst_migrate);
+
+    return TRUE;
+}
+
+/*
+ * saa_transform_translation - Return the translation of a transform that
+ * is an integer translation only. Sampling at pixel centers then yields
+ * the source pixels unchanged, unless the filter is a convolution.
+ */
+static Bool
+saa_transform_translation(PicturePtr pict, int *tx, int *ty)
+{
+    PictTransformPtr t = pict->transform;
 
+    *tx = 0;
+    *ty = 0;
+    if (!t)
+	return TRUE;
+
+    if (t->matrix[0][0] != xFixed1 || t->matrix[0][1] != 0 ||
+	t->matrix[1][0] != 0 || t->matrix[1][1] != xFixed1 ||
+	t->matrix[2][0] != 0 || t->matrix[2][1] != 0 ||
+	t->matrix[2][2] != xFixed1 ||
+	xFixedFrac(t->matrix[0][2]) || xFixedFrac(t->matrix[1][2]))
+	return FALSE;
+
+    *tx = xFixedToInt(t->matrix[0][2]);
+    *ty = xFixedToInt(t->matrix[1][2]);
     return TRUE;
 }
 
 /*
  * Try to turn a composite operation into an accelerated copy.
- * We can do that in some special cases for PictOpSrc and PictOpOver.
+ * We can do that in some special cases for PictOpSrc and PictOpOver
+ * without mask, for sources without transform or with an integer
+ * translation. A source with normal repeat is expanded into one copy
+ * per covered tile.
  */
 
 static Bool
@@ -305,53 +657,294 @@ saa_copy_composite(CARD8 op,
 		   INT16 xDst, INT16 yDst, CARD16 width, CARD16 height,
 		   RegionPtr dst_region)
 {
-    if (!pSrc->pDrawable || pSrc->transform ||
-	pSrc->repeat || xSrc < 0 || ySrc < 0 ||
-	xSrc + width > pSrc->pDrawable->width ||
-	ySrc + height > pSrc->pDrawable->height)
+    DrawablePtr src_draw = pSrc->pDrawable;
+    DrawablePtr dst_draw = pDst->pDrawable;
+    int xoff, yoff, tx, ty, ox, oy, i, j, i1, i2, j1, j2;
+    PixmapPtr dst_pix;
+    struct saa_pixmap *dst_spix;
+    struct saa_pixmap *src_spix;
+    BoxPtr extents;
+    Bool ret = TRUE;
+
+    if (!src_draw || pMask || pSrc->alphaMap || pDst->alphaMap ||
+	pSrc->filter == PictFilterConvolution ||
+	!saa_transform_translation(pSrc, &tx, &ty))
 	return FALSE;
 
-    if (op == PictOpSrc ||
-	(op == PictOpOver && PICT_FORMAT_A(pSrc->format) == 0 &&
-	 pMask == NULL)) {
+    if (op != PictOpSrc &&
+	!(op == PictOpOver && PICT_FORMAT_A(pSrc->format) == 0))
+	return FALSE;
 
-	int xoff, yoff;
-	PixmapPtr dst_pix = saa_get_pixmap(pDst->pDrawable, &xoff, &yoff);
-	struct saa_pixmap *dst_spix = saa_pixmap(dst_pix);
-	struct saa_pixmap *src_spix =
-	    saa_pixmap(saa_get_drawable_pixmap(pSrc->pDrawable));
-	int ret;
+    /*
+     * The source offset, in picture coordinates.
+     */
+    ox = xSrc + tx - xDst;
+    oy = ySrc + ty - yDst;
 
-	if (src_spix->auth_loc != saa_loc_driver ||
-	    dst_spix->auth_loc != saa_loc_driver)
+    if (pSrc->repeat) {
+	if (pSrc->repeatType != RepeatNormal ||
+	    saa_get_drawable_pixmap(src_draw) ==
+	    saa_get_drawable_pixmap(dst_draw))
 	    return FALSE;
+    } else if (xSrc + tx < 0 || ySrc + ty < 0 ||
+	       xSrc + tx + width > src_draw->width ||
+	       ySrc + ty + height > src_draw->height)
+	return FALSE;
+
+    dst_pix = saa_get_pixmap(dst_draw, &xoff, &yoff);
+    dst_spix = saa_pixmap(dst_pix);
+    src_spix = saa_pixmap(saa_get_drawable_pixmap(src_draw));
+
+    if (src_spix->auth_loc != saa_loc_driver ||
+	dst_spix->auth_loc != saa_loc_driver)
+	return FALSE;
+
+    /*
+     * Dst region is in backing pixmap space. We need to
+     * translate it to drawable space.
+     */
+    REGION_TRANSLATE(pScreen, dst_region, -xoff, -yoff);
 
-	src_spix->src_format = pSrc->format;
-	dst_spix->dst_format = pDst->format;
-
-	xDst += pDst->pDrawable->x;
-	yDst += pDst->pDrawable->y;
-	xSrc += pSrc->pDrawable->x;
-	ySrc += pSrc->pDrawable->y;
-
-	/*
-	 * Dst region is in backing pixmap space. We need to
-	 * translate it.
-	 */
-	REGION_TRANSLATE(pScreen, dst_region, -xoff, -yoff);
-	ret = saa_hw_copy_nton(pSrc->pDrawable, pDst->pDrawable, NULL,
-			       REGION_RECTS(dst_region),
-			       REGION_NUM_RECTS(dst_region),
-			       xSrc - xDst, ySrc - yDst, FALSE, FALSE);
-	REGION_TRANSLATE(pScreen, dst_region, xoff, yoff);
-
-	src_spix->src_format = 0;
-	dst_spix->dst_format = 0;
-
-	if (ret)
-	    return TRUE;
+    /*
+     * Range of source tiles covered, in units of the source size.
+     * Without repeat, the bounds check above keeps us in tile 0, 0.
+     */
+    extents = REGION_EXTENTS(pScreen, dst_region);
+    i1 = saa_floor_div(extents->x1 - dst_draw->x + ox, src_draw->width);
+    i2 = saa_floor_div(extents->x2 - 1 - dst_draw->x + ox, src_draw->width);
+    j1 = saa_floor_div(extents->y1 - dst_draw->y + oy, src_draw->height);
+    j2 = saa_floor_div(extents->y2 - 1 - dst_draw->y + oy,
+		       src_draw->height);
+    if (!pSrc->repeat)
+	i1 = i2 = j1 = j2 = 0;
+
+    if ((i2 - i1 + 1) * (j2 - j1 + 1) > SAA_COPY_MAX_TILES) {
+	ret = FALSE;
+	goto out;
     }
-    return FALSE;
+
+    src_spix->src_format = pSrc->format;
+    dst_spix->dst_format = pDst->format;
+
+    /*
+     * Src and opaque Over replace the destination, so if a tile fails
+     * after others succeeded, the composite path may just redo it all.
+     */
+    for (j = j1; ret && j <= j2; ++j) {
+	for (i = i1; ret && i <= i2; ++i) {
+	    int dx = ox - i * src_draw->width + src_draw->x - dst_draw->x;
+	    int dy = oy - j * src_draw->height + src_draw->y - dst_draw->y;
+	    RegionRec tile_region;
+	    BoxRec tile;
+
+	    if (!pSrc->repeat) {
+		ret = saa_hw_copy_nton(src_draw, dst_draw, NULL,
+				       REGION_RECTS(dst_region),
+				       REGION_NUM_RECTS(dst_region),
+				       dx, dy, FALSE, FALSE);
+		break;
+	    }
+
+	    tile.x1 = i * src_draw->width - ox + dst_draw->x;
+	    tile.y1 = j * src_draw->height - oy + dst_draw->y;
+	    tile.x2 = tile.x1 + src_draw->width;
+	    tile.y2 = tile.y1 + src_draw->height;
+	    REGION_INIT(pScreen, &tile_region, &tile, 1);
+	    REGION_INTERSECT(pScreen, &tile_region, &tile_region, dst_region);
+	    if (REGION_NOTEMPTY(pScreen, &tile_region))
+		ret = saa_hw_copy_nton(src_draw, dst_draw, NULL,
+				       REGION_RECTS(&tile_region),
+				       REGION_NUM_RECTS(&tile_region),
+				       dx, dy, FALSE, FALSE);
+	    REGION_UNINIT(pScreen, &tile_region);
+	}
+    }
+
+    src_spix->src_format = 0;
+    dst_spix->dst_format = 0;
+  out:
+    REGION_TRANSLATE(pScreen, dst_region, xoff, yoff);
+    return ret;
+}
+
+/*
+ * saa_composite_dst_accel - Whether composite operations to a destination
+ * may be accelerated at all. Checked before staging source pictures, to
+ * avoid work that wouldn't be used.
+ */
+static Bool
+saa_composite_dst_accel(PicturePtr pDst)
+{
+    int xoff, yoff;
+    PixmapPtr dst_pix = saa_get_pixmap(pDst->pDrawable, &xoff, &yoff);
+
+    return (saa_screen(pDst->pDrawable->pScreen)->driver->composite_prepare &&
+	    !pDst->alphaMap &&
+	    saa_pixmap(dst_pix)->auth_loc == saa_loc_driver &&
+	    saa_pixmap_get_pin(dst_pix) != saa_pin_sw);
+}
+
+/*
+ * Accelerate a composite operation with a gradient source, using a
+ * pixmap copy of the gradient from the gradient cache as source.
+ */
+
+static Bool
+saa_gradient_composite(CARD8 op,
+		       PicturePtr pSrc,
+		       PicturePtr pMask,
+		       PicturePtr pDst,
+		       INT16 xSrc,
+		       INT16 ySrc,
+		       INT16 xMask,
+		       INT16 yMask,
+		       INT16 xDst, INT16 yDst, CARD16 width, CARD16 height,
+		       RegionPtr mask_region,
+		       RegionPtr dst_region)
+{
+    ScreenPtr pScreen = pDst->pDrawable->pScreen;
+    PicturePtr pGradient;
+    RegionRec src_region;
+    BoxRec box;
+    int xoff, yoff;
+    Bool ret;
+
+    if (pSrc->pDrawable || !pSrc->pSourcePict ||
+	pSrc->pSourcePict->type == SourcePictTypeSolidFill ||
+	!saa_composite_dst_accel(pDst))
+	return FALSE;
+
+    pGradient = saa_gradient_source(pScreen, pSrc, xSrc, ySrc, width, height,
+				    &xoff, &yoff);
+    if (!pGradient)
+	return FALSE;
+
+    box.x1 = xoff;
+    box.y1 = yoff;
+    box.x2 = xoff + width;
+    box.y2 = yoff + height;
+    REGION_INIT(pScreen, &src_region, &box, 1);
+    ret = saa_driver_composite(op, pGradient, pMask, pDst, xoff, yoff,
+			       xMask, yMask, xDst, yDst, width, height,
+			       &src_region, mask_region, dst_region);
+    REGION_UNINIT(pScreen, &src_region);
+
+    return ret;
+}
+
+/*
+ * saa_stage_picture - Render an area of a picture, with its alpha map,
+ * transform and repeat applied, into a new a8r8g8b8 picture.
+ */
+static PicturePtr
+saa_stage_picture(ScreenPtr pScreen, PicturePtr pict, int x, int y,
+		  int width, int height, RegionPtr region)
+{
+    PictFormatPtr pict_format;
+    PixmapPtr pixmap;
+    PicturePtr staged;
+    RegionRec staged_region;
+    BoxRec box;
+    CARD32 component_alpha = pict->componentAlpha;
+    int error;
+
+    if ((unsigned long) width * height > SAA_SCRATCH_MASK_MAX)
+	return NULL;
+
+    pict_format = PictureMatchFormat(pScreen, 32, PICT_a8r8g8b8);
+    if (!pict_format)
+	return NULL;
+
+    pixmap = (*pScreen->CreatePixmap) (pScreen, width, height, 32, 0);
+    if (!pixmap)
+	return NULL;
+
+    staged = CreatePicture(0, &pixmap->drawable, pict_format,
+			   CPComponentAlpha, &component_alpha,
+			   serverClient, &error);
+    (*pScreen->DestroyPixmap) (pixmap);
+    if (!staged)
+	return NULL;
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = width;
+    box.y2 = height;
+    REGION_INIT(pScreen, &staged_region, &box, 1);
+    saa_check_composite(PictOpSrc, pict, NULL, staged, x, y, 0, 0, 0, 0,
+			width, height, region, NULL, &staged_region);
+    REGION_UNINIT(pScreen, &staged_region);
+
+    return staged;
+}
+
+/*
+ * Accelerate a composite operation with source or mask alpha maps. The
+ * area of each such picture is staged in software, which reads the
+ * source and its alpha map but not the destination, and the staged
+ * pictures are composited by the driver.
+ */
+
+static Bool
+saa_alpha_map_composite(CARD8 op,
+			PicturePtr pSrc,
+			PicturePtr pMask,
+			PicturePtr pDst,
+			INT16 xSrc,
+			INT16 ySrc,
+			INT16 xMask,
+			INT16 yMask,
+			INT16 xDst, INT16 yDst, CARD16 width, CARD16 height,
+			RegionPtr src_region,
+			RegionPtr mask_region,
+			RegionPtr dst_region)
+{
+    ScreenPtr pScreen = pDst->pDrawable->pScreen;
+    PicturePtr staged_src = NULL, staged_mask = NULL;
+    RegionRec staged_region;
+    BoxRec box;
+    Bool ret = FALSE;
+
+    if (!(pSrc->alphaMap || (pMask && pMask->alphaMap)) ||
+	!saa_composite_dst_accel(pDst))
+	return FALSE;
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = width;
+    box.y2 = height;
+    REGION_INIT(pScreen, &staged_region, &box, 1);
+
+    if (pSrc->alphaMap) {
+	staged_src = saa_stage_picture(pScreen, pSrc, xSrc, ySrc, width,
+				       height, src_region);
+	if (!staged_src)
+	    goto out;
+	pSrc = staged_src;
+	xSrc = ySrc = 0;
+	src_region = &staged_region;
+    }
+
+    if (pMask && pMask->alphaMap) {
+	staged_mask = saa_stage_picture(pScreen, pMask, xMask, yMask, width,
+					height, mask_region);
+	if (!staged_mask)
+	    goto out;
+	pMask = staged_mask;
+	xMask = yMask = 0;
+	mask_region = &staged_region;
+    }
+
+    ret = saa_driver_composite(op, pSrc, pMask, pDst, xSrc, ySrc, xMask,
+			       yMask, xDst, yDst, width, height, src_region,
+			       mask_region, dst_region);
+  out:
+    if (staged_src)
+	FreePicture(staged_src, 0);
+    if (staged_mask)
+	FreePicture(staged_mask, 0);
+    REGION_UNINIT(pScreen, &staged_region);
+    return ret;
 }
 
 static void
@@ -385,6 +978,16 @@ saa_composite(CARD8 op,
 			     mask_region, &dst_region))
 	goto out;
 
+    if (saa_gradient_composite(op, pSrc, pMask, pDst, xSrc, ySrc, xMask,
+			       yMask, xDst, yDst, width, height,
+			       mask_region, &dst_region))
+	goto out;
+
+    if (saa_alpha_map_composite(op, pSrc, pMask, pDst, xSrc, ySrc, xMask,
+				yMask, xDst, yDst, width, height,
+				src_region, mask_region, &dst_region))
+	goto out;
+
     saa_check_composite(op, pSrc, pMask, pDst, xSrc, ySrc, xMask, yMask,
 			xDst, yDst, width, height,
 			src_region, mask_region, &dst_region);
@@ -406,8 +1009,36 @@ saa_render_setup(ScreenPtr pScreen)
 	saa_wrap(sscreen, ps, Trapezoids, saa_trapezoids);
 	saa_wrap(sscreen, ps, Triangles, saa_triangles);
 	saa_wrap(sscreen, ps, Composite, saa_composite);
-	saa_wrap(sscreen, ps, Glyphs,    miGlyphs);
-	saa_wrap(sscreen, ps, UnrealizeGlyph, miUnrealizeGlyph);
+	if (saa_glyphs_init(pScreen)) {
+	    saa_wrap(sscreen, ps, Glyphs, saa_glyphs);
+	    saa_wrap(sscreen, ps, UnrealizeGlyph, saa_unrealize_glyph);
+	} else {
+	    saa_wrap(sscreen, ps, Glyphs, miGlyphs);
+	    saa_wrap(sscreen, ps, UnrealizeGlyph, miUnrealizeGlyph);
+	}
+	(void) saa_gradients_init(pScreen);
+    }
+}
+
+/**
+ * saa_render_release - Free the pictures owned by SAA.
+ *
+ * @pScreen: The screen.
+ *
+ * Must be called while DestroyPixmap is still wrapped, so that the
+ * driver releases the storage of the picture pixmaps.
+ */
+void
+saa_render_release(ScreenPtr pScreen)
+{
+    struct saa_screen_priv *sscreen = saa_screen(pScreen);
+
+    saa_glyphs_takedown(pScreen);
+    saa_gradients_takedown(pScreen);
+
+    if (sscreen->scratch_mask) {
+	FreePicture(sscreen->scratch_mask, 0);
+	sscreen->scratch_mask = NULL;
     }
 }
 
@@ -0,0 +1,455 @@
+/*
+ * Copyright 2013 VMWare, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL TUNGSTEN GRAPHICS AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Threaded software fallbacks. Large solid fills and plain copies that
+ * fall back to software are split into horizontal bands, which are
+ * rendered in parallel by a small pool of worker threads and the server
+ * thread. The server thread waits for all bands to complete before
+ * returning, so the pixmaps are never accessed by the workers after
+ * saa_finish_access_pixmap(). Only operations that write pixels directly,
+ * without calling into the server, are threaded.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "saa_priv.h"
+#include "saa.h"
+#include "saa_box.h"
+
+#ifdef HAVE_PTHREAD
+
+#include <pthread.h>
+#include <signal.h>
+
+/*
+ * Smallest operation, in pixels, that is split into bands.
+ */
+#define SAA_THREADS_MIN_AREA (256 * 256)
+
+/*
+ * Smallest band height, in rows.
+ */
+#define SAA_THREADS_MIN_ROWS 16
+
+struct saa_threads_job {
+    void (*band) (const struct saa_threads_job *job, int y1, int y2);
+    const BoxRec *boxes;
+    int num_boxes;
+    int bpp;
+    uint8_t *dst;
+    int dst_pitch;
+    /* Solid fills */
+    uint32_t pixel;
+    /* Copies */
+    uint8_t *src;
+    int src_pitch;
+    int dx;
+    int dy;
+};
+
+struct saa_threads {
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    unsigned int num_threads;
+    pthread_t *threads;
+    unsigned int generation;
+    Bool quit;
+
+    /* Current job, protected by the mutex */
+    const struct saa_threads_job *job;
+    int y1;
+    int y2;
+    int band_height;
+    unsigned int next_band;
+    unsigned int num_bands;
+    unsigned int pending;
+};
+
+/*
+ * saa_threads_work - Render unclaimed bands of the current job until
+ * there are none left. Called with the mutex held.
+ */
+static void
+saa_threads_work(struct saa_threads *threads)
+{
+    while (threads->next_band < threads->num_bands) {
+	const struct saa_threads_job *job = threads->job;
+	int y1 = threads->y1 + threads->next_band++ * threads->band_height;
+	int y2 = y1 + threads->band_height;
+
+	if (y2 > threads->y2)
+	    y2 = threads->y2;
+
+	pthread_mutex_unlock(&threads->mutex);
+	job->band(job, y1, y2);
+	pthread_mutex_lock(&threads->mutex);
+
+	if (--threads->pending == 0)
+	    pthread_cond_signal(&threads->done_cond);
+    }
+}
+
+static void *
+saa_threads_worker(void *arg)
+{
+    struct saa_threads *threads = arg;
+    unsigned int generation = 0;
+
+    pthread_mutex_lock(&threads->mutex);
+    for (;;) {
+	while (!threads->quit && threads->generation == generation)
+	    pthread_cond_wait(&threads->work_cond, &threads->mutex);
+	if (threads->quit)
+	    break;
+
+	generation = threads->generation;
+	saa_threads_work(threads);
+    }
+    pthread_mutex_unlock(&threads->mutex);
+
+    return NULL;
+}
+
+/*
+ * saa_threads_run - Run a job on rows @y1 to @y2, and wait for it to
+ * complete.
+ */
+static void
+saa_threads_run(struct saa_threads *threads,
+		const struct saa_threads_job *job, int y1, int y2)
+{
+    unsigned int num = threads->num_threads + 1;
+    int band_height = (y2 - y1 + num - 1) / num;
+
+    if (band_height < SAA_THREADS_MIN_ROWS)
+	band_height = SAA_THREADS_MIN_ROWS;
+
+    pthread_mutex_lock(&threads->mutex);
+    threads->job = job;
+    threads->y1 = y1;
+    threads->y2 = y2;
+    threads->band_height = band_height;
+    threads->next_band = 0;
+    threads->num_bands = (y2 - y1 + band_height - 1) / band_height;
+    threads->pending = threads->num_bands;
+    threads->generation++;
+    pthread_cond_broadcast(&threads->work_cond);
+
+    saa_threads_work(threads);
+    while (threads->pending)
+	pthread_cond_wait(&threads->done_cond, &threads->mutex);
+
+    threads->job = NULL;
+    pthread_mutex_unlock(&threads->mutex);
+}
+
+/*
+ * saa_threads_split - Whether an operation on @boxes is large enough to
+ * be split into bands. Also computes the rows it covers.
+ */
+static Bool
+saa_threads_split(const BoxRec *boxes, int num_boxes, int *y1, int *y2)
+{
+    if (num_boxes <= 0 ||
+	saa_boxes_area(boxes, num_boxes) < SAA_THREADS_MIN_AREA)
+	return FALSE;
+
+    saa_boxes_rows(boxes, num_boxes, y1, y2);
+    return TRUE;
+}
+
+static void
+saa_threads_fill_band(const struct saa_threads_job *job, int y1, int y2)
+{
+    const BoxRec *box = job->boxes;
+    int n = job->num_boxes;
+
+    int by1, by2;
+
+    for (; n > 0; --n, ++box) {
+	if (!saa_box_clamp_rows(box, y1, y2, &by1, &by2))
+	    continue;
+
+	(void) pixman_fill((uint32_t *) job->dst,
+			   job->dst_pitch / sizeof(uint32_t), job->bpp,
+			   box->x1, by1, box->x2 - box->x1, by2 - by1,
+			   job->pixel);
+    }
+}
+
+static void
+saa_threads_copy_band(const struct saa_threads_job *job, int y1, int y2)
+{
+    const BoxRec *box = job->boxes;
+    int n = job->num_boxes;
+    int cpp = job->bpp / 8;
+    int by1, by2;
+
+    for (; n > 0; --n, ++box) {
+	size_t width = (box->x2 - box->x1) * cpp;
+	uint8_t *dst, *src;
+
+	if (!saa_box_clamp_rows(box, y1, y2, &by1, &by2))
+	    continue;
+
+	dst = job->dst + by1 * job->dst_pitch + box->x1 * cpp;
+	src = job->src + (by1 + job->dy) * job->src_pitch +
+	    (box->x1 + job->dx) * cpp;
+	for (; by1 < by2; ++by1) {
+	    memcpy(dst, src, width);
+	    dst += job->dst_pitch;
+	    src += job->src_pitch;
+	}
+    }
+}
+
+/**
+ * saa_threads_fill_rect - Render a software fallback PolyFillRect using
+ * the worker threads.
+ *
+ * The destination pixmap must be mapped for writing. Returns FALSE if
+ * the operation isn't a large solid fill, in which case it should be
+ * rendered by fb.
+ */
+Bool
+saa_threads_fill_rect(DrawablePtr pDrawable, GCPtr pGC,
+		      int nrect, xRectangle *prect)
+{
+    ScreenPtr pScreen = pDrawable->pScreen;
+    struct saa_screen_priv *sscreen = saa_screen(pScreen);
+    struct saa_threads_job job;
+    PixmapPtr pPixmap;
+    RegionPtr region;
+    int xoff, yoff;
+    int y1, y2;
+
+    if (!sscreen->threads || pGC->fillStyle != FillSolid ||
+	pGC->alu != GXcopy || !SAA_PM_IS_SOLID(pDrawable, pGC->planemask))
+	return FALSE;
+
+    if (pDrawable->bitsPerPixel != 8 && pDrawable->bitsPerPixel != 16 &&
+	pDrawable->bitsPerPixel != 32)
+	return FALSE;
+
+    pPixmap = saa_get_pixmap(pDrawable, &xoff, &yoff);
+    if (!pPixmap->devPrivate.ptr)
+	return FALSE;
+
+    region = RECTS_TO_REGION(pScreen, nrect, prect, CT_UNSORTED);
+    if (!region)
+	return FALSE;
+
+    REGION_TRANSLATE(pScreen, region, pDrawable->x, pDrawable->y);
+    REGION_INTERSECT(pScreen, region, region, fbGetCompositeClip(pGC));
+    REGION_TRANSLATE(pScreen, region, xoff, yoff);
+
+    job.boxes = REGION_RECTS(region);
+    job.num_boxes = REGION_NUM_RECTS(region);
+    if (!saa_threads_split(job.boxes, job.num_boxes, &y1, &y2)) {
+	REGION_DESTROY(pScreen, region);
+	return FALSE;
+    }
+
+    job.band = saa_threads_fill_band;
+    job.bpp = pDrawable->bitsPerPixel;
+    job.dst = pPixmap->devPrivate.ptr;
+    job.dst_pitch = pPixmap->devKind;
+    job.pixel = pGC->fgPixel;
+    saa_threads_run(sscreen->threads, &job, y1, y2);
+
+    REGION_DESTROY(pScreen, region);
+    return TRUE;
+}
+
+/**
+ * saa_threads_copy - Render a software fallback copy using the worker
+ * threads.
+ *
+ * @pbox: Destination boxes, already clipped, in screen coordinates.
+ * @dx: Offset from destination to source.
+ * @dy: Offset from destination to source.
+ *
+ * Both pixmaps must be mapped. Returns FALSE if the operation isn't a
+ * large plain copy between two different pixmaps, in which case it should
+ * be rendered by fb.
+ */
+Bool
+saa_threads_copy(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+		 BoxPtr pbox, int nbox, int dx, int dy)
+{
+    struct saa_screen_priv *sscreen = saa_screen(pDst->pScreen);
+    struct saa_threads_job job;
+    PixmapPtr src_pixmap, dst_pixmap;
+    int src_xoff, src_yoff, dst_xoff, dst_yoff;
+    BoxPtr boxes;
+    int y1, y2;
+
+    if (!sscreen->threads ||
+	(pGC && (pGC->alu != GXcopy ||
+		 !SAA_PM_IS_SOLID(pDst, pGC->planemask))))
+	return FALSE;
+
+    if (pSrc->bitsPerPixel != pDst->bitsPerPixel ||
+	(pDst->bitsPerPixel & 7) != 0)
+	return FALSE;
+
+    src_pixmap = saa_get_pixmap(pSrc, &src_xoff, &src_yoff);
+    dst_pixmap = saa_get_pixmap(pDst, &dst_xoff, &dst_yoff);
+    if (src_pixmap == dst_pixmap || !src_pixmap->devPrivate.ptr ||
+	!dst_pixmap->devPrivate.ptr)
+	return FALSE;
+
+    if (!saa_threads_split(pbox, nbox, &y1, &y2))
+	return FALSE;
+
+    boxes = malloc(nbox * sizeof(*boxes));
+    if (!boxes)
+	return FALSE;
+
+    saa_boxes_translate(boxes, pbox, nbox, dst_xoff, dst_yoff);
+
+    job.band = saa_threads_copy_band;
+    job.boxes = boxes;
+    job.num_boxes = nbox;
+    job.bpp = pDst->bitsPerPixel;
+    job.dst = dst_pixmap->devPrivate.ptr;
+    job.dst_pitch = dst_pixmap->devKind;
+    job.src = src_pixmap->devPrivate.ptr;
+    job.src_pitch = src_pixmap->devKind;
+    job.dx = dx + src_xoff - dst_xoff;
+    job.dy = dy + src_yoff - dst_yoff;
+    saa_threads_run(sscreen->threads, &job, y1 + dst_yoff, y2 + dst_yoff);
+
+    free(boxes);
+    return TRUE;
+}
+
+/**
+ * saa_threads_init - Start the worker threads of a screen.
+ *
+ * @sscreen: The saa screen private.
+ * @num_threads: Number of worker threads.
+ *
+ * The workers block all signals, so that signals keep being delivered
+ * to the server thread.
+ */
+Bool
+saa_threads_init(struct saa_screen_priv *sscreen, unsigned int num_threads)
+{
+    struct saa_threads *threads;
+    sigset_t all, saved;
+    unsigned int i;
+
+    threads = calloc(1, sizeof(*threads));
+    if (!threads)
+	return FALSE;
+
+    threads->threads = calloc(num_threads, sizeof(*threads->threads));
+    if (!threads->threads)
+	goto out_no_threads;
+
+    pthread_mutex_init(&threads->mutex, NULL);
+    pthread_cond_init(&threads->work_cond, NULL);
+    pthread_cond_init(&threads->done_cond, NULL);
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+    for (i = 0; i < num_threads; ++i) {
+	if (pthread_create(&threads->threads[i], NULL, saa_threads_worker,
+			   threads) != 0)
+	    break;
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    threads->num_threads = i;
+    sscreen->threads = threads;
+    if (i < num_threads) {
+	saa_threads_takedown(sscreen);
+	return FALSE;
+    }
+
+    return TRUE;
+
+  out_no_threads:
+    free(threads);
+    return FALSE;
+}
+
+/**
+ * saa_threads_takedown - Stop the worker threads of a screen, if any.
+ */
+void
+saa_threads_takedown(struct saa_screen_priv *sscreen)
+{
+    struct saa_threads *threads = sscreen->threads;
+    unsigned int i;
+
+    if (!threads)
+	return;
+
+    pthread_mutex_lock(&threads->mutex);
+    threads->quit = TRUE;
+    pthread_cond_broadcast(&threads->work_cond);
+    pthread_mutex_unlock(&threads->mutex);
+
+    for (i = 0; i < threads->num_threads; ++i)
+	pthread_join(threads->threads[i], NULL);
+
+    pthread_cond_destroy(&threads->done_cond);
+    pthread_cond_destroy(&threads->work_cond);
+    pthread_mutex_destroy(&threads->mutex);
+    free(threads->threads);
+    free(threads);
+    sscreen->threads = NULL;
+}
+
+#else /* HAVE_PTHREAD */
+
+Bool
+saa_threads_fill_rect(DrawablePtr pDrawable, GCPtr pGC,
+		      int nrect, xRectangle *prect)
+{
+    return FALSE;
+}
+
+Bool
+saa_threads_copy(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+		 BoxPtr pbox, int nbox, int dx, int dy)
+{
+    return FALSE;
+}
+
+Bool
+saa_threads_init(struct saa_screen_priv *sscreen, unsigned int num_threads)
+{
+    return FALSE;
+}
+
+void
+saa_threads_takedown(struct saa_screen_priv *sscreen)
+{
+}
+
+#endif /* HAVE_PTHREAD */
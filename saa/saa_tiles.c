@@ -0,0 +1,267 @@
+/*
+ * Copyright 2013 VMWare, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL TUNGSTEN GRAPHICS AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Tile bitmaps for large pixmaps. For each of dirty_shadow and dirty_hw
+ * we keep a bitmap of the tiles the region may touch. The bitmaps are
+ * conservative: A set bit doesn't mean the region touches the tile, but
+ * a cleared bit means it doesn't. That lets saa_pixmap_dirty() skip the
+ * costly subtraction from the opposite dirty region when new damage can't
+ * intersect it, and lets readbacks be rounded up to whole tiles.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "saa_priv.h"
+#include "saa.h"
+
+#define SAA_TILE_SHIFT 6
+#define SAA_TILE_SIZE (1 << SAA_TILE_SHIFT)
+
+/*
+ * Smallest pixmap area we keep tile bitmaps for.
+ */
+#define SAA_TILES_MIN_AREA (512 * 512)
+
+struct saa_tiles {
+    int width;
+    int height;
+    unsigned int cols;
+    unsigned int rows;
+    unsigned int words;
+    Bool any[2];
+    uint32_t *bits[2];
+};
+
+/*
+ * saa_tiles_range - Compute the tile range covered by a box, clipped to
+ * the pixmap. Returns FALSE if the clipped box is empty.
+ */
+static Bool
+saa_tiles_range(const struct saa_tiles *tiles, const BoxRec *box,
+		unsigned int *c1, unsigned int *r1,
+		unsigned int *c2, unsigned int *r2)
+{
+    int x1 = (box->x1 < 0) ? 0 : box->x1;
+    int y1 = (box->y1 < 0) ? 0 : box->y1;
+    int x2 = (box->x2 > tiles->width) ? tiles->width : box->x2;
+    int y2 = (box->y2 > tiles->height) ? tiles->height : box->y2;
+
+    if (x1 >= x2 || y1 >= y2)
+	return FALSE;
+
+    *c1 = x1 >> SAA_TILE_SHIFT;
+    *r1 = y1 >> SAA_TILE_SHIFT;
+    *c2 = (x2 - 1) >> SAA_TILE_SHIFT;
+    *r2 = (y2 - 1) >> SAA_TILE_SHIFT;
+    return TRUE;
+}
+
+/**
+ * saa_tiles_mark - Mark the tiles touched by a region.
+ *
+ * @tiles: The tile bitmaps.
+ * @hw: Mark the dirty_hw bitmap if TRUE, the dirty_shadow bitmap otherwise.
+ * @reg: The region.
+ *
+ * Returns TRUE if any of the tiles is also marked in the opposite bitmap.
+ */
+Bool
+saa_tiles_mark(struct saa_tiles *tiles, Bool hw, RegionPtr reg)
+{
+    uint32_t *bits = tiles->bits[hw ? 1 : 0];
+    const uint32_t *other = tiles->bits[hw ? 0 : 1];
+    Bool check = tiles->any[hw ? 0 : 1];
+    Bool overlap = FALSE;
+    BoxPtr box = REGION_RECTS(reg);
+    int n = REGION_NUM_RECTS(reg);
+    unsigned int c1, r1, c2, r2, r, c;
+
+    for (; n > 0; --n, ++box) {
+	if (!saa_tiles_range(tiles, box, &c1, &r1, &c2, &r2))
+	    continue;
+
+	tiles->any[hw ? 1 : 0] = TRUE;
+	for (r = r1; r <= r2; ++r) {
+	    for (c = c1; c <= c2; ++c) {
+		unsigned int bit = r * tiles->cols + c;
+		uint32_t mask = 1U << (bit & 31);
+
+		bits[bit >> 5] |= mask;
+		if (check && (other[bit >> 5] & mask))
+		    overlap = TRUE;
+	    }
+	}
+    }
+
+    return overlap;
+}
+
+/**
+ * saa_tiles_clear - Clear a tile bitmap after its region became empty.
+ */
+void
+saa_tiles_clear(struct saa_tiles *tiles, Bool hw)
+{
+    int i = hw ? 1 : 0;
+
+    if (!tiles->any[i])
+	return;
+
+    memset(tiles->bits[i], 0, tiles->words * sizeof(uint32_t));
+    tiles->any[i] = FALSE;
+}
+
+static struct saa_tiles *
+saa_tiles_create(PixmapPtr pixmap, struct saa_pixmap *spix)
+{
+    struct saa_tiles *tiles;
+    int width = pixmap->drawable.width;
+    int height = pixmap->drawable.height;
+    unsigned int cols = (width + SAA_TILE_SIZE - 1) >> SAA_TILE_SHIFT;
+    unsigned int rows = (height + SAA_TILE_SIZE - 1) >> SAA_TILE_SHIFT;
+    unsigned int words = (cols * rows + 31) / 32;
+
+    tiles = calloc(1, sizeof(*tiles) + 2 * words * sizeof(uint32_t));
+    if (!tiles)
+	return NULL;
+
+    tiles->width = width;
+    tiles->height = height;
+    tiles->cols = cols;
+    tiles->rows = rows;
+    tiles->words = words;
+    tiles->bits[0] = (uint32_t *) (tiles + 1);
+    tiles->bits[1] = tiles->bits[0] + words;
+
+    (void) saa_tiles_mark(tiles, FALSE, &spix->dirty_shadow);
+    (void) saa_tiles_mark(tiles, TRUE, &spix->dirty_hw);
+
+    return tiles;
+}
+
+/**
+ * saa_pixmap_tiles - Return the tile bitmaps of a pixmap.
+ *
+ * Returns NULL if tile bitmaps are disabled, the pixmap is too small to
+ * benefit from them, or on allocation failure. The bitmaps are set up
+ * lazily, and set up again if the pixmap size changes.
+ */
+struct saa_tiles *
+saa_pixmap_tiles(PixmapPtr pixmap, struct saa_pixmap *spix)
+{
+    struct saa_screen_priv *sscreen = saa_screen(pixmap->drawable.pScreen);
+    struct saa_tiles *tiles = spix->tiles;
+
+    if (tiles && tiles->width == pixmap->drawable.width &&
+	tiles->height == pixmap->drawable.height)
+	return tiles;
+
+    saa_tiles_destroy(spix);
+
+    if (!sscreen->dirty_tiles ||
+	pixmap->drawable.width * pixmap->drawable.height < SAA_TILES_MIN_AREA)
+	return NULL;
+
+    spix->tiles = saa_tiles_create(pixmap, spix);
+    return spix->tiles;
+}
+
+void
+saa_tiles_destroy(struct saa_pixmap *spix)
+{
+    free(spix->tiles);
+    spix->tiles = NULL;
+}
+
+/**
+ * saa_pixmap_tiles_invalidate - Drop the tile bitmaps of a pixmap.
+ *
+ * Drivers that add to the dirty regions of a pixmap directly, rather
+ * than through SAA, must call this function to keep the tile bitmaps
+ * conservative.
+ */
+void
+saa_pixmap_tiles_invalidate(PixmapPtr pixmap)
+{
+    saa_tiles_destroy(saa_pixmap(pixmap));
+}
+
+/**
+ * saa_tiles_round_region - Round a region up to whole tiles.
+ *
+ * @pScreen: The screen.
+ * @tiles: The tile bitmaps of the pixmap the region refers to.
+ * @reg: The region.
+ *
+ * Returns a new region covering all tiles touched by @reg, clipped to the
+ * pixmap, or NULL on failure.
+ */
+RegionPtr
+saa_tiles_round_region(ScreenPtr pScreen, const struct saa_tiles *tiles,
+		       RegionPtr reg)
+{
+    BoxPtr box = REGION_RECTS(reg);
+    int n = REGION_NUM_RECTS(reg);
+    xRectangle *rects, *rect;
+    unsigned int c1, r1, c2, r2;
+    RegionPtr tiled;
+    int x1, y1, x2, y2;
+    int num = 0;
+
+    rects = malloc(n * sizeof(*rects));
+    if (!rects)
+	return NULL;
+
+    for (rect = rects; n > 0; --n, ++box) {
+	if (!saa_tiles_range(tiles, box, &c1, &r1, &c2, &r2))
+	    continue;
+
+	x1 = c1 << SAA_TILE_SHIFT;
+	y1 = r1 << SAA_TILE_SHIFT;
+	x2 = (c2 + 1) << SAA_TILE_SHIFT;
+	y2 = (r2 + 1) << SAA_TILE_SHIFT;
+	if (x2 > tiles->width)
+	    x2 = tiles->width;
+	if (y2 > tiles->height)
+	    y2 = tiles->height;
+
+	/*
+	 * Boxes of the same band often round to the same tiles.
+	 */
+	if (num && rect[-1].x == x1 && rect[-1].y == y1 &&
+	    rect[-1].width == x2 - x1 && rect[-1].height == y2 - y1)
+	    continue;
+
+	rect->x = x1;
+	rect->y = y1;
+	rect->width = x2 - x1;
+	rect->height = y2 - y1;
+	rect++;
+	num++;
+    }
+
+    tiled = RECTS_TO_REGION(pScreen, num, rects, CT_UNSORTED);
+    free(rects);
+    return tiled;
+}
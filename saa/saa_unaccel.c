@@ -28,6 +28,7 @@
 
 #include "saa_priv.h"
 #include "saa.h"
+#include "saa_box.h"
 #include "mipict.h"
 
 /**
@@ -75,7 +76,7 @@ saa_check_fill_spans(DrawablePtr pDrawable, GCPtr pGC, int nspans,
 
     SAA_FALLBACK(("to %p (%c)\n", pDrawable, saa_drawable_location(pDrawable)));
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_FILL_SPANS);
     if (saa_pad_write(pDrawable, NULL, FALSE, &access)) {
 	if (saa_prepare_access_gc(pGC)) {
 	    saa_swap(sgc, pGC, ops);
@@ -85,7 +86,7 @@ saa_check_fill_spans(DrawablePtr pDrawable, GCPtr pGC, int nspans,
 	}
 	saa_fad_write(pDrawable, access);
     }
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
 static void
@@ -97,17 +98,17 @@ saa_check_set_spans(DrawablePtr pDrawable, GCPtr pGC, char *psrc,
     saa_access_t access
 	SAA_FALLBACK(("to %p (%c)\n", pDrawable, saa_drawable_loc(pDrawable)));
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_SET_SPANS);
     if (saa_pad_write(pDrawable, NULL, FALSE, &access)) {
 	saa_swap(sgc, pGC, ops);
 	pGC->ops->SetSpans(pDrawable, pGC, psrc, ppt, pwidth, nspans, fSorted);
 	saa_swap(sgc, pGC, ops);
 	saa_fad_write(pDrawable, access);
     }
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
-static void
+void
 saa_check_put_image(DrawablePtr pDrawable, GCPtr pGC, int depth,
 		    int x, int y, int w, int h, int leftPad, int format,
 		    char *bits)
@@ -117,7 +118,7 @@ saa_check_put_image(DrawablePtr pDrawable, GCPtr pGC, int depth,
     saa_access_t access;
 
     SAA_FALLBACK(("to %p (%c)\n", pDrawable, saa_drawable_loc(pDrawable)));
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_PUT_IMAGE);
     if (saa_pad_write(pDrawable, pGC, TRUE, &access)) {
 	saa_swap(sgc, pGC, ops);
 	pGC->ops->PutImage(pDrawable, pGC, depth, x, y, w, h, leftPad,
@@ -125,25 +126,19 @@ saa_check_put_image(DrawablePtr pDrawable, GCPtr pGC, int depth,
 	saa_swap(sgc, pGC, ops);
 	saa_fad_write(pDrawable, access);
     }
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
 RegionPtr
 saa_boxes_to_region(ScreenPtr pScreen, int nbox, BoxPtr pbox, int ordering)
 {
     xRectangle *rects = malloc(nbox * sizeof(*rects));
-    int i;
     RegionPtr reg;
 
     if (!rects)
 	return NULL;
 
-    for (i = 0; i < nbox; i++) {
-	rects[i].x = pbox[i].x1;
-	rects[i].y = pbox[i].y1;
-	rects[i].width = pbox[i].x2 - pbox[i].x1;
-	rects[i].height = pbox[i].y2 - pbox[i].y1;
-    }
+    saa_boxes_to_rects(rects, pbox, nbox);
 
     reg = RECTS_TO_REGION(pScreen, nbox, rects, ordering);
     free(rects);
@@ -165,7 +160,7 @@ saa_check_copy_nton(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
     saa_access_t access = SAA_ACCESS_R;
     int ordering;
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_COPY_NTON);
     SAA_FALLBACK(("from %p to %p (%c,%c)\n", pSrc, pDst,
 		  saa_drawable_loc(pSrc), saa_drawable_loc(pDst)));
 
@@ -199,22 +194,24 @@ saa_check_copy_nton(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
     if (!saa_prepare_access_pixmap(dst_pixmap, access, readback))
 	goto out_no_dst;
 
-    saa_swap(sgc, pGC, ops);
-    while (nbox--) {
-	pGC->ops->CopyArea(pSrc, pDst, pGC, pbox->x1 - pSrc->x + dx,
-			   pbox->y1 - pSrc->y + dy,
-			   pbox->x2 - pbox->x1, pbox->y2 - pbox->y1,
-			   pbox->x1 - pDst->x, pbox->y1 - pDst->y);
-	pbox++;
+    if (!saa_threads_copy(pSrc, pDst, pGC, pbox, nbox, dx, dy)) {
+	saa_swap(sgc, pGC, ops);
+	while (nbox--) {
+	    pGC->ops->CopyArea(pSrc, pDst, pGC, pbox->x1 - pSrc->x + dx,
+			       pbox->y1 - pSrc->y + dy,
+			       pbox->x2 - pbox->x1, pbox->y2 - pbox->y1,
+			       pbox->x1 - pDst->x, pbox->y1 - pDst->y);
+	    pbox++;
+	}
+	saa_swap(sgc, pGC, ops);
     }
 
-    saa_swap(sgc, pGC, ops);
     saa_finish_access_pixmap(dst_pixmap, access);
     saa_pixmap_dirty(dst_pixmap, FALSE, reg);
  out_no_dst:
     saa_fad_read(pSrc);
  out_no_access:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
     REGION_DESTROY(pScreen, reg);
 }
 
@@ -229,7 +226,7 @@ saa_check_copy_area(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
 
     SAA_FALLBACK(("from %p to %p (%c,%c)\n", pSrc, pDst,
 		  saa_drawable_loc(pSrc), saa_drawable_loc(pDst)));
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_COPY_AREA);
     if (!saa_pad_read_box(pSrc, srcx, srcy, w, h))
 	goto out_no_access;
     if (!saa_pad_write(pDst, pGC, TRUE, &access))
@@ -243,7 +240,7 @@ saa_check_copy_area(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
  out_no_dst:
     saa_fad_read(pSrc);
  out_no_access:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 
     return ret;
 }
@@ -260,7 +257,7 @@ saa_check_copy_plane(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
 
     SAA_FALLBACK(("from %p to %p (%c,%c)\n", pSrc, pDst,
 		  saa_drawable_loc(pSrc), saa_drawable_loc(pDst)));
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_COPY_PLANE);
     if (!saa_pad_read_box(pSrc, srcx, srcy, w, h))
 	goto out_no_src;
     if (!saa_pad_write(pDst, pGC, TRUE, &access))
@@ -275,7 +272,7 @@ saa_check_copy_plane(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
  out_no_dst:
     saa_fad_read(pSrc);
  out_no_src:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 
     return ret;
 }
@@ -288,7 +285,7 @@ saa_check_poly_point(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
     saa_access_t access;
     struct saa_screen_priv *sscreen = saa_screen(pGC->pScreen);
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_POLY_POINT);
     SAA_FALLBACK(("to %p (%c)\n", pDrawable, saa_drawable_loc(pDrawable)));
     if (!saa_pad_write(pDrawable, NULL, FALSE, &access))
 	goto out_no_access;
@@ -298,7 +295,7 @@ saa_check_poly_point(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
     saa_fad_write(pDrawable, access);
 
  out_no_access:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
 static void
@@ -313,7 +310,7 @@ saa_check_poly_lines(DrawablePtr pDrawable, GCPtr pGC,
 		  pDrawable, saa_drawable_loc(pDrawable),
 		  pGC->lineWidth, mode, npt));
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_POLY_LINES);
     if (!saa_pad_write(pDrawable, NULL, FALSE, &access))
 	goto out_no_access;
     if (!saa_prepare_access_gc(pGC))
@@ -325,7 +322,7 @@ saa_check_poly_lines(DrawablePtr pDrawable, GCPtr pGC,
  out_no_gc:
     saa_fad_write(pDrawable, access);
  out_no_access:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
 static void
@@ -339,7 +336,7 @@ saa_check_poly_segment(DrawablePtr pDrawable, GCPtr pGC,
     SAA_FALLBACK(("to %p (%c) width %d, count %d\n", pDrawable,
 		  saa_drawable_loc(pDrawable), pGC->lineWidth, nsegInit));
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_POLY_SEGMENT);
     if (!saa_pad_write(pDrawable, NULL, FALSE, &access))
 	goto out_no_access;;
     if (!saa_prepare_access_gc(pGC))
@@ -351,7 +348,7 @@ saa_check_poly_segment(DrawablePtr pDrawable, GCPtr pGC,
  out_no_gc:
     saa_fad_write(pDrawable, access);
  out_no_access:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
 static void
@@ -363,7 +360,7 @@ saa_check_poly_arc(DrawablePtr pDrawable, GCPtr pGC, int narcs, xArc * pArcs)
 
     SAA_FALLBACK(("to %p (%c)\n", pDrawable, saa_drawable_loc(pDrawable)));
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_POLY_ARC);
     if (!saa_pad_write(pDrawable, NULL, FALSE, &access))
 	goto out_no_access;;
     if (!saa_prepare_access_gc(pGC))
@@ -375,7 +372,7 @@ saa_check_poly_arc(DrawablePtr pDrawable, GCPtr pGC, int narcs, xArc * pArcs)
  out_no_gc:
     saa_fad_write(pDrawable, access);
  out_no_access:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
 
@@ -401,7 +398,6 @@ saa_check_poly_fill_rect_noreadback(DrawablePtr pDrawable, GCPtr pGC,
 				    int nrect, xRectangle *prect)
 {
     struct saa_gc_priv *sgc = saa_gc(pGC);
-    struct saa_screen_priv *sscreen = saa_screen(pGC->pScreen);
     RegionPtr region;
     saa_access_t access;
     Bool ret;
@@ -413,8 +409,6 @@ saa_check_poly_fill_rect_noreadback(DrawablePtr pDrawable, GCPtr pGC,
     if (!nrect)
 	return TRUE;
 
-    sscreen->fallback_count++;
-
     pPixmap = saa_get_pixmap(pDrawable, &xoff, &yoff);
     spix = saa_get_saa_pixmap(pPixmap);
     region = RECTS_TO_REGION(pGC->pScreen, nrect, prect, CT_UNSORTED);
@@ -443,9 +437,11 @@ saa_check_poly_fill_rect_noreadback(DrawablePtr pDrawable, GCPtr pGC,
     if (!saa_prepare_access_gc(pGC))
 	goto out_no_gc;
 
-    saa_swap(sgc, pGC, ops);
-    pGC->ops->PolyFillRect(pDrawable, pGC, nrect, prect_save);
-    saa_swap(sgc, pGC, ops);
+    if (!saa_threads_fill_rect(pDrawable, pGC, nrect, prect_save)) {
+	saa_swap(sgc, pGC, ops);
+	pGC->ops->PolyFillRect(pDrawable, pGC, nrect, prect_save);
+	saa_swap(sgc, pGC, ops);
+    }
 
     saa_finish_access_gc(pGC);
     saa_finish_access_pixmap(pPixmap, access);
@@ -463,8 +459,6 @@ saa_check_poly_fill_rect_noreadback(DrawablePtr pDrawable, GCPtr pGC,
 
     REGION_DESTROY(pGC->pScreen, region);
 
-    sscreen->fallback_count--;
-
     return TRUE;
 
   out_no_gc:
@@ -472,8 +466,6 @@ saa_check_poly_fill_rect_noreadback(DrawablePtr pDrawable, GCPtr pGC,
   out_no_access:
     REGION_DESTROY(pGC->pScreen, region);
   out_no_region:
-    sscreen->fallback_count--;
-
     return FALSE;
 }
 
@@ -486,11 +478,10 @@ saa_check_poly_fill_rect(DrawablePtr pDrawable, GCPtr pGC,
     struct saa_screen_priv *sscreen = saa_screen(pGC->pScreen);
 
     SAA_FALLBACK(("to %p (%c)\n", pDrawable, saa_drawable_loc(pDrawable)));
+    saa_fallback_enter(sscreen, SAA_OP_POLY_FILL_RECT);
 
     if (saa_check_poly_fill_rect_noreadback(pDrawable, pGC, nrect, prect))
-	return;
-
-    sscreen->fallback_count++;
+	goto out;
 
     /*
      * TODO: Use @prect for readback / damaging instead of
@@ -498,7 +489,7 @@ saa_check_poly_fill_rect(DrawablePtr pDrawable, GCPtr pGC,
      * but should avoid unnecessary readbacks.
      */
     if (!saa_pad_write(pDrawable, pGC, FALSE, &access))
-	goto out_no_access;;
+	goto out;
     if (!saa_prepare_access_gc(pGC))
 	goto out_no_gc;
     saa_swap(sgc, pGC, ops);
@@ -507,8 +498,8 @@ saa_check_poly_fill_rect(DrawablePtr pDrawable, GCPtr pGC,
     saa_finish_access_gc(pGC);
  out_no_gc:
     saa_fad_write(pDrawable, access);
- out_no_access:
-    sscreen->fallback_count--;
+ out:
+    saa_fallback_leave(sscreen);
 }
 
 static void
@@ -522,7 +513,7 @@ saa_check_image_glyph_blt(DrawablePtr pDrawable, GCPtr pGC,
 
     SAA_FALLBACK(("to %p (%c)\n", pDrawable, saa_drawable_loc(pDrawable)));
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_IMAGE_GLYPH_BLT);
     if (!saa_pad_write(pDrawable, NULL, FALSE, &access))
 	goto out_no_access;;
     if (!saa_prepare_access_gc(pGC))
@@ -534,7 +525,7 @@ saa_check_image_glyph_blt(DrawablePtr pDrawable, GCPtr pGC,
  out_no_gc:
     saa_fad_write(pDrawable, access);
  out_no_access:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
 static void
@@ -549,7 +540,7 @@ saa_check_poly_glyph_blt(DrawablePtr pDrawable, GCPtr pGC,
     SAA_FALLBACK(("to %p (%c), style %d alu %d\n", pDrawable,
 		  saa_drawable_loc(pDrawable), pGC->fillStyle, pGC->alu));
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_POLY_GLYPH_BLT);
     if (!saa_pad_write(pDrawable, NULL, FALSE, &access))
 	goto out_no_access;;
     if (!saa_prepare_access_gc(pGC))
@@ -561,7 +552,7 @@ saa_check_poly_glyph_blt(DrawablePtr pDrawable, GCPtr pGC,
  out_no_gc:
     saa_fad_write(pDrawable, access);
  out_no_access:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
 static void
@@ -576,7 +567,7 @@ saa_check_push_pixels(GCPtr pGC, PixmapPtr pBitmap,
 		  saa_drawable_loc(&pBitmap->drawable),
 		  saa_drawable_loc(pDrawable)));
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_PUSH_PIXELS);
     if (!saa_pad_write(pDrawable, pGC, TRUE, &access))
 	goto out_no_access;;
     if (!saa_pad_read_box(&pBitmap->drawable, 0, 0, w, h))
@@ -592,7 +583,7 @@ saa_check_push_pixels(GCPtr pGC, PixmapPtr pBitmap,
  out_no_src:
     saa_fad_write(pDrawable, access);
  out_no_access:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
 static void
@@ -609,7 +600,7 @@ saa_check_copy_window(WindowPtr pWin, DDXPointRec ptOldOrg, RegionPtr prgnSrc)
 
     /* Only need the source bits, the destination region will be overwritten */
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_COPY_WINDOW);
     REGION_TRANSLATE(pScreen, prgnSrc, xoff, yoff);
     ret = saa_prepare_access_pixmap(pPixmap, SAA_ACCESS_R, prgnSrc);
     REGION_TRANSLATE(pScreen, prgnSrc, -xoff, -yoff);
@@ -624,7 +615,7 @@ saa_check_copy_window(WindowPtr pWin, DDXPointRec ptOldOrg, RegionPtr prgnSrc)
     }
     saa_fad_read(pDrawable);
  out_no_access:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
 #ifdef RENDER
@@ -670,7 +661,7 @@ saa_src_validate(DrawablePtr pDrawable, int x, int y, int width, int height)
     }
 }
 
-static void
+void
 saa_check_get_image(DrawablePtr pDrawable, int x, int y, int w, int h,
 		    unsigned int format, unsigned long planeMask, char *d)
 {
@@ -679,7 +670,7 @@ saa_check_get_image(DrawablePtr pDrawable, int x, int y, int w, int h,
 
     SAA_FALLBACK(("from %p (%c)\n", pDrawable, saa_drawable_loc(pDrawable)));
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_GET_IMAGE);
     if (!saa_pad_read_box(pDrawable, x, y, w, h))
 	goto out_no_access;;
     saa_swap(sscreen, pScreen, GetImage);
@@ -687,7 +678,7 @@ saa_check_get_image(DrawablePtr pDrawable, int x, int y, int w, int h,
     saa_swap(sscreen, pScreen, GetImage);
     saa_fad_read(pDrawable);
  out_no_access:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
 static void
@@ -700,7 +691,7 @@ saa_check_get_spans(DrawablePtr pDrawable,
 
     SAA_FALLBACK(("from %p (%c)\n", pDrawable, saa_drawable_loc(pDrawable)));
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_GET_SPANS);
     if (!saa_pad_read(pDrawable))
 	goto out_no_access;;
     saa_swap(sscreen, pScreen, GetSpans);
@@ -708,7 +699,7 @@ saa_check_get_spans(DrawablePtr pDrawable,
     saa_swap(sscreen, pScreen, GetSpans);
     saa_fad_read(pDrawable);
  out_no_access:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
 /*
@@ -913,7 +904,7 @@ saa_check_composite(CARD8 op,
     saa_access_t access;
     PixmapPtr pixmap;
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_COMPOSITE);
     if (!saa_prepare_composite_reg(pScreen, op, pSrc, pMask, pDst, xSrc,
 				   ySrc, xMask, yMask, xDst, yDst, width,
 				   height,
@@ -947,7 +938,7 @@ saa_check_composite(CARD8 op,
     if (pMask && pMask->alphaMap && pMask->alphaMap->pDrawable)
 	saa_fad_read(pMask->alphaMap->pDrawable);
  out_no_access:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
 static void
@@ -961,7 +952,7 @@ saa_check_add_traps(PicturePtr pPicture,
 
     SAA_FALLBACK(("to pict %p (%c)\n", saa_drawable_loc(pPicture->pDrawable)));
 
-    sscreen->fallback_count++;
+    saa_fallback_enter(sscreen, SAA_OP_ADD_TRAPS);
     if (!saa_pad_write(pPicture->pDrawable, NULL, FALSE, &access))
 	goto out_no_access;
     saa_swap(sscreen, ps, AddTraps);
@@ -969,7 +960,7 @@ saa_check_add_traps(PicturePtr pPicture,
     saa_swap(sscreen, ps, AddTraps);
     saa_fad_write(pPicture->pDrawable, access);
  out_no_access:
-    sscreen->fallback_count--;
+    saa_fallback_leave(sscreen);
 }
 
 #endif
@@ -982,7 +973,7 @@ saa_unaccel_setup(ScreenPtr pScreen)
 #endif
     struct saa_screen_priv *sscreen = saa_screen(pScreen);
 
-    saa_wrap(sscreen, pScreen, GetImage, saa_check_get_image);
+    saa_wrap(sscreen, pScreen, GetImage, saa_get_image);
     saa_wrap(sscreen, pScreen, GetSpans, saa_check_get_spans);
     saa_wrap(sscreen, pScreen, CopyWindow, saa_check_copy_window);
 
@@ -1015,7 +1006,7 @@ saa_unaccel_takedown(ScreenPtr pScreen)
 GCOps saa_gc_ops = {
     saa_check_fill_spans,
     saa_check_set_spans,
-    saa_check_put_image,
+    saa_put_image,
     saa_copy_area,
     saa_check_copy_plane,
     saa_check_poly_point,
@@ -1024,7 +1015,7 @@ GCOps saa_gc_ops = {
     miPolyRectangle,
     saa_check_poly_arc,
     miFillPolygon,
-    saa_check_poly_fill_rect,
+    saa_poly_fill_rect,
     miPolyFillArc,
     miPolyText8,
     miPolyText16,
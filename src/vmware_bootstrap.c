@@ -187,6 +187,13 @@ static const OptionInfoRec VMWAREOptions[] = {
     { OPTION_DIRECT_PRESENTS, "DirectPresents", OPTV_BOOLEAN, {0}, FALSE},
     { OPTION_HW_PRESENTS, "HWPresents", OPTV_BOOLEAN, {0}, FALSE},
     { OPTION_RENDERCHECK, "RenderCheck", OPTV_BOOLEAN, {0}, FALSE},
+    { OPTION_DMA_BAND_SIZE, "DMABandSize", OPTV_INTEGER, {0}, FALSE},
+    { OPTION_BOX_MERGE_COST, "BoxMergeCost", OPTV_INTEGER, {0}, FALSE},
+    { OPTION_PRESENT_RATE, "PresentRate", OPTV_INTEGER, {0}, FALSE},
+    { OPTION_DIRTY_TILES, "DirtyTiles", OPTV_BOOLEAN, {0}, FALSE},
+    { OPTION_SURFACE_BUDGET, "SurfaceBudget", OPTV_INTEGER, {0}, FALSE},
+    { OPTION_PIXMAP_CACHE_SIZE, "PixmapCacheSize", OPTV_INTEGER, {0}, FALSE},
+    { OPTION_FALLBACK_THREADS, "FallbackThreads", OPTV_INTEGER, {0}, FALSE},
     { -1,               NULL,           OPTV_NONE,      {0},    FALSE }
 };
 
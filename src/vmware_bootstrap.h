@@ -41,7 +41,14 @@ typedef enum {
     OPTION_DRI,
     OPTION_DIRECT_PRESENTS,
     OPTION_HW_PRESENTS,
-    OPTION_RENDERCHECK
+    OPTION_RENDERCHECK,
+    OPTION_DMA_BAND_SIZE,
+    OPTION_BOX_MERGE_COST,
+    OPTION_PRESENT_RATE,
+    OPTION_DIRTY_TILES,
+    OPTION_SURFACE_BUDGET,
+    OPTION_PIXMAP_CACHE_SIZE,
+    OPTION_FALLBACK_THREADS
 } VMWAREOpts;
 
 OptionInfoPtr VMWARECopyOptions(void);
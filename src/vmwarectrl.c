@@ -389,6 +389,130 @@ VMwareCtrlSetTopology(ClientPtr client)
 }
 
 
+/*
+ *----------------------------------------------------------------------------
+ *
+ * VMwareCtrlQueryMemStats --
+ *
+ *      Implementation of QueryMemStats command handler. Initialises and
+ *      sends a reply.
+ *
+ *      The legacy driver doesn't track pixmap storage, so all
+ *      counters are reported as zero.
+ *
+ * Results:
+ *      Standard response codes.
+ *
+ * Side effects:
+ *      Writes reply to client
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+VMwareCtrlQueryMemStats(ClientPtr client)
+{
+   REQUEST(xVMwareCtrlQueryMemStatsReq);
+   xVMwareCtrlQueryMemStatsReply rep = { 0, };
+   ScrnInfoPtr pScrn;
+   ExtensionEntry *ext;
+   register int n;
+
+   REQUEST_SIZE_MATCH(xVMwareCtrlQueryMemStatsReq);
+
+   if (!(ext = CheckExtension(VMWARE_CTRL_PROTOCOL_NAME))) {
+      return BadMatch;
+   }
+
+   pScrn = ext->extPrivate;
+   if (pScrn->scrnIndex != stuff->screen) {
+      return BadMatch;
+   }
+
+   /*
+    * Pixmaps are kept in system memory by the server, and we don't
+    * account for them. Report all counters as zero.
+    */
+
+   rep.type = X_Reply;
+   rep.length = (sizeof(xVMwareCtrlQueryMemStatsReply) - sizeof(xGenericReply)) >> 2;
+   rep.sequenceNumber = client->sequence;
+   rep.screen = stuff->screen;
+   if (client->swapped) {
+      _swaps(&rep.sequenceNumber, n);
+      _swapl(&rep.length, n);
+      _swapl(&rep.screen, n);
+      _swapl(&rep.mallocKB, n);
+      _swapl(&rep.gmrKB, n);
+      _swapl(&rep.surfaceKB, n);
+      _swapl(&rep.budgetKB, n);
+      _swapl(&rep.evictions, n);
+   }
+   WriteToClient(client, sizeof(xVMwareCtrlQueryMemStatsReply), (char *)&rep);
+
+   return client->noClientException;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * VMwareCtrlDumpFallbackStats --
+ *
+ *      Implementation of DumpFallbackStats command handler. Initialises and
+ *      sends a reply.
+ *
+ *      The legacy driver has no software fallback statistics, so
+ *      nothing is logged.
+ *
+ * Results:
+ *      Standard response codes.
+ *
+ * Side effects:
+ *      Writes reply to client
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+VMwareCtrlDumpFallbackStats(ClientPtr client)
+{
+   REQUEST(xVMwareCtrlDumpFallbackStatsReq);
+   xVMwareCtrlDumpFallbackStatsReply rep = { 0, };
+   ScrnInfoPtr pScrn;
+   ExtensionEntry *ext;
+   register int n;
+
+   REQUEST_SIZE_MATCH(xVMwareCtrlDumpFallbackStatsReq);
+
+   if (!(ext = CheckExtension(VMWARE_CTRL_PROTOCOL_NAME))) {
+      return BadMatch;
+   }
+
+   pScrn = ext->extPrivate;
+   if (pScrn->scrnIndex != stuff->screen) {
+      return BadMatch;
+   }
+
+   /*
+    * The legacy driver doesn't track software fallbacks.
+    */
+
+   rep.type = X_Reply;
+   rep.length = (sizeof(xVMwareCtrlDumpFallbackStatsReply) - sizeof(xGenericReply)) >> 2;
+   rep.sequenceNumber = client->sequence;
+   rep.screen = stuff->screen;
+   if (client->swapped) {
+      _swaps(&rep.sequenceNumber, n);
+      _swapl(&rep.length, n);
+      _swapl(&rep.screen, n);
+   }
+   WriteToClient(client, sizeof(xVMwareCtrlDumpFallbackStatsReply), (char *)&rep);
+
+   return client->noClientException;
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -418,6 +542,10 @@ VMwareCtrlDispatch(ClientPtr client)
       return VMwareCtrlSetRes(client);
    case X_VMwareCtrlSetTopology:
       return VMwareCtrlSetTopology(client);
+   case X_VMwareCtrlQueryMemStats:
+      return VMwareCtrlQueryMemStats(client);
+   case X_VMwareCtrlDumpFallbackStats:
+      return VMwareCtrlDumpFallbackStats(client);
    }
    return BadRequest;
 }
@@ -523,6 +651,71 @@ SVMwareCtrlSetTopology(ClientPtr client)
 }
 
 
+/*
+ *----------------------------------------------------------------------------
+ *
+ * SVMwareCtrlQueryMemStats --
+ *
+ *      Wrapper for QueryMemStats handler that handles input from
+ *      other-endian clients.
+ *
+ * Results:
+ *      Standard response codes.
+ *
+ * Side effects:
+ *      Side effects of unswapped implementation.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+SVMwareCtrlQueryMemStats(ClientPtr client)
+{
+   register int n;
+
+   REQUEST(xVMwareCtrlQueryMemStatsReq);
+   REQUEST_SIZE_MATCH(xVMwareCtrlQueryMemStatsReq);
+
+   _swaps(&stuff->length, n);
+   _swapl(&stuff->screen, n);
+
+   return VMwareCtrlQueryMemStats(client);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * SVMwareCtrlDumpFallbackStats --
+ *
+ *      Wrapper for DumpFallbackStats handler that handles input from
+ *      other-endian clients.
+ *
+ * Results:
+ *      Standard response codes.
+ *
+ * Side effects:
+ *      Side effects of unswapped implementation.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+SVMwareCtrlDumpFallbackStats(ClientPtr client)
+{
+   register int n;
+
+   REQUEST(xVMwareCtrlDumpFallbackStatsReq);
+   REQUEST_SIZE_MATCH(xVMwareCtrlDumpFallbackStatsReq);
+
+   _swaps(&stuff->length, n);
+   _swapl(&stuff->screen, n);
+   _swapl(&stuff->reset, n);
+
+   return VMwareCtrlDumpFallbackStats(client);
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -551,6 +744,10 @@ SVMwareCtrlDispatch(ClientPtr client)
       return SVMwareCtrlSetRes(client);
    case X_VMwareCtrlSetTopology:
       return SVMwareCtrlSetTopology(client);
+   case X_VMwareCtrlQueryMemStats:
+      return SVMwareCtrlQueryMemStats(client);
+   case X_VMwareCtrlDumpFallbackStats:
+      return SVMwareCtrlDumpFallbackStats(client);
    }
    return BadRequest;
 }
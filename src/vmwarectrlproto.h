@@ -119,4 +119,53 @@ typedef struct {
 } xVMwareCtrlSetTopologyReply;
 #define sz_xVMwareCtrlSetTopologyReply 32
 
+/* Version 0.3 definitions. */
+
+typedef struct {
+   CARD8  reqType;           /* always X_VMwareCtrlReqCode */
+   CARD8  VMwareCtrlReqType; /* always X_VMwareCtrlQueryMemStats */
+   CARD16 length B16;
+   CARD32 screen B32;
+} xVMwareCtrlQueryMemStatsReq;
+#define sz_xVMwareCtrlQueryMemStatsReq 8
+
+typedef struct {
+   BYTE   type; /* X_Reply */
+   BYTE   pad1;
+   CARD16 sequenceNumber B16;
+   CARD32 length B32;
+   CARD32 screen B32;
+   CARD32 mallocKB B32;      /* Pixmap storage in malloced memory */
+   CARD32 gmrKB B32;         /* Pixmap storage in DMA buffers */
+   CARD32 surfaceKB B32;     /* Pixmap storage in hardware surfaces */
+   CARD32 budgetKB B32;      /* Hardware surface budget, 0 if unlimited */
+   CARD32 evictions B32;     /* Hardware surfaces evicted */
+} xVMwareCtrlQueryMemStatsReply;
+#define sz_xVMwareCtrlQueryMemStatsReply 32
+
+/* Version 0.4 definitions. */
+
+typedef struct {
+   CARD8  reqType;           /* always X_VMwareCtrlReqCode */
+   CARD8  VMwareCtrlReqType; /* always X_VMwareCtrlDumpFallbackStats */
+   CARD16 length B16;
+   CARD32 screen B32;
+   CARD32 reset B32;         /* Clear the statistics after logging them */
+} xVMwareCtrlDumpFallbackStatsReq;
+#define sz_xVMwareCtrlDumpFallbackStatsReq 12
+
+typedef struct {
+   BYTE   type; /* X_Reply */
+   BYTE   pad1;
+   CARD16 sequenceNumber B16;
+   CARD32 length B32;
+   CARD32 screen B32;
+   CARD32 pad2   B32;
+   CARD32 pad3   B32;
+   CARD32 pad4   B32;
+   CARD32 pad5   B32;
+   CARD32 pad6   B32;
+} xVMwareCtrlDumpFallbackStatsReply;
+#define sz_xVMwareCtrlDumpFallbackStatsReply 32
+
 #endif /* _VMWARE_CTRL_PROTO_H_ */
@@ -265,3 +265,110 @@ exit:
 
    return ret;
 }
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * VMwareCtrl_QueryMemStats --
+ *
+ *      Send the QueryMemStats command to the driver and return the results.
+ *
+ * Results:
+ *      True if information is successfully retrieved. False otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+Bool
+VMwareCtrl_QueryMemStats(Display *dpy,                // IN:
+                         int screen,                  // IN:
+                         VMwareCtrlMemStats *stats)   // OUT:
+{
+   xVMwareCtrlQueryMemStatsReply rep;
+   xVMwareCtrlQueryMemStatsReq *req;
+   XExtDisplayInfo *info = find_display(dpy);
+   Bool ret = False;
+
+   VMwareCtrlCheckExtension(dpy, info, False);
+   LockDisplay(dpy);
+
+   GetReq(VMwareCtrlQueryMemStats, req);
+   req->reqType = info->codes->major_opcode;
+   req->VMwareCtrlReqType = X_VMwareCtrlQueryMemStats;
+   req->screen = screen;
+
+   if (!_XReply(dpy, (xReply *)&rep,
+                (SIZEOF(xVMwareCtrlQueryMemStatsReply) - SIZEOF(xReply)) >> 2,
+                xFalse)) {
+      goto exit;
+   }
+   stats->mallocKB = rep.mallocKB;
+   stats->gmrKB = rep.gmrKB;
+   stats->surfaceKB = rep.surfaceKB;
+   stats->budgetKB = rep.budgetKB;
+   stats->evictions = rep.evictions;
+
+   ret = True;
+
+exit:
+   UnlockDisplay(dpy);
+   SyncHandle();
+
+   return ret;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * VMwareCtrl_DumpFallbackStats --
+ *
+ *      Send the DumpFallbackStats command to the driver, which writes its
+ *      software fallback statistics to the X server log.
+ *
+ * Results:
+ *      True if the command is successfully sent. False otherwise.
+ *
+ * Side effects:
+ *      Clears the statistics if reset is True.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+Bool
+VMwareCtrl_DumpFallbackStats(Display *dpy,  // IN:
+                             int screen,    // IN:
+                             Bool reset)    // IN:
+{
+   xVMwareCtrlDumpFallbackStatsReply rep;
+   xVMwareCtrlDumpFallbackStatsReq *req;
+   XExtDisplayInfo *info = find_display(dpy);
+   Bool ret = False;
+
+   VMwareCtrlCheckExtension(dpy, info, False);
+   LockDisplay(dpy);
+
+   GetReq(VMwareCtrlDumpFallbackStats, req);
+   req->reqType = info->codes->major_opcode;
+   req->VMwareCtrlReqType = X_VMwareCtrlDumpFallbackStats;
+   req->screen = screen;
+   req->reset = reset;
+
+   if (!_XReply(dpy, (xReply *)&rep,
+                (SIZEOF(xVMwareCtrlDumpFallbackStatsReply) - SIZEOF(xReply)) >> 2,
+                xFalse)) {
+      goto exit;
+   }
+
+   ret = True;
+
+exit:
+   UnlockDisplay(dpy);
+   SyncHandle();
+
+   return ret;
+}
@@ -39,9 +39,19 @@
 #include <X11/Xmd.h>
 #include <X11/extensions/panoramiXproto.h>
 
+typedef struct {
+   unsigned long mallocKB;
+   unsigned long gmrKB;
+   unsigned long surfaceKB;
+   unsigned long budgetKB;
+   unsigned long evictions;
+} VMwareCtrlMemStats;
+
 Bool VMwareCtrl_QueryExtension(Display *dpy, int *event_basep, int *error_basep);
 Bool VMwareCtrl_QueryVersion(Display *dpy, int *majorVersion, int *minorVersion);
 Bool VMwareCtrl_SetRes(Display *dpy, int screen, int x, int y);
 Bool VMwareCtrl_SetTopology(Display *dpy, int screen, xXineramaScreenInfo[], int number);
+Bool VMwareCtrl_QueryMemStats(Display *dpy, int screen, VMwareCtrlMemStats *stats);
+Bool VMwareCtrl_DumpFallbackStats(Display *dpy, int screen, Bool reset);
 
 #endif /* _LIB_VMWARE_CTRL_H_ */
@@ -69,6 +69,39 @@ main (int argc, char **argv)
          } else {
             printf("SetTopology failed\n");
          }
+      } else if (strcmp(argv[1], "memstats") == 0) {
+         VMwareCtrlMemStats stats;
+
+         if (major == 0 && minor < 3) {
+            printf("VMWARE_CTRL version >= 0.3 is required\n");
+            exit(EXIT_FAILURE);
+         }
+
+         if (VMwareCtrl_QueryMemStats(dpy, screen, &stats)) {
+            printf("Pixmap memory: %lu KiB malloc, %lu KiB GMR, "
+                   "%lu KiB surfaces\n",
+                   stats.mallocKB, stats.gmrKB, stats.surfaceKB);
+            if (stats.budgetKB)
+               printf("Surface budget: %lu KiB\n", stats.budgetKB);
+            else
+               printf("Surface budget: unlimited\n");
+            printf("Surfaces evicted: %lu\n", stats.evictions);
+         } else {
+            printf("QueryMemStats failed\n");
+         }
+      } else if (strcmp(argv[1], "fallbackstats") == 0) {
+         Bool reset = (argc > 2 && strcmp(argv[2], "reset") == 0);
+
+         if (major == 0 && minor < 4) {
+            printf("VMWARE_CTRL version >= 0.4 is required\n");
+            exit(EXIT_FAILURE);
+         }
+
+         if (VMwareCtrl_DumpFallbackStats(dpy, screen, reset)) {
+            printf("Fallback statistics written to the X server log\n");
+         } else {
+            printf("DumpFallbackStats failed\n");
+         }
       }
    }
 
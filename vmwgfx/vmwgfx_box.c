@@ -0,0 +1,394 @@
+/*
+ * Copyright 2013 VMWare, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL TUNGSTEN GRAPHICS AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The code in this file reduces the number of boxes sent to the host
+ * for DMA, present and dirty-fb commands. Each box carries a fixed host
+ * overhead, so for fragmented regions, like those resulting from text
+ * rendering, it's cheaper to transfer a few extra pixels than to emit
+ * a box for every rectangle of the region.
+ *
+ * It also contains the damage accumulator used for scanout damage, which
+ * replaces region arithmetic in the damage callback with a small, fixed
+ * number of box operations.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "vmwgfx_box.h"
+
+/*
+ * Number of previously emitted boxes we try to merge a new box with.
+ * Boxes arrive sorted in y-x bands, so nearby boxes are found among the
+ * most recently emitted ones.
+ */
+#define VMWGFX_BOX_WINDOW 8
+
+void
+vmwgfx_box_list_init(struct vmwgfx_box_list *list)
+{
+    list->boxes = NULL;
+    list->size = 0;
+}
+
+void
+vmwgfx_box_list_fini(struct vmwgfx_box_list *list)
+{
+    free(list->boxes);
+    vmwgfx_box_list_init(list);
+}
+
+/**
+ * vmwgfx_box_list_reserve - Make sure a box list has room for at
+ * least @num boxes.
+ */
+Bool
+vmwgfx_box_list_reserve(struct vmwgfx_box_list *list, unsigned int num)
+{
+    BoxPtr boxes;
+    unsigned int size;
+
+    if (num <= list->size)
+	return TRUE;
+
+    size = (list->size) ? list->size : 64;
+    while (size < num)
+	size <<= 1;
+
+    boxes = realloc(list->boxes, size * sizeof(*boxes));
+    if (!boxes)
+	return FALSE;
+
+    list->boxes = boxes;
+    list->size = size;
+    return TRUE;
+}
+
+static inline uint64_t
+vmwgfx_box_area(const BoxRec *box)
+{
+    return (uint64_t) (box->x2 - box->x1) * (uint64_t) (box->y2 - box->y1);
+}
+
+/**
+ * vmwgfx_box_try_merge - Try to grow @dst to also cover @src.
+ *
+ * @dst: Previously emitted box.
+ * @src: New box.
+ * @exclude: Region that the merged box may not cover, unless the merge
+ * is lossless, or NULL.
+ * @box_cost: Maximum number of extra pixels the merge may add.
+ *
+ * Returns TRUE if @dst was grown to cover @src.
+ */
+static Bool
+vmwgfx_box_try_merge(BoxPtr dst, const BoxRec *src, RegionPtr exclude,
+		     unsigned int box_cost)
+{
+    BoxRec merged, overlap;
+    uint64_t covered, extra;
+
+    merged.x1 = (src->x1 < dst->x1) ? src->x1 : dst->x1;
+    merged.y1 = (src->y1 < dst->y1) ? src->y1 : dst->y1;
+    merged.x2 = (src->x2 > dst->x2) ? src->x2 : dst->x2;
+    merged.y2 = (src->y2 > dst->y2) ? src->y2 : dst->y2;
+
+    covered = vmwgfx_box_area(dst) + vmwgfx_box_area(src);
+
+    /*
+     * A grown box may overlap the new box.
+     */
+    overlap.x1 = (src->x1 > dst->x1) ? src->x1 : dst->x1;
+    overlap.y1 = (src->y1 > dst->y1) ? src->y1 : dst->y1;
+    overlap.x2 = (src->x2 < dst->x2) ? src->x2 : dst->x2;
+    overlap.y2 = (src->y2 < dst->y2) ? src->y2 : dst->y2;
+    if (overlap.x1 < overlap.x2 && overlap.y1 < overlap.y2)
+	covered -= vmwgfx_box_area(&overlap);
+
+    extra = vmwgfx_box_area(&merged) - covered;
+    if (extra > box_cost)
+	return FALSE;
+
+    if (extra && exclude &&
+	RECT_IN_REGION(pScreen, exclude, &merged) != rgnOUT)
+	return FALSE;
+
+    *dst = merged;
+    return TRUE;
+}
+
+/**
+ * vmwgfx_box_optimize - Compute a reduced box list covering a region.
+ *
+ * @list: Scratch box list used for the result.
+ * @region: The region to cover.
+ * @exclude: Pixels in this region may not be covered unless they are
+ * part of @region, or NULL. The caller uses this to protect pixels whose
+ * contents would be invalid at the destination of the transfer.
+ * @box_cost: The per-box cost in pixels. Nearby boxes are merged if
+ * the merged box covers at most this many pixels outside of @region.
+ * @boxes: Returns the resulting boxes.
+ * @num_boxes: Returns the number of resulting boxes.
+ *
+ * Boxes of the same row band are merged first, and then boxes close to
+ * each other in subsequent bands. Lossless merges, like the vertical
+ * merges of the pieces of a rectangle split up by the band structure,
+ * are always done. The resulting boxes are sorted on y1, but may
+ * overlap. If there's nothing to gain or memory is short, the region's
+ * own rectangles are returned.
+ */
+void
+vmwgfx_box_optimize(struct vmwgfx_box_list *list, RegionPtr region,
+		    RegionPtr exclude, unsigned int box_cost,
+		    BoxPtr *boxes, unsigned int *num_boxes)
+{
+    BoxPtr in = REGION_RECTS(region);
+    unsigned int num_in = REGION_NUM_RECTS(region);
+    BoxPtr out;
+    unsigned int num_out, window, i, j;
+
+    *boxes = in;
+    *num_boxes = num_in;
+
+    if (num_in < 2 || !vmwgfx_box_list_reserve(list, num_in))
+	return;
+
+    if (exclude && !REGION_NOTEMPTY(pScreen, exclude))
+	exclude = NULL;
+
+    out = list->boxes;
+    out[0] = in[0];
+    num_out = 1;
+    window = 0;
+
+    for (i = 1; i < num_in; ++i) {
+	const BoxRec *box = &in[i];
+	Bool merged = FALSE;
+
+	for (j = num_out; j > window; --j) {
+	    merged = vmwgfx_box_try_merge(&out[j - 1], box, exclude,
+					  box_cost);
+	    if (merged)
+		break;
+	}
+
+	if (!merged) {
+	    out[num_out++] = *box;
+	    if (num_out - window > VMWGFX_BOX_WINDOW)
+		window++;
+	}
+    }
+
+    *boxes = out;
+    *num_boxes = num_out;
+}
+
+static inline Bool
+vmwgfx_box_contains(const BoxRec *outer, const BoxRec *inner)
+{
+    return (outer->x1 <= inner->x1 && outer->y1 <= inner->y1 &&
+	    outer->x2 >= inner->x2 && outer->y2 >= inner->y2);
+}
+
+static inline Bool
+vmwgfx_box_overlaps(const BoxRec *a, const BoxRec *b)
+{
+    return (a->x1 < b->x2 && b->x1 < a->x2 &&
+	    a->y1 < b->y2 && b->y1 < a->y2);
+}
+
+static inline void
+vmwgfx_box_union(BoxPtr dst, const BoxRec *src)
+{
+    if (src->x1 < dst->x1)
+	dst->x1 = src->x1;
+    if (src->y1 < dst->y1)
+	dst->y1 = src->y1;
+    if (src->x2 > dst->x2)
+	dst->x2 = src->x2;
+    if (src->y2 > dst->y2)
+	dst->y2 = src->y2;
+}
+
+/**
+ * vmwgfx_damage_add_box - Add a box to a damage accumulator.
+ *
+ * @damage: The accumulator.
+ * @box: The damaged box.
+ *
+ * Boxes already covered are dropped, and boxes that can be joined
+ * without covering extra pixels are joined. When the accumulator is
+ * full, the box is merged with the accumulated box that grows the least.
+ */
+void
+vmwgfx_damage_add_box(struct vmwgfx_damage *damage, const BoxRec *box)
+{
+    BoxPtr cur;
+    BoxPtr best = NULL;
+    uint64_t best_extra = 0;
+    unsigned int i;
+
+    if (box->x1 >= box->x2 || box->y1 >= box->y2)
+	return;
+
+    i = 0;
+    while (i < damage->num_boxes) {
+	cur = &damage->boxes[i];
+
+	if (vmwgfx_box_contains(cur, box))
+	    return;
+
+	/*
+	 * Drop boxes covered by the new one.
+	 */
+	if (vmwgfx_box_contains(box, cur)) {
+	    *cur = damage->boxes[--damage->num_boxes];
+	    continue;
+	}
+
+	/*
+	 * Lossless joins of boxes in the same columns or rows.
+	 */
+	if ((cur->x1 == box->x1 && cur->x2 == box->x2 &&
+	     cur->y1 <= box->y2 && box->y1 <= cur->y2) ||
+	    (cur->y1 == box->y1 && cur->y2 == box->y2 &&
+	     cur->x1 <= box->x2 && box->x1 <= cur->x2)) {
+	    vmwgfx_box_union(cur, box);
+	    return;
+	}
+	i++;
+    }
+
+    if (damage->num_boxes < VMWGFX_DAMAGE_BOXES) {
+	damage->boxes[damage->num_boxes++] = *box;
+	return;
+    }
+
+    for (i = 0; i < damage->num_boxes; ++i) {
+	BoxRec merged;
+	uint64_t extra;
+
+	cur = &damage->boxes[i];
+	merged = *cur;
+	vmwgfx_box_union(&merged, box);
+	extra = vmwgfx_box_area(&merged) - vmwgfx_box_area(cur);
+	if (!best || extra < best_extra) {
+	    best = cur;
+	    best_extra = extra;
+	}
+    }
+
+    vmwgfx_box_union(best, box);
+}
+
+/**
+ * vmwgfx_damage_add_region - Add a region to a damage accumulator.
+ */
+void
+vmwgfx_damage_add_region(struct vmwgfx_damage *damage, RegionPtr region)
+{
+    BoxPtr boxes = REGION_RECTS(region);
+    int num_boxes = REGION_NUM_RECTS(region);
+
+    while (num_boxes--)
+	vmwgfx_damage_add_box(damage, boxes++);
+}
+
+/**
+ * vmwgfx_damage_intersects - Check whether the damage of an accumulator
+ * may intersect a region.
+ *
+ * Since the accumulator may cover more than the damage added, this
+ * may return TRUE even if the damage itself doesn't intersect @region.
+ */
+Bool
+vmwgfx_damage_intersects(const struct vmwgfx_damage *damage,
+			 RegionPtr region)
+{
+    BoxPtr extents = REGION_EXTENTS(pScreen, region);
+    unsigned int i;
+
+    for (i = 0; i < damage->num_boxes; ++i) {
+	const BoxRec *box = &damage->boxes[i];
+
+	if (vmwgfx_box_overlaps(box, extents) &&
+	    RECT_IN_REGION(pScreen, region, (BoxPtr) box) != rgnOUT)
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * vmwgfx_damage_clip - Clip the damage of an accumulator to a box.
+ */
+void
+vmwgfx_damage_clip(struct vmwgfx_damage *damage, const BoxRec *bounds)
+{
+    unsigned int i = 0;
+
+    while (i < damage->num_boxes) {
+	BoxPtr box = &damage->boxes[i];
+
+	if (!vmwgfx_box_overlaps(box, bounds)) {
+	    *box = damage->boxes[--damage->num_boxes];
+	    continue;
+	}
+
+	if (box->x1 < bounds->x1)
+	    box->x1 = bounds->x1;
+	if (box->y1 < bounds->y1)
+	    box->y1 = bounds->y1;
+	if (box->x2 > bounds->x2)
+	    box->x2 = bounds->x2;
+	if (box->y2 > bounds->y2)
+	    box->y2 = bounds->y2;
+	i++;
+    }
+}
+
+/**
+ * vmwgfx_damage_region - Return the area covered by a damage
+ * accumulator as a region.
+ *
+ * @damage: The accumulator.
+ * @region: Initialized region that returns the covered area.
+ */
+void
+vmwgfx_damage_region(const struct vmwgfx_damage *damage, RegionPtr region)
+{
+    unsigned int i;
+
+    REGION_EMPTY(pScreen, region);
+    for (i = 0; i < damage->num_boxes; ++i) {
+	RegionRec box_reg;
+
+	REGION_INIT(pScreen, &box_reg, (BoxPtr) &damage->boxes[i], 1);
+	REGION_UNION(pScreen, region, region, &box_reg);
+	REGION_UNINIT(pScreen, &box_reg);
+    }
+}
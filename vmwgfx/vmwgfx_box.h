@@ -0,0 +1,142 @@
+/*
+ * Copyright 2013 VMWare, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL TUNGSTEN GRAPHICS AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _VMWGFX_BOX_H_
+#define _VMWGFX_BOX_H_
+
+#include <xorg-server.h>
+#include <regionstr.h>
+#include <xf86drmMode.h>
+#include "vmwgfx_drm.h"
+#include "saa_box.h"
+
+/*
+ * Default cost, in pixels, of emitting an extra box to the host.
+ * Two boxes are merged if the merged box covers at most this many
+ * pixels outside of the original boxes.
+ */
+#define VMWGFX_BOX_COST_DEFAULT 1024
+
+/*
+ * A growable scratch array of boxes, reused between calls to avoid
+ * allocations in the update paths.
+ */
+struct vmwgfx_box_list {
+    BoxPtr boxes;
+    unsigned int size;
+};
+
+extern void
+vmwgfx_box_list_init(struct vmwgfx_box_list *list);
+
+extern void
+vmwgfx_box_list_fini(struct vmwgfx_box_list *list);
+
+extern Bool
+vmwgfx_box_list_reserve(struct vmwgfx_box_list *list, unsigned int num);
+
+/*
+ * vmwgfx_boxes_to_clips - Convert boxes to kms dirty clips.
+ */
+static inline void
+vmwgfx_boxes_to_clips(drmModeClip *restrict clips,
+		      const BoxRec *restrict boxes, unsigned int num)
+{
+    unsigned int i;
+
+    for (i = 0; i < num; ++i) {
+	clips[i].x1 = boxes[i].x1;
+	clips[i].y1 = boxes[i].y1;
+	clips[i].x2 = boxes[i].x2;
+	clips[i].y2 = boxes[i].y2;
+    }
+}
+
+/*
+ * vmwgfx_boxes_to_rects - Convert boxes to vmwgfx kernel rects.
+ */
+static inline void
+vmwgfx_boxes_to_rects(struct drm_vmw_rect *restrict rects,
+		      const BoxRec *restrict boxes, unsigned int num)
+{
+    unsigned int i;
+
+    for (i = 0; i < num; ++i) {
+	rects[i].x = boxes[i].x1;
+	rects[i].y = boxes[i].y1;
+	rects[i].w = boxes[i].x2 - boxes[i].x1;
+	rects[i].h = boxes[i].y2 - boxes[i].y1;
+    }
+}
+
+extern void
+vmwgfx_box_optimize(struct vmwgfx_box_list *list, RegionPtr region,
+		    RegionPtr exclude, unsigned int box_cost,
+		    BoxPtr *boxes, unsigned int *num_boxes);
+
+/*
+ * Maximum number of boxes of a damage accumulator.
+ */
+#define VMWGFX_DAMAGE_BOXES 32
+
+/*
+ * A cheap, bounded accumulator for damage that is only needed as a
+ * region at flush time. It covers all damage added to it, but once it
+ * runs out of boxes, it may also cover undamaged pixels.
+ */
+struct vmwgfx_damage {
+    BoxRec boxes[VMWGFX_DAMAGE_BOXES];
+    unsigned int num_boxes;
+};
+
+static inline void
+vmwgfx_damage_empty(struct vmwgfx_damage *damage)
+{
+    damage->num_boxes = 0;
+}
+
+static inline Bool
+vmwgfx_damage_notempty(const struct vmwgfx_damage *damage)
+{
+    return (damage->num_boxes != 0);
+}
+
+extern void
+vmwgfx_damage_add_box(struct vmwgfx_damage *damage, const BoxRec *box);
+
+extern void
+vmwgfx_damage_add_region(struct vmwgfx_damage *damage, RegionPtr region);
+
+extern Bool
+vmwgfx_damage_intersects(const struct vmwgfx_damage *damage,
+			 RegionPtr region);
+
+extern void
+vmwgfx_damage_clip(struct vmwgfx_damage *damage, const BoxRec *bounds);
+
+extern void
+vmwgfx_damage_region(const struct vmwgfx_damage *damage, RegionPtr region);
+
+#endif
@@ -0,0 +1,369 @@
+/*
+ * Copyright 2013 VMWare, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL TUNGSTEN GRAPHICS AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * A small cache of backing storage of destroyed pixmaps. Hardware surfaces
+ * are keyed by size, format and flags, and GMRs by size. Short-lived
+ * pixmaps, like scratch pixmaps and toolkit back buffers, are often
+ * recreated with the same geometry right after being destroyed, and can
+ * then reuse the storage without the surface define and GMR allocation
+ * ioctls. Entries are released when they grow old, or when the cache
+ * exceeds its size limit. Cached surfaces count against the hardware
+ * surface budget, and are released before live pixmaps are evicted.
+ *
+ * A GMR may be cached while an upload is still reading from it. The
+ * fence of the upload is kept with the GMR, which isn't handed out again
+ * until the fence has signaled.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <xorg-server.h>
+#include <os.h>
+#include "vmwgfx_saa_priv.h"
+
+/*
+ * Maximum time in milliseconds an entry is kept in the cache.
+ */
+#define VMWGFX_CACHE_MAX_AGE 1000
+
+struct vmwgfx_cache_entry {
+    struct _WsbmListHead head;
+    CARD32 time;
+    size_t size;
+    int width;
+    int height;
+    enum xa_formats format;
+    uint32_t flags;
+    struct xa_surface *hw;
+    struct vmwgfx_dmabuf *gmr;
+    Bool fenced;
+    uint32_t fence;
+};
+
+/**
+ * vmwgfx_cache_init - Initialize a storage cache.
+ *
+ * @cache: The cache.
+ * @drm_fd: File descriptor for the drm connection.
+ * @max_bytes: Maximum size of cached storage. 0 disables the cache.
+ */
+void
+vmwgfx_cache_init(struct vmwgfx_cache *cache, int drm_fd, size_t max_bytes)
+{
+    WSBMINITLISTHEAD(&cache->entries);
+    cache->drm_fd = drm_fd;
+    cache->bytes = 0;
+    cache->hw_bytes = 0;
+    cache->gmr_bytes = 0;
+    cache->max_bytes = max_bytes;
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+static void
+vmwgfx_cache_remove(struct vmwgfx_cache *cache,
+		    struct vmwgfx_cache_entry *entry)
+{
+    WSBMLISTDEL(&entry->head);
+    cache->bytes -= entry->size;
+    if (entry->hw)
+	cache->hw_bytes -= entry->size;
+    else
+	cache->gmr_bytes -= entry->size;
+    free(entry);
+}
+
+static void
+vmwgfx_cache_free(struct vmwgfx_cache *cache,
+		  struct vmwgfx_cache_entry *entry)
+{
+    if (entry->hw)
+	xa_surface_destroy(entry->hw);
+    if (entry->fenced)
+	vmwgfx_fence_unref(cache->drm_fd, entry->fence);
+    if (entry->gmr)
+	vmwgfx_dmabuf_destroy(entry->gmr);
+    vmwgfx_cache_remove(cache, entry);
+}
+
+/*
+ * vmwgfx_cache_gmr_idle - Check whether the GMR of an entry may be
+ * written, optionally waiting for its fence.
+ */
+static Bool
+vmwgfx_cache_gmr_idle(struct vmwgfx_cache *cache,
+		      struct vmwgfx_cache_entry *entry, Bool wait)
+{
+    if (!entry->fenced)
+	return TRUE;
+
+    if (wait) {
+	if (vmwgfx_fence_wait(cache->drm_fd, entry->fence, TRUE) != 0)
+	    vmwgfx_fence_unref(cache->drm_fd, entry->fence);
+    } else {
+	if (vmwgfx_fence_signaled(cache->drm_fd, entry->fence) != 1)
+	    return FALSE;
+	vmwgfx_fence_unref(cache->drm_fd, entry->fence);
+    }
+
+    entry->fenced = FALSE;
+    return TRUE;
+}
+
+/**
+ * vmwgfx_cache_expire - Release old cache entries.
+ *
+ * @cache: The cache.
+ * @all: Release all entries, regardless of age.
+ *
+ * Returns TRUE if any entry was released.
+ */
+Bool
+vmwgfx_cache_expire(struct vmwgfx_cache *cache, Bool all)
+{
+    struct _WsbmListHead *list, *next;
+    CARD32 now = GetTimeInMillis();
+    Bool released = FALSE;
+
+    /*
+     * Entries are ordered oldest first.
+     */
+    WSBMLISTFOREACHSAFE(list, next, &cache->entries) {
+	struct vmwgfx_cache_entry *entry =
+	    WSBMLISTENTRY(list, struct vmwgfx_cache_entry, head);
+
+	if (!all && now - entry->time < VMWGFX_CACHE_MAX_AGE &&
+	    cache->bytes <= cache->max_bytes)
+	    break;
+
+	vmwgfx_cache_free(cache, entry);
+	released = TRUE;
+    }
+
+    return released;
+}
+
+/**
+ * vmwgfx_cache_release_hw - Release cached hardware surfaces, oldest
+ * first.
+ *
+ * @cache: The cache.
+ * @size: Number of bytes to release.
+ *
+ * Returns the number of bytes released, which may be less than @size if
+ * the cache runs out of surfaces.
+ */
+size_t
+vmwgfx_cache_release_hw(struct vmwgfx_cache *cache, size_t size)
+{
+    struct _WsbmListHead *list, *next;
+    size_t freed = 0;
+
+    WSBMLISTFOREACHSAFE(list, next, &cache->entries) {
+	struct vmwgfx_cache_entry *entry =
+	    WSBMLISTENTRY(list, struct vmwgfx_cache_entry, head);
+
+	if (freed >= size)
+	    break;
+
+	if (!entry->hw)
+	    continue;
+
+	freed += entry->size;
+	vmwgfx_cache_free(cache, entry);
+    }
+
+    return freed;
+}
+
+static Bool
+vmwgfx_cache_add(struct vmwgfx_cache *cache,
+		 struct vmwgfx_cache_entry *entry)
+{
+    if (entry->size > cache->max_bytes)
+	return FALSE;
+
+    entry->time = GetTimeInMillis();
+    WSBMLISTADDTAIL(&entry->head, &cache->entries);
+    cache->bytes += entry->size;
+    if (entry->hw)
+	cache->hw_bytes += entry->size;
+    else
+	cache->gmr_bytes += entry->size;
+    (void) vmwgfx_cache_expire(cache, FALSE);
+
+    return TRUE;
+}
+
+/**
+ * vmwgfx_cache_put_hw - Hand over a hardware surface to the cache.
+ *
+ * @cache: The cache.
+ * @hw: The surface.
+ * @width: Surface width.
+ * @height: Surface height.
+ * @flags: The xa flags the surface was created with.
+ * @size: Estimated surface size.
+ *
+ * Returns TRUE if the cache took ownership of the surface.
+ */
+Bool
+vmwgfx_cache_put_hw(struct vmwgfx_cache *cache, struct xa_surface *hw,
+		    int width, int height, uint32_t flags, size_t size)
+{
+    struct vmwgfx_cache_entry *entry;
+
+    if (size > cache->max_bytes)
+	return FALSE;
+
+    entry = calloc(1, sizeof(*entry));
+    if (!entry)
+	return FALSE;
+
+    entry->size = size;
+    entry->width = width;
+    entry->height = height;
+    entry->format = xa_surface_format(hw);
+    entry->flags = flags;
+    entry->hw = hw;
+
+    if (!vmwgfx_cache_add(cache, entry)) {
+	free(entry);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * vmwgfx_cache_get_hw - Take a matching hardware surface from the cache.
+ *
+ * Returns NULL if there is no matching surface. The most recently cached
+ * match is returned.
+ */
+struct xa_surface *
+vmwgfx_cache_get_hw(struct vmwgfx_cache *cache, int width, int height,
+		    enum xa_formats format, uint32_t flags)
+{
+    struct _WsbmListHead *list;
+    struct xa_surface *hw;
+
+    WSBMLISTFOREACHPREV(list, &cache->entries) {
+	struct vmwgfx_cache_entry *entry =
+	    WSBMLISTENTRY(list, struct vmwgfx_cache_entry, head);
+
+	if (entry->hw && entry->width == width && entry->height == height &&
+	    entry->format == format && entry->flags == flags) {
+	    hw = entry->hw;
+	    vmwgfx_cache_remove(cache, entry);
+	    cache->hits++;
+	    return hw;
+	}
+    }
+
+    cache->misses++;
+    return NULL;
+}
+
+/**
+ * vmwgfx_cache_put_gmr - Hand over a GMR to the cache.
+ *
+ * @cache: The cache.
+ * @gmr: The GMR.
+ * @fence: If non-NULL, the fence of an upload still reading from the GMR.
+ *
+ * Returns TRUE if the cache took ownership of the GMR, and of the fence.
+ */
+Bool
+vmwgfx_cache_put_gmr(struct vmwgfx_cache *cache, struct vmwgfx_dmabuf *gmr,
+		     const uint32_t *fence)
+{
+    struct vmwgfx_cache_entry *entry;
+
+    if (gmr->size > cache->max_bytes)
+	return FALSE;
+
+    entry = calloc(1, sizeof(*entry));
+    if (!entry)
+	return FALSE;
+
+    entry->size = gmr->size;
+    entry->gmr = gmr;
+    if (fence) {
+	entry->fenced = TRUE;
+	entry->fence = *fence;
+    }
+
+    if (!vmwgfx_cache_add(cache, entry)) {
+	free(entry);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * vmwgfx_cache_get_gmr - Take a GMR of a given size from the cache.
+ *
+ * @cache: The cache.
+ * @size: The GMR size.
+ * @wait: Wait for a GMR that is still busy with an upload, rather than
+ * skipping it.
+ *
+ * Returns NULL if there is no idle GMR of that size.
+ */
+struct vmwgfx_dmabuf *
+vmwgfx_cache_get_gmr(struct vmwgfx_cache *cache, size_t size, Bool wait)
+{
+    struct _WsbmListHead *list;
+    struct vmwgfx_dmabuf *gmr;
+
+    WSBMLISTFOREACHPREV(list, &cache->entries) {
+	struct vmwgfx_cache_entry *entry =
+	    WSBMLISTENTRY(list, struct vmwgfx_cache_entry, head);
+
+	if (entry->gmr && entry->size == size &&
+	    vmwgfx_cache_gmr_idle(cache, entry, wait)) {
+	    gmr = entry->gmr;
+	    vmwgfx_cache_remove(cache, entry);
+	    cache->hits++;
+	    return gmr;
+	}
+    }
+
+    cache->misses++;
+    return NULL;
+}
+
+/**
+ * vmwgfx_cache_report - Log cache statistics.
+ */
+void
+vmwgfx_cache_report(struct vmwgfx_cache *cache)
+{
+    LogMessageVerb(X_INFO, 3, "Pixmap storage cache: %lu hits, "
+		   "%lu misses.\n", cache->hits, cache->misses);
+}
@@ -65,6 +65,27 @@ struct crtc_private
     struct vmwgfx_screen_entry entry;
 };
 
+/*
+ * crtc_scanout_unref - Drop the scanout reference of a crtc.
+ *
+ * The scanout list is rebuilt first, since dropping the reference may
+ * destroy the pixmap.
+ */
+static void
+crtc_scanout_unref(xf86CrtcPtr crtc)
+{
+    struct crtc_private *crtcp = crtc->driver_private;
+    PixmapPtr pixmap = crtcp->entry.pixmap;
+
+    if (!pixmap)
+	return;
+
+    crtcp->entry.pixmap = NULL;
+    vmwgfx_scanout_list_update(crtc->scrn);
+    crtcp->entry.pixmap = pixmap;
+    vmwgfx_scanout_unref(&crtcp->entry);
+}
+
 static void
 crtc_dpms(xf86CrtcPtr crtc, int mode)
 {
@@ -89,9 +110,8 @@ crtc_dpms(xf86CrtcPtr crtc, int mode)
        * the crtc may be turned on again by
        * another dpms call, so don't release the scanout pixmap ref.
        */
-	if (!crtc->enabled && crtcp->entry.pixmap) {
-	    vmwgfx_scanout_unref(&crtcp->entry);
-	}
+	if (!crtc->enabled && crtcp->entry.pixmap)
+	    crtc_scanout_unref(crtc);
 	break;
     }
 }
@@ -187,16 +207,25 @@ crtc_set_mode_major(xf86CrtcPtr crtc, DisplayModePtr mode,
 	pixmap = pScreen->GetScreenPixmap(pScreen);
 
     if (crtcp->entry.pixmap != pixmap) {
-	if (crtcp->entry.pixmap)
-	    vmwgfx_scanout_unref(&crtcp->entry);
+	crtc_scanout_unref(crtc);
 
 	crtcp->entry.pixmap = pixmap;
 	crtcp->scanout_id = vmwgfx_scanout_ref(&crtcp->entry);
 	if (crtcp->scanout_id == -1) {
+	    /*
+	     * Don't leave a pixmap without a scanout reference on the
+	     * scanout list.
+	     */
+	    crtcp->entry.pixmap = NULL;
 	    LogMessage(X_ERROR, "Failed to convert pixmap to scanout.\n");
 	    return FALSE;
 	}
     }
+
+    /*
+     * The crtc may have been enabled without a new scanout pixmap.
+     */
+    vmwgfx_scanout_list_update(crtc->scrn);
     ret = drmModeSetCrtc(ms->fd, drm_crtc->crtc_id, crtcp->scanout_id, x, y,
 			 &connector_id, 1, &drm_mode);
     if (ret)
@@ -378,7 +407,7 @@ crtc_destroy(xf86CrtcPtr crtc)
     struct crtc_private *crtcp = crtc->driver_private;
 
     if (!WSBMLISTEMPTY(&crtcp->entry.scanout_head))
-	vmwgfx_scanout_unref(&crtcp->entry);
+	crtc_scanout_unref(crtc);
 
     xorg_crtc_cursor_destroy(crtc);
 
@@ -456,4 +485,53 @@ crtc_get_scanout(xf86CrtcPtr crtc)
     return crtcp->entry.pixmap;
 }
 
+/*
+ * Rebuild the list of pixmaps we scan out from, without duplicates.
+ * This needs to be called whenever a crtc takes or drops a scanout
+ * reference, so that the screen update code doesn't need to walk
+ * the crtcs.
+ */
+void
+vmwgfx_scanout_list_update(ScrnInfoPtr pScrn)
+{
+    modesettingPtr ms = modesettingPTR(pScrn);
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(pScrn);
+    PixmapPtr pixmap;
+    unsigned int j;
+    int i;
+
+    if (!ms)
+	return;
+
+    ms->num_scanouts = 0;
+    if (ms->scanouts_size < (unsigned int) config->num_crtc) {
+	PixmapPtr *scanouts = realloc(ms->scanouts, config->num_crtc *
+				      sizeof(*scanouts));
+
+	if (!scanouts) {
+	    LogMessage(X_ERROR, "Failed to allocate scanout list.\n");
+	    return;
+	}
+	ms->scanouts = scanouts;
+	ms->scanouts_size = config->num_crtc;
+    }
+
+    for (i = 0; i < config->num_crtc; ++i) {
+	if (!config->crtc[i]->enabled || !config->crtc[i]->driver_private)
+	    continue;
+
+	pixmap = crtc_get_scanout(config->crtc[i]);
+	if (!pixmap)
+	    continue;
+
+	for (j = 0; j < ms->num_scanouts; ++j) {
+	    if (pixmap == ms->scanouts[j])
+		break;
+	}
+
+	if (j == ms->num_scanouts)
+	    ms->scanouts[ms->num_scanouts++] = pixmap;
+    }
+}
+
 /* vim: set sw=4 ts=8 sts=4: */
@@ -41,6 +41,7 @@
 #include "vmwarectrlproto.h"
 #include "vmwgfx_driver.h"
 #include "vmwgfx_drmi.h"
+#include "vmwgfx_saa.h"
 
 /*
  *----------------------------------------------------------------------------
@@ -288,6 +289,131 @@ VMwareCtrlSetTopology(ClientPtr client)
 }
 
 
+/*
+ *----------------------------------------------------------------------------
+ *
+ * VMwareCtrlQueryMemStats --
+ *
+ *      Implementation of QueryMemStats command handler. Initialises and
+ *      sends a reply.
+ *
+ *      Reports how much memory pixmap storage uses in system memory,
+ *      DMA buffers and hardware surfaces.
+ *
+ * Results:
+ *      Standard response codes.
+ *
+ * Side effects:
+ *      Writes reply to client
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+VMwareCtrlQueryMemStats(ClientPtr client)
+{
+   REQUEST(xVMwareCtrlQueryMemStatsReq);
+   xVMwareCtrlQueryMemStatsReply rep = { 0, };
+   ScrnInfoPtr pScrn;
+   ExtensionEntry *ext;
+   struct vmwgfx_mem_stats stats;
+   register int n;
+
+   REQUEST_SIZE_MATCH(xVMwareCtrlQueryMemStatsReq);
+
+   if (!(ext = CheckExtension(VMWARE_CTRL_PROTOCOL_NAME))) {
+      return BadMatch;
+   }
+
+   pScrn = ext->extPrivate;
+   if (pScrn->scrnIndex != stuff->screen) {
+      return BadMatch;
+   }
+
+   vmwgfx_saa_mem_stats(xf86ScrnToScreen(pScrn), &stats);
+   rep.mallocKB = stats.malloc_bytes >> 10;
+   rep.gmrKB = stats.gmr_bytes >> 10;
+   rep.surfaceKB = stats.hw_bytes >> 10;
+   rep.budgetKB = stats.hw_budget >> 10;
+   rep.evictions = stats.evictions;
+
+   rep.type = X_Reply;
+   rep.length = (sizeof(xVMwareCtrlQueryMemStatsReply) - sizeof(xGenericReply)) >> 2;
+   rep.sequenceNumber = client->sequence;
+   rep.screen = stuff->screen;
+   if (client->swapped) {
+      _swaps(&rep.sequenceNumber, n);
+      _swapl(&rep.length, n);
+      _swapl(&rep.screen, n);
+      _swapl(&rep.mallocKB, n);
+      _swapl(&rep.gmrKB, n);
+      _swapl(&rep.surfaceKB, n);
+      _swapl(&rep.budgetKB, n);
+      _swapl(&rep.evictions, n);
+   }
+   WriteToClient(client, sizeof(xVMwareCtrlQueryMemStatsReply), (char *)&rep);
+
+   return client->noClientException;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * VMwareCtrlDumpFallbackStats --
+ *
+ *      Implementation of DumpFallbackStats command handler. Initialises and
+ *      sends a reply.
+ *
+ *      Writes the software fallback and composite rejection statistics
+ *      to the X server log, at default verbosity.
+ *
+ * Results:
+ *      Standard response codes.
+ *
+ * Side effects:
+ *      Writes reply to client
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+VMwareCtrlDumpFallbackStats(ClientPtr client)
+{
+   REQUEST(xVMwareCtrlDumpFallbackStatsReq);
+   xVMwareCtrlDumpFallbackStatsReply rep = { 0, };
+   ScrnInfoPtr pScrn;
+   ExtensionEntry *ext;
+   register int n;
+
+   REQUEST_SIZE_MATCH(xVMwareCtrlDumpFallbackStatsReq);
+
+   if (!(ext = CheckExtension(VMWARE_CTRL_PROTOCOL_NAME))) {
+      return BadMatch;
+   }
+
+   pScrn = ext->extPrivate;
+   if (pScrn->scrnIndex != stuff->screen) {
+      return BadMatch;
+   }
+
+   vmwgfx_saa_fallback_report(xf86ScrnToScreen(pScrn), 1, stuff->reset != 0);
+
+   rep.type = X_Reply;
+   rep.length = (sizeof(xVMwareCtrlDumpFallbackStatsReply) - sizeof(xGenericReply)) >> 2;
+   rep.sequenceNumber = client->sequence;
+   rep.screen = stuff->screen;
+   if (client->swapped) {
+      _swaps(&rep.sequenceNumber, n);
+      _swapl(&rep.length, n);
+      _swapl(&rep.screen, n);
+   }
+   WriteToClient(client, sizeof(xVMwareCtrlDumpFallbackStatsReply), (char *)&rep);
+
+   return client->noClientException;
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -317,6 +443,10 @@ VMwareCtrlDispatch(ClientPtr client)
       return VMwareCtrlSetRes(client);
    case X_VMwareCtrlSetTopology:
       return VMwareCtrlSetTopology(client);
+   case X_VMwareCtrlQueryMemStats:
+      return VMwareCtrlQueryMemStats(client);
+   case X_VMwareCtrlDumpFallbackStats:
+      return VMwareCtrlDumpFallbackStats(client);
    }
    return BadRequest;
 }
@@ -422,6 +552,71 @@ SVMwareCtrlSetTopology(ClientPtr client)
 }
 
 
+/*
+ *----------------------------------------------------------------------------
+ *
+ * SVMwareCtrlQueryMemStats --
+ *
+ *      Wrapper for QueryMemStats handler that handles input from
+ *      other-endian clients.
+ *
+ * Results:
+ *      Standard response codes.
+ *
+ * Side effects:
+ *      Side effects of unswapped implementation.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+SVMwareCtrlQueryMemStats(ClientPtr client)
+{
+   register int n;
+
+   REQUEST(xVMwareCtrlQueryMemStatsReq);
+   REQUEST_SIZE_MATCH(xVMwareCtrlQueryMemStatsReq);
+
+   _swaps(&stuff->length, n);
+   _swapl(&stuff->screen, n);
+
+   return VMwareCtrlQueryMemStats(client);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * SVMwareCtrlDumpFallbackStats --
+ *
+ *      Wrapper for DumpFallbackStats handler that handles input from
+ *      other-endian clients.
+ *
+ * Results:
+ *      Standard response codes.
+ *
+ * Side effects:
+ *      Side effects of unswapped implementation.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+SVMwareCtrlDumpFallbackStats(ClientPtr client)
+{
+   register int n;
+
+   REQUEST(xVMwareCtrlDumpFallbackStatsReq);
+   REQUEST_SIZE_MATCH(xVMwareCtrlDumpFallbackStatsReq);
+
+   _swaps(&stuff->length, n);
+   _swapl(&stuff->screen, n);
+   _swapl(&stuff->reset, n);
+
+   return VMwareCtrlDumpFallbackStats(client);
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -450,6 +645,10 @@ SVMwareCtrlDispatch(ClientPtr client)
       return SVMwareCtrlSetRes(client);
    case X_VMwareCtrlSetTopology:
       return SVMwareCtrlSetTopology(client);
+   case X_VMwareCtrlQueryMemStats:
+      return SVMwareCtrlQueryMemStats(client);
+   case X_VMwareCtrlDumpFallbackStats:
+      return SVMwareCtrlDumpFallbackStats(client);
    }
    return BadRequest;
 }
@@ -194,6 +194,7 @@ dri2_do_create_buffer(DrawablePtr pDraw, DRI2Buffer2Ptr buffer, unsigned int for
 	    return FALSE;
 
 	srf = vpix->hw;
+	vpix->hw_exported = TRUE;
 	private->refcount++;
 	private->dri2_depth = depth;
 
@@ -375,6 +376,11 @@ dri2_copy_region(DrawablePtr pDraw, RegionPtr pRegion,
     (*gc->ops->CopyArea)(src_draw, dst_draw, gc,
 			 0, 0, pDraw->width, pDraw->height, 0, 0);
 
+    /*
+     * The client may access the buffers as soon as we return.
+     */
+    vmwgfx_saa_flush_deferred(pScreen);
+
     /*
      * FreeScratchGC will free myClip as well.
      */
@@ -441,6 +441,12 @@ drv_pre_init(ScrnInfoPtr pScrn, int flags)
     Gamma zeros = { 0.0, 0.0, 0.0 };
     EntityInfoPtr pEnt;
     uint64_t cap;
+    int band_size;
+    int box_cost;
+    int present_rate;
+    int surface_budget;
+    int cache_size;
+    int fallback_threads;
 
     if (pScrn->numEntities != 1)
 	return FALSE;
@@ -565,6 +571,86 @@ drv_pre_init(ScrnInfoPtr pScrn, int flags)
 					     &ms->rendercheck) ?
 	X_CONFIG : X_DEFAULT;
 
+    ms->dma_band_size = VMWGFX_DMA_BAND_SIZE_DEFAULT;
+    ms->from_dma_band_size = X_DEFAULT;
+    if (xf86GetOptValInteger(ms->Options, OPTION_DMA_BAND_SIZE,
+			     &band_size)) {
+	if (band_size >= 0) {
+	    ms->dma_band_size = (unsigned int) band_size;
+	    ms->from_dma_band_size = X_CONFIG;
+	} else
+	    xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		       "Ignoring negative DMABandSize %d.\n", band_size);
+    }
+
+    ms->box_cost = VMWGFX_BOX_COST_DEFAULT;
+    ms->from_box_cost = X_DEFAULT;
+    if (xf86GetOptValInteger(ms->Options, OPTION_BOX_MERGE_COST,
+			     &box_cost)) {
+	if (box_cost >= 0) {
+	    ms->box_cost = (unsigned int) box_cost;
+	    ms->from_box_cost = X_CONFIG;
+	} else
+	    xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		       "Ignoring negative BoxMergeCost %d.\n", box_cost);
+    }
+
+    ms->present_rate = 0;
+    ms->from_present_rate = X_DEFAULT;
+    if (xf86GetOptValInteger(ms->Options, OPTION_PRESENT_RATE,
+			     &present_rate)) {
+	if (present_rate >= 0) {
+	    ms->present_rate = (unsigned int) present_rate;
+	    ms->from_present_rate = X_CONFIG;
+	} else
+	    xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		       "Ignoring negative PresentRate %d.\n", present_rate);
+    }
+
+    ms->dirty_tiles = FALSE;
+    ms->from_dirty_tiles = (xf86GetOptValBool(ms->Options, OPTION_DIRTY_TILES,
+					      &ms->dirty_tiles)) ?
+	X_CONFIG : X_DEFAULT;
+
+    ms->surface_budget = 0;
+    ms->from_surface_budget = X_DEFAULT;
+    if (xf86GetOptValInteger(ms->Options, OPTION_SURFACE_BUDGET,
+			     &surface_budget)) {
+	if (surface_budget >= 0) {
+	    ms->surface_budget = (unsigned int) surface_budget;
+	    ms->from_surface_budget = X_CONFIG;
+	} else
+	    xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		       "Ignoring negative SurfaceBudget %d.\n",
+		       surface_budget);
+    }
+
+    ms->cache_size = VMWGFX_CACHE_SIZE_DEFAULT;
+    ms->from_cache_size = X_DEFAULT;
+    if (xf86GetOptValInteger(ms->Options, OPTION_PIXMAP_CACHE_SIZE,
+			     &cache_size)) {
+	if (cache_size >= 0) {
+	    ms->cache_size = (unsigned int) cache_size;
+	    ms->from_cache_size = X_CONFIG;
+	} else
+	    xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		       "Ignoring negative PixmapCacheSize %d.\n",
+		       cache_size);
+    }
+
+    ms->fallback_threads = 0;
+    ms->from_fallback_threads = X_DEFAULT;
+    if (xf86GetOptValInteger(ms->Options, OPTION_FALLBACK_THREADS,
+			     &fallback_threads)) {
+	if (fallback_threads >= 0) {
+	    ms->fallback_threads = (unsigned int) fallback_threads;
+	    ms->from_fallback_threads = X_CONFIG;
+	} else
+	    xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		       "Ignoring negative FallbackThreads %d.\n",
+		       fallback_threads);
+    }
+
     ms->enable_dri = ms->accelerate_render;
     ms->from_dri = xf86GetOptValBool(ms->Options, OPTION_DRI,
 				     &ms->enable_dri) ?
@@ -615,25 +701,56 @@ drv_pre_init(ScrnInfoPtr pScrn, int flags)
 
 }
 
+/*
+ * vmwgfx_scanout_boxes - Compute the boxes to send to the host for a
+ * scanout update or present.
+ *
+ * @exclude: Region of the scanout pixmap where the source of the update
+ * is stale, and that may not be covered by merged boxes, or NULL.
+ */
+static void
+vmwgfx_scanout_boxes(modesettingPtr ms, struct vmwgfx_saa_pixmap *vpix,
+		     RegionPtr dirty, RegionPtr exclude,
+		     BoxPtr *boxes, unsigned int *num_boxes)
+{
+    /*
+     * With direct presents, the screen contents may be newer than both
+     * the surface and the shadow.
+     */
+    if (vpix->dirty_present && REGION_NOTEMPTY(pScreen, vpix->dirty_present)) {
+	*boxes = REGION_RECTS(dirty);
+	*num_boxes = REGION_NUM_RECTS(dirty);
+	return;
+    }
+
+    vmwgfx_box_optimize(&ms->scanout_boxes, dirty, exclude, ms->box_cost,
+			boxes, num_boxes);
+}
+
+/*
+ * vmwgfx_scanout_update - Tell the host to update the screen from the
+ * framebuffer contents.
+ *
+ * @exclude: For shadow-backed framebuffers, the region where the shadow is
+ * stale, because hardware rendering hasn't been read back.
+ */
 static Bool
-vmwgfx_scanout_update(int drm_fd, int fb_id, RegionPtr dirty)
+vmwgfx_scanout_update(modesettingPtr ms, struct vmwgfx_saa_pixmap *vpix,
+		      RegionPtr dirty, RegionPtr exclude)
 {
-    unsigned num_cliprects = REGION_NUM_RECTS(dirty);
-    drmModeClip *clip = alloca(num_cliprects * sizeof(drmModeClip));
-    BoxPtr rect = REGION_RECTS(dirty);
-    int i, ret;
+    unsigned num_cliprects;
+    drmModeClip *clip;
+    BoxPtr rect;
+    int ret;
 
-    if (!num_cliprects)
+    if (!REGION_NOTEMPTY(pScreen, dirty))
 	return TRUE;
 
-    for (i = 0; i < num_cliprects; i++, rect++) {
-	clip[i].x1 = rect->x1;
-	clip[i].y1 = rect->y1;
-	clip[i].x2 = rect->x2;
-	clip[i].y2 = rect->y2;
-    }
+    vmwgfx_scanout_boxes(ms, vpix, dirty, exclude, &rect, &num_cliprects);
+    clip = alloca(num_cliprects * sizeof(drmModeClip));
+    vmwgfx_boxes_to_clips(clip, rect, num_cliprects);
 
-    ret = drmModeDirtyFB(drm_fd, fb_id, clip, num_cliprects);
+    ret = drmModeDirtyFB(ms->fd, vpix->fb_id, clip, num_cliprects);
     if (ret)
 	LogMessage(X_ERROR, "%s: failed to send dirty (%i, %s)\n",
 		   __func__, ret, strerror(-ret));
@@ -641,12 +758,14 @@ vmwgfx_scanout_update(int drm_fd, int fb_id, RegionPtr dirty)
 }
 
 static Bool
-vmwgfx_scanout_present(ScreenPtr pScreen, int drm_fd,
+vmwgfx_scanout_present(ScreenPtr pScreen, modesettingPtr ms,
 		       struct vmwgfx_saa_pixmap *vpix,
 		       RegionPtr dirty)
 {
     uint32_t handle;
     unsigned int dummy;
+    BoxPtr boxes;
+    unsigned int num_boxes;
 
     if (!REGION_NOTEMPTY(pScreen, dirty))
 	return TRUE;
@@ -661,7 +780,15 @@ vmwgfx_scanout_present(ScreenPtr pScreen, int drm_fd,
 	return FALSE;
     }
 
-    if (vmwgfx_present(drm_fd, vpix->fb_id, 0, 0, dirty, handle) != 0) {
+    /*
+     * Don't present stale surface contents where software rendering
+     * hasn't been uploaded yet.
+     */
+    vmwgfx_scanout_boxes(ms, vpix, dirty, &vpix->base.dirty_shadow,
+			 &boxes, &num_boxes);
+
+    if (vmwgfx_present(ms->fd, vpix->fb_id, 0, 0, boxes, num_boxes,
+		       handle) != 0) {
 	LogMessage(X_ERROR, "Failed present kernel call.\n");
 	return FALSE;
     }
@@ -669,80 +796,232 @@ vmwgfx_scanout_present(ScreenPtr pScreen, int drm_fd,
     return TRUE;
 }
 
+/*
+ * vmwgfx_scanout_pending - Whether a scanout pixmap has damage that
+ * hasn't been sent to the host yet.
+ */
+static Bool
+vmwgfx_scanout_pending(struct vmwgfx_saa_pixmap *vpix)
+{
+    if (vpix->fb_id == -1)
+	return FALSE;
+
+    return ((vpix->pending_update &&
+	     vmwgfx_damage_notempty(vpix->pending_update)) ||
+	    (vpix->pending_present &&
+	     vmwgfx_damage_notempty(vpix->pending_present)));
+}
+
+/*
+ * vmwgfx_scanout_flush - Send the pending updates and presents of a
+ * scanout pixmap to the host.
+ *
+ * The pending damage is accumulated as a bounded set of boxes that may
+ * cover more than the actual damage. Before sending, the extra area is
+ * clipped so that we never send pixels from a stale source.
+ */
+static void
+vmwgfx_scanout_flush(ScreenPtr pScreen, modesettingPtr ms, PixmapPtr pixmap)
+{
+    struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
+    RegionRec reg;
+
+    if (vpix->fb_id == -1)
+	return;
+
+    vmwgfx_saa_flush_deferred(pScreen);
+    REGION_NULL(pScreen, &reg);
+
+    if (vpix->pending_update && vmwgfx_damage_notempty(vpix->pending_update)) {
+	vmwgfx_damage_region(vpix->pending_update, &reg);
+	vmwgfx_damage_empty(vpix->pending_update);
+	REGION_SUBTRACT(pScreen, &reg, &reg, &vpix->base.dirty_hw);
+
+	if (ms->only_hw_presents) {
+	    (void) vmwgfx_hw_accel_validate(pixmap, 0, XA_FLAG_SCANOUT,
+					    0, NULL);
+	    vmwgfx_damage_add_region(vpix->pending_present, &reg);
+	} else
+	    (void) vmwgfx_scanout_update(ms, vpix, &reg,
+					 &vpix->base.dirty_hw);
+    }
+    if (vpix->pending_present &&
+	vmwgfx_damage_notempty(vpix->pending_present)) {
+	vmwgfx_damage_region(vpix->pending_present, &reg);
+	vmwgfx_damage_empty(vpix->pending_present);
+	REGION_SUBTRACT(pScreen, &reg, &reg, &vpix->base.dirty_shadow);
+	if (vpix->dirty_present)
+	    REGION_SUBTRACT(pScreen, &reg, &reg, vpix->dirty_present);
+
+	if (ms->only_hw_presents)
+	    (void) vmwgfx_scanout_update(ms, vpix, &reg,
+					 &vpix->base.dirty_shadow);
+	else
+	    (void) vmwgfx_scanout_present(pScreen, ms, vpix, &reg);
+    }
+
+    REGION_UNINIT(pScreen, &reg);
+}
+
+/*
+ * xorg_flush - Send all pending screen damage to the host.
+ *
+ * This is called when the damage must reach the host now, for example
+ * before the hardware surface of a scanout is read or replaced, and
+ * is therefore never throttled.
+ */
 void xorg_flush(ScreenPtr pScreen)
 {
     ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
     modesettingPtr ms = modesettingPTR(pScrn);
-    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(pScrn);
-    PixmapPtr pixmap = NULL;
-    struct vmwgfx_saa_pixmap *vpix;
-    int i;
-    xf86CrtcPtr crtc;
-    PixmapPtr *pixmaps = calloc(config->num_crtc, sizeof(*pixmaps));
-    unsigned int num_scanout = 0;
     unsigned int j;
 
-    if (!pixmaps) {
-	LogMessage(X_ERROR, "Failed memory allocation during screen "
-		   "update.\n");
+    /*
+     * The list of pixmaps we scan out from is maintained at modeset time.
+     * Scanouts without pending damage don't cost any kernel calls, so
+     * frames without screen damage, like cursor-only updates, are
+     * done without allocations or ioctls.
+     */
+    for (j = 0; j < ms->num_scanouts; ++j)
+	vmwgfx_scanout_flush(pScreen, ms, ms->scanouts[j]);
+}
+
+/*
+ * vmwgfx_throttle_reap - Release signaled screen update fences.
+ *
+ * Returns TRUE if the maximum number of update batches is still
+ * queued in the host.
+ */
+static Bool
+vmwgfx_throttle_reap(modesettingPtr ms)
+{
+    while (ms->num_fences) {
+	uint32_t handle = ms->fences[ms->fence_first];
+
+	/*
+	 * On error, drop the fence rather than stalling updates.
+	 */
+	if (vmwgfx_fence_signaled(ms->fd, handle) == 0)
+	    break;
+
+	vmwgfx_fence_unref(ms->fd, handle);
+	ms->fence_first = (ms->fence_first + 1) % XORG_NR_FENCES;
+	ms->num_fences--;
+    }
+
+    return (ms->num_fences == XORG_NR_FENCES);
+}
+
+/*
+ * vmwgfx_throttle_fence - Fence a batch of screen updates.
+ */
+static void
+vmwgfx_throttle_fence(ScrnInfoPtr pScrn, modesettingPtr ms)
+{
+    uint32_t handle;
+    int ret;
+
+    if (!ms->throttle_fences || ms->num_fences == XORG_NR_FENCES)
+	return;
+
+    ret = vmwgfx_fence_emit(ms->fd, &handle);
+    if (ret) {
+	xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		   "Failed to fence screen updates: %s. "
+		   "Disabling update throttling.\n", strerror(-ret));
+	ms->throttle_fences = FALSE;
 	return;
     }
 
-    /*
-     * Get an array of pixmaps from which we scan out.
-     */
-    for (i=0; i<config->num_crtc; ++i) {
-	crtc = config->crtc[i];
-	if (crtc->enabled) {
-	    pixmap = crtc_get_scanout(crtc);
-	    if (pixmap) {
-
-		/*
-		 * Remove duplicates.
-		 */
-		for (j=0; j<num_scanout; ++j) {
-		    if (pixmap == pixmaps[j])
-			break;
-		}
+    ms->fences[(ms->fence_first + ms->num_fences) % XORG_NR_FENCES] = handle;
+    ms->num_fences++;
+}
 
-		if (j == num_scanout)
-		    pixmaps[num_scanout++] = pixmap;
-	    }
-	}
+/*
+ * vmwgfx_throttle_fini - Release all screen update fences.
+ */
+static void
+vmwgfx_throttle_fini(modesettingPtr ms)
+{
+    while (ms->num_fences) {
+	vmwgfx_fence_unref(ms->fd, ms->fences[ms->fence_first]);
+	ms->fence_first = (ms->fence_first + 1) % XORG_NR_FENCES;
+	ms->num_fences--;
+    }
+}
+
+/*
+ * How often, in milliseconds, we poll for the host to catch up when the
+ * maximum number of update batches is queued.
+ */
+#define VMWGFX_THROTTLE_POLL_MS 2
+
+/**
+ * vmwgfx_paced_flush - Send pending screen damage to the host, subject
+ * to throttling.
+ *
+ * @pScreen: The screen.
+ * @pTimeout: The block handler timeout. Shortened so that we get back
+ * here in time to send deferred damage.
+ *
+ * Damage of a scanout isn't sent until 1 / PresentRate seconds have
+ * passed since its last update. Also nothing is sent while
+ * XORG_NR_FENCES update batches are queued in the host. Deferred damage
+ * stays in the pending regions, where it's merged with new damage and
+ * sent with the next update.
+ */
+static void
+vmwgfx_paced_flush(ScreenPtr pScreen, pointer pTimeout)
+{
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    modesettingPtr ms = modesettingPTR(pScrn);
+    CARD32 now, interval, delay = 0;
+    Bool sent = FALSE;
+    unsigned int j;
+
+    for (j = 0; j < ms->num_scanouts; ++j) {
+	if (vmwgfx_scanout_pending(vmwgfx_saa_pixmap(ms->scanouts[j])))
+	    break;
     }
 
-    if (!num_scanout)
+    if (j == ms->num_scanouts)
 	return;
 
-    for (j=0; j<num_scanout; ++j) {
-	pixmap = pixmaps[j];
-	vpix = vmwgfx_saa_pixmap(pixmap);
-
-	if (vpix->fb_id != -1) {
-	    if (vpix->pending_update) {
-		if (ms->only_hw_presents &&
-		    REGION_NOTEMPTY(pscreen, vpix->pending_update)) {
-		    (void) vmwgfx_hw_accel_validate(pixmap, 0, XA_FLAG_SCANOUT,
-						    0, NULL);
-		    REGION_UNION(pScreen, vpix->pending_present,
-				 vpix->pending_present, vpix->pending_update);
-		} else
-		    (void) vmwgfx_scanout_update(ms->fd, vpix->fb_id,
-						 vpix->pending_update);
-		REGION_EMPTY(pScreen, vpix->pending_update);
-	    }
-	    if (vpix->pending_present) {
-		if (ms->only_hw_presents)
-		    (void) vmwgfx_scanout_update(ms->fd, vpix->fb_id,
-						 vpix->pending_present);
-		else
-		    (void) vmwgfx_scanout_present(pScreen, ms->fd, vpix,
-						  vpix->pending_present);
-		REGION_EMPTY(pScreen, vpix->pending_present);
-	    }
+    if (ms->num_fences && vmwgfx_throttle_reap(ms)) {
+	ms->throttled[THROTTLE_RENDER]++;
+	AdjustWaitForDelay(pTimeout, VMWGFX_THROTTLE_POLL_MS);
+	return;
+    }
+
+    interval = (ms->present_rate) ? 1000 / ms->present_rate : 0;
+    now = GetTimeInMillis();
+
+    for (; j < ms->num_scanouts; ++j) {
+	PixmapPtr pixmap = ms->scanouts[j];
+	struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
+
+	if (!vmwgfx_scanout_pending(vpix))
+	    continue;
+
+	if (interval && (CARD32) (now - vpix->present_time) < interval) {
+	    CARD32 remaining = interval - (now - vpix->present_time);
+
+	    if (!delay || remaining < delay)
+		delay = remaining;
+	    ms->throttled[THROTTLE_SWAP]++;
+	    continue;
 	}
+
+	vmwgfx_scanout_flush(pScreen, ms, pixmap);
+	vpix->present_time = now;
+	sent = TRUE;
     }
-    free(pixmaps);
+
+    if (delay)
+	AdjustWaitForDelay(pTimeout, delay);
+
+    if (sent)
+	vmwgfx_throttle_fence(pScrn, ms);
 }
 
 static void drv_block_handler(BLOCKHANDLER_ARGS_DECL)
@@ -754,10 +1033,16 @@ static void drv_block_handler(BLOCKHANDLER_ARGS_DECL)
     pScreen->BlockHandler(BLOCKHANDLER_ARGS);
     vmwgfx_swap(ms, pScreen, BlockHandler);
 
+    /*
+     * Rendering is batched until we're about to wait for clients.
+     */
+    vmwgfx_saa_flush_deferred(pScreen);
     if (vmwgfx_is_hosted(ms->hdriver))
 	vmwgfx_hosted_post_damage(ms->hdriver, ms->hosted);
     else
-	xorg_flush(pScreen);
+	vmwgfx_paced_flush(pScreen, pTimeout);
+
+    vmwgfx_saa_expire_cache(pScreen, FALSE);
 }
 
 static Bool
@@ -1047,9 +1332,24 @@ drv_screen_init(SCREEN_INIT_ARGS_DECL)
     if (!vmwgfx_saa_init(pScreen, ms->fd, ms->xat, &xorg_flush,
 			 ms->direct_presents,
 			 ms->only_hw_presents,
-			 ms->rendercheck)) {
+			 ms->rendercheck,
+			 ms->dma_band_size * 1024,
+			 ms->box_cost,
+			 (size_t) ms->surface_budget << 20,
+			 (size_t) ms->cache_size << 20)) {
 	FatalError("Failed to initialize SAA.\n");
     }
+    saa_set_dirty_tiles(pScreen, ms->dirty_tiles);
+    if (!saa_set_fallback_threads(pScreen, ms->fallback_threads)) {
+	xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		   "Failed to start software fallback threads.\n");
+	ms->fallback_threads = 0;
+	ms->from_fallback_threads = X_PROBED;
+    }
+
+    ms->throttle_fences = TRUE;
+    ms->fence_first = 0;
+    ms->num_fences = 0;
 
     ms->dri2_available = FALSE;
     if (ms->enable_dri) {
@@ -1073,6 +1373,43 @@ drv_screen_init(SCREEN_INIT_ARGS_DECL)
 	       "Rendercheck mode is %s.\n",
 	       (ms->rendercheck) ? "enabled" : "disabled");
 
+    if (ms->dma_band_size)
+	xf86DrvMsg(pScrn->scrnIndex, ms->from_dma_band_size,
+		   "DMA band size is %u KiB.\n", ms->dma_band_size);
+    else
+	xf86DrvMsg(pScrn->scrnIndex, ms->from_dma_band_size,
+		   "Banded DMA is disabled.\n");
+    xf86DrvMsg(pScrn->scrnIndex, ms->from_box_cost,
+	       "Box merge cost is %u pixels.\n", ms->box_cost);
+    if (ms->present_rate)
+	xf86DrvMsg(pScrn->scrnIndex, ms->from_present_rate,
+		   "Present rate is limited to %u Hz.\n", ms->present_rate);
+    else
+	xf86DrvMsg(pScrn->scrnIndex, ms->from_present_rate,
+		   "Present rate is unlimited.\n");
+    xf86DrvMsg(pScrn->scrnIndex, ms->from_dirty_tiles,
+	       "Dirty tile tracking is %s.\n",
+	       (ms->dirty_tiles) ? "enabled" : "disabled");
+    if (ms->surface_budget)
+	xf86DrvMsg(pScrn->scrnIndex, ms->from_surface_budget,
+		   "Surface budget is %u MiB.\n", ms->surface_budget);
+    else
+	xf86DrvMsg(pScrn->scrnIndex, ms->from_surface_budget,
+		   "Surface budget is unlimited.\n");
+    if (ms->cache_size)
+	xf86DrvMsg(pScrn->scrnIndex, ms->from_cache_size,
+		   "Pixmap storage cache size is %u MiB.\n", ms->cache_size);
+    else
+	xf86DrvMsg(pScrn->scrnIndex, ms->from_cache_size,
+		   "Pixmap storage cache is disabled.\n");
+    if (ms->fallback_threads)
+	xf86DrvMsg(pScrn->scrnIndex, ms->from_fallback_threads,
+		   "Using %u software fallback threads.\n",
+		   ms->fallback_threads);
+    else
+	xf86DrvMsg(pScrn->scrnIndex, ms->from_fallback_threads,
+		   "Software fallbacks are single-threaded.\n");
+
     xf86DrvMsg(pScrn->scrnIndex, ms->from_dri, "Direct rendering (3D) is %s.\n",
 	       (ms->dri2_available) ? "enabled" : "disabled");
     if (ms->xat != NULL) {
@@ -1246,9 +1583,25 @@ drv_close_screen(CLOSE_SCREEN_ARGS_DECL)
     vmwgfx_unwrap(ms, pScreen, BlockHandler);
     vmwgfx_unwrap(ms, pScreen, CreateScreenResources);
 
+    vmwgfx_throttle_fini(ms);
+    xf86DrvMsgVerb(pScrn->scrnIndex, X_INFO, 3,
+		   "Deferred %lu screen updates for host load and %lu for "
+		   "present rate.\n", ms->throttled[THROTTLE_RENDER],
+		   ms->throttled[THROTTLE_SWAP]);
+
+    /*
+     * Cached surfaces need to go before the tracker.
+     */
+    vmwgfx_saa_expire_cache(pScreen, TRUE);
     if (ms->xat)
 	xa_tracker_destroy(ms->xat);
 
+    vmwgfx_box_list_fini(&ms->scanout_boxes);
+    free(ms->scanouts);
+    ms->scanouts = NULL;
+    ms->num_scanouts = 0;
+    ms->scanouts_size = 0;
+
     return (*pScreen->CloseScreen) (CLOSE_SCREEN_ARGS);
 }
 
@@ -47,6 +47,7 @@
 #include <xf86Module.h>
 
 #include "../src/compat-api.h"
+#include "vmwgfx_box.h"
 #ifdef DRI2
 #include <dri2.h>
 #if (!defined(DRI2INFOREC_VERSION) || (DRI2INFOREC_VERSION < 3))
@@ -67,6 +68,9 @@
 
 #define VMWGFX_DRI_DEVICE_LEN 80
 
+/* Default maximum size of a single DMA band, in KiB. */
+#define VMWGFX_DMA_BAND_SIZE_DEFAULT 4096
+
 typedef struct
 {
     int lastInstance;
@@ -75,11 +79,24 @@ typedef struct
     ScrnInfoPtr pScrn_2;
 } EntRec, *EntPtr;
 
+/*
+ * Maximum number of screen update batches queued in the host.
+ */
 #define XORG_NR_FENCES 3
 
+/*
+ * Default size, in MiB, of the pixmap storage cache.
+ */
+#define VMWGFX_CACHE_SIZE_DEFAULT 16
+
+/*
+ * Reasons for deferring a screen update: The host is still busy with
+ * previous updates, or the scanout's present rate limit was hit.
+ */
 enum xorg_throttling_reason {
     THROTTLE_RENDER,
-    THROTTLE_SWAP
+    THROTTLE_SWAP,
+    THROTTLE_NUM_REASONS
 };
 
 struct vmwgfx_hosted;
@@ -112,6 +129,20 @@ typedef struct _modesettingRec
     MessageType from_dp;
     Bool only_hw_presents;
     MessageType from_hwp;
+    unsigned int dma_band_size;
+    MessageType from_dma_band_size;
+    unsigned int box_cost;
+    MessageType from_box_cost;
+    unsigned int present_rate;
+    MessageType from_present_rate;
+    Bool dirty_tiles;
+    MessageType from_dirty_tiles;
+    unsigned int surface_budget;
+    MessageType from_surface_budget;
+    unsigned int cache_size;
+    MessageType from_cache_size;
+    unsigned int fallback_threads;
+    MessageType from_fallback_threads;
     Bool isMaster;
 
 
@@ -132,6 +163,18 @@ typedef struct _modesettingRec
     Bool check_fb_size;
     size_t max_fb_size;
 
+    struct vmwgfx_box_list scanout_boxes;
+    PixmapPtr *scanouts;
+    unsigned int num_scanouts;
+    unsigned int scanouts_size;
+
+    /* Screen update throttling. */
+    Bool throttle_fences;
+    uint32_t fences[XORG_NR_FENCES];
+    unsigned int fence_first;
+    unsigned int num_fences;
+    unsigned long throttled[THROTTLE_NUM_REASONS];
+
     struct xa_tracker *xat;
     const struct vmwgfx_hosted_driver *hdriver;
     struct vmwgfx_hosted *hosted;
@@ -169,6 +212,9 @@ vmwgfx_disable_scanout(ScrnInfoPtr pScrn);
 PixmapPtr
 crtc_get_scanout(xf86CrtcPtr crtc);
 
+void
+vmwgfx_scanout_list_update(ScrnInfoPtr pScrn);
+
 
 /***********************************************************************
  * xorg_output.c
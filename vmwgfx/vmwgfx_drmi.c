@@ -45,7 +45,13 @@
 #include "svga3d_reg.h"
 #include "vmwgfx_driver.h"
 
-static int
+/*
+ * Number of present cliprects we keep on the stack, to avoid allocations
+ * for the common case.
+ */
+#define VMWGFX_PRESENT_STACK_RECTS 64
+
+int
 vmwgfx_fence_wait(int drm_fd, uint32_t handle, Bool unref)
 {
 	struct drm_vmw_fence_wait_arg farg;
@@ -63,7 +69,7 @@ vmwgfx_fence_wait(int drm_fd, uint32_t handle, Bool unref)
 				   sizeof(farg));
 }
 
-static void
+void
 vmwgfx_fence_unref(int drm_fd, uint32_t handle)
 {
 	struct drm_vmw_fence_arg farg;
@@ -75,6 +81,71 @@ vmwgfx_fence_unref(int drm_fd, uint32_t handle)
 			       sizeof(farg));
 }
 
+/**
+ * vmwgfx_fence_emit - Emit a fence after all previously submitted
+ * commands.
+ *
+ * @drm_fd: File descriptor for the drm connection.
+ * @handle: Returns the fence handle.
+ *
+ * Submits an empty command buffer requesting a fence. Since the host
+ * processes commands in order, the fence signals when all previously
+ * submitted commands, including presents and screen updates, are done.
+ * Returns 0 on success.
+ */
+int
+vmwgfx_fence_emit(int drm_fd, uint32_t *handle)
+{
+    struct drm_vmw_execbuf_arg arg;
+    struct drm_vmw_fence_rep rep;
+    int ret;
+
+    memset(&arg, 0, sizeof(arg));
+    memset(&rep, 0, sizeof(rep));
+    rep.error = -EFAULT;
+
+    arg.fence_rep = (unsigned long) &rep;
+    arg.commands = 0;
+    arg.command_size = 0;
+    arg.throttle_us = 0;
+    arg.version = DRM_VMW_EXECBUF_VERSION;
+
+    ret = drmCommandWrite(drm_fd, DRM_VMW_EXECBUF, &arg, sizeof(arg));
+    if (ret)
+	return ret;
+
+    if (rep.error)
+	return rep.error;
+
+    *handle = rep.handle;
+    return 0;
+}
+
+/**
+ * vmwgfx_fence_signaled - Check whether a fence has signaled, without
+ * blocking.
+ *
+ * Returns 1 if the fence has signaled, 0 if not and a negative error
+ * code on error.
+ */
+int
+vmwgfx_fence_signaled(int drm_fd, uint32_t handle)
+{
+    struct drm_vmw_fence_signaled_arg arg;
+    int ret;
+
+    memset(&arg, 0, sizeof(arg));
+    arg.handle = handle;
+    arg.flags = DRM_VMW_FENCE_FLAG_EXEC;
+
+    ret = drmCommandWriteRead(drm_fd, DRM_VMW_FENCE_SIGNALED, &arg,
+			      sizeof(arg));
+    if (ret)
+	return ret;
+
+    return (arg.signaled) ? 1 : 0;
+}
+
 
 int
 vmwgfx_present_readback(int drm_fd, uint32_t fb_id, RegionPtr region)
@@ -84,8 +155,7 @@ vmwgfx_present_readback(int drm_fd, uint32_t fb_id, RegionPtr region)
     struct drm_vmw_fence_rep rep;
     struct drm_vmw_present_readback_arg arg;
     int ret;
-    unsigned i;
-    struct drm_vmw_rect *rects, *r;
+    struct drm_vmw_rect *rects;
 
     rects = calloc(num_clips, sizeof(*rects));
     if (!rects) {
@@ -103,12 +173,7 @@ vmwgfx_present_readback(int drm_fd, uint32_t fb_id, RegionPtr region)
     arg.fence_rep = (unsigned long) &rep;
     rep.error = -EFAULT;
 
-    for (i = 0, r = rects; i < num_clips; ++i, ++r, ++clips) {
-	r->x = clips->x1;
-	r->y = clips->y1;
-	r->w = clips->x2 - clips->x1;
-	r->h = clips->y2 - clips->y1;
-    }
+    vmwgfx_boxes_to_rects(rects, clips, num_clips);
 
     ret = drmCommandWrite(drm_fd, DRM_VMW_PRESENT_READBACK, &arg, sizeof(arg));
     if (ret)
@@ -134,19 +199,21 @@ vmwgfx_present_readback(int drm_fd, uint32_t fb_id, RegionPtr region)
 
 int
 vmwgfx_present(int drm_fd, uint32_t fb_id, unsigned int dst_x,
-	       unsigned int dst_y, RegionPtr region, uint32_t handle)
+	       unsigned int dst_y, BoxPtr clips, unsigned int num_clips,
+	       uint32_t handle)
 {
-    BoxPtr clips = REGION_RECTS(region);
-    unsigned int num_clips = REGION_NUM_RECTS(region);
     struct drm_vmw_present_arg arg;
-    unsigned int i;
-    struct drm_vmw_rect *rects, *r;
+    struct drm_vmw_rect stack_rects[VMWGFX_PRESENT_STACK_RECTS];
+    struct drm_vmw_rect *rects;
     int ret;
 
     if (num_clips == 0)
 	return 0;
 
-    rects = calloc(num_clips, sizeof(*rects));
+    if (num_clips <= VMWGFX_PRESENT_STACK_RECTS)
+	rects = stack_rects;
+    else
+	rects = calloc(num_clips, sizeof(*rects));
     if (!rects) {
 	LogMessage(X_ERROR, "Failed to alloc cliprects for "
 		   "present.\n");
@@ -161,19 +228,15 @@ vmwgfx_present(int drm_fd, uint32_t fb_id, unsigned int dst_x,
     arg.num_clips = num_clips;
     arg.clips_ptr = (unsigned long) rects;
 
-    for (i = 0, r = rects; i < num_clips; ++i, ++r, ++clips) {
-	r->x = clips->x1;
-	r->y = clips->y1;
-	r->w = clips->x2 - clips->x1;
-	r->h = clips->y2 - clips->y1;
-    }
+    vmwgfx_boxes_to_rects(rects, clips, num_clips);
 
     ret = drmCommandWrite(drm_fd, DRM_VMW_PRESENT, &arg, sizeof(arg));
     if (ret) {
 	LogMessage(X_ERROR, "Present error %s.\n", strerror(-ret));
     }
 
-    free(rects);
+    if (rects != stack_rects)
+	free(rects);
     return ((ret != 0) ? -1 : 0);
 }
 
@@ -283,18 +346,103 @@ vmwgfx_dmabuf_destroy(struct vmwgfx_dmabuf *buf)
     free(buf);
 }
 
-int
-vmwgfx_dma(int host_x, int host_y,
-	   RegionPtr region, struct vmwgfx_dmabuf *buf,
-	   uint32_t buf_pitch, uint32_t surface_handle, int to_surface)
+/*
+ * vmwgfx_dma_submit - Submit a surface DMA command buffer.
+ *
+ * If @rep is non-NULL, a fence is requested and returned in @rep.
+ * rep->error is nonzero if no fence was obtained.
+ */
+static int
+vmwgfx_dma_submit(int drm_fd, void *cmd, unsigned int size,
+		  struct drm_vmw_fence_rep *rep)
 {
-    BoxPtr clips = REGION_RECTS(region);
-    unsigned int num_clips = REGION_NUM_RECTS(region);
     struct drm_vmw_execbuf_arg arg;
-    struct drm_vmw_fence_rep rep;
     int ret;
+
+    memset(&arg, 0, sizeof(arg));
+    if (rep) {
+	memset(rep, 0, sizeof(*rep));
+	rep->error = -EFAULT;
+    }
+
+    arg.fence_rep = (unsigned long) rep;
+    arg.commands = (unsigned long)cmd;
+    arg.command_size = size;
+    arg.throttle_us = 0;
+    arg.version = DRM_VMW_EXECBUF_VERSION;
+
+    ret = drmCommandWrite(drm_fd, DRM_VMW_EXECBUF, &arg, sizeof(arg));
+    if (ret)
+	LogMessage(X_ERROR, "DMA error %s.\n", strerror(-ret));
+
+    return ret;
+}
+
+/*
+ * vmwgfx_dma_fence_wait - Wait for and release a DMA fence.
+ */
+static int
+vmwgfx_dma_fence_wait(int drm_fd, struct drm_vmw_fence_rep *rep)
+{
+    int ret;
+
+    if (rep->error != 0)
+	return 0;
+
+    ret = vmwgfx_fence_wait(drm_fd, rep->handle, TRUE);
+    if (ret) {
+	LogMessage(X_ERROR, "DMA fence wait error %s.\n",
+		   strerror(-ret));
+	vmwgfx_fence_unref(drm_fd, rep->handle);
+    }
+    rep->error = -EFAULT;
+
+    return ret;
+}
+
+/*
+ * vmwgfx_dma_fence_release - Release a DMA fence without waiting for it.
+ */
+static void
+vmwgfx_dma_fence_release(int drm_fd, struct drm_vmw_fence_rep *rep)
+{
+    if (rep->error != 0)
+	return;
+
+    vmwgfx_fence_unref(drm_fd, rep->handle);
+    rep->error = -EFAULT;
+}
+
+/*
+ * vmwgfx_dma - DMA a set of boxes between a dma buffer and a surface.
+ *
+ * @clips: The boxes to transfer, in dma buffer coordinates. They need to
+ * be sorted on y1, but may overlap.
+ * @fence: If non-NULL, an upload hands the fence of its last band to the
+ * caller here instead of releasing it, so that the caller can tell when
+ * the dma buffer may be overwritten. fence->error is nonzero if there is
+ * no fence, in which case the upload has already completed. Readbacks
+ * always wait and never return a fence.
+ * @band_size: If nonzero, and the region spans more than @band_size bytes
+ * of the dma buffer, the transfer is split into row bands of at most
+ * @band_size bytes, each submitted as a separate command. At most two
+ * bands are kept in flight: band N + 2 is submitted only after band N
+ * completed, so the host can work on one band while the kernel
+ * validates and queues the next, and other clients' commands get a
+ * chance to interleave with a large transfer. Uploads return without
+ * waiting for the last bands.
+ */
+int
+vmwgfx_dma(int host_x, int host_y,
+	   BoxPtr clips, unsigned int num_clips, struct vmwgfx_dmabuf *buf,
+	   uint32_t buf_pitch, uint32_t surface_handle, int to_surface,
+	   struct drm_vmw_fence_rep *fence, unsigned int band_size)
+{
+    struct drm_vmw_fence_rep rep[2];
     unsigned int size;
-    unsigned i;
+    unsigned int i, first, band, submitted;
+    int band_rows, y1, y2, ext_y1, ext_y2;
+    Bool banded;
     SVGA3dCopyBox *cb;
     SVGA3dCmdSurfaceDMASuffix *suffix;
     SVGA3dCmdSurfaceDMA *body;
@@ -306,26 +454,37 @@ vmwgfx_dma(int host_x, int host_y,
 	SVGA3dCopyBox cb;
     } *cmd;
 
+    if (fence)
+	fence->error = -EFAULT;
+
     if (num_clips == 0)
 	return 0;
 
-    size = sizeof(*cmd) + (num_clips - 1) * sizeof(cmd->cb) +
-	sizeof(*suffix);
-    cmd = malloc(size);
+    /*
+     * Clips are sorted on y1, but y2 may vary arbitrarily.
+     */
+    saa_boxes_rows(clips, num_clips, &ext_y1, &ext_y2);
+
+    band_rows = ext_y2 - ext_y1;
+    if (band_size != 0 && buf_pitch != 0 &&
+	(size_t) band_rows * buf_pitch > band_size) {
+	band_rows = band_size / buf_pitch;
+	if (band_rows == 0)
+	    band_rows = 1;
+	banded = TRUE;
+    } else
+	banded = FALSE;
+
+    /*
+     * The command buffer is sized for the whole clip list, and reused
+     * for each band.
+     */
+    cmd = malloc(sizeof(*cmd) + (num_clips - 1) * sizeof(cmd->cb) +
+		 sizeof(*suffix));
     if (!cmd)
 	return -1;
 
     cmd->header.id = SVGA_3D_CMD_SURFACE_DMA;
-    cmd->header.size = sizeof(cmd->body) + num_clips * sizeof(cmd->cb) +
-	sizeof(*suffix);
-    cb = &cmd->cb;
-
-    suffix = (SVGA3dCmdSurfaceDMASuffix *) &cb[num_clips];
-    suffix->suffixSize = sizeof(*suffix);
-    suffix->maximumOffset = (uint32_t) -1;
-    suffix->flags.discard = 0;
-    suffix->flags.unsynchronized = 0;
-    suffix->flags.reserved = 0;
 
     body = &cmd->body;
     body->guest.ptr.gmrId = buf->gmr_id;
@@ -338,49 +497,101 @@ vmwgfx_dma(int host_x, int host_y,
     body->transfer =  (to_surface ? SVGA3D_WRITE_HOST_VRAM :
 		       SVGA3D_READ_HOST_VRAM);
 
-
-    for (i=0; i < num_clips; i++, cb++, clips++) {
-	cb->x = (uint16_t) clips->x1 + host_x;
-	cb->y = (uint16_t) clips->y1 + host_y;
-	cb->z = 0;
-	cb->srcx = (uint16_t) clips->x1;
-	cb->srcy = (uint16_t) clips->y1;
-	cb->srcz = 0;
-	cb->w = (uint16_t) (clips->x2 - clips->x1);
-	cb->h = (uint16_t) (clips->y2 - clips->y1);
-	cb->d = 1;
+    rep[0].error = -EFAULT;
+    rep[1].error = -EFAULT;
+
+    first = 0;
+    submitted = 0;
+    for (band = 0, y1 = ext_y1; y1 < ext_y2; ++band, y1 = y2) {
+	struct drm_vmw_fence_rep *cur_rep = &rep[submitted & 1];
+	unsigned int n = 0;
+
+	y2 = y1 + band_rows;
+	if (y2 > ext_y2)
+	    y2 = ext_y2;
+
+	/*
+	 * Skip the leading clips that end above this band. Merged clips
+	 * may end in any order, so later ones are clamped below instead.
+	 */
+	while (first < num_clips && clips[first].y2 <= y1)
+	    first++;
+
+	cb = &cmd->cb;
+	for (i = first; i < num_clips && clips[i].y1 < y2; ++i) {
+	    BoxPtr clip = &clips[i];
+	    int cy1, cy2;
+
+	    if (!saa_box_clamp_rows(clip, y1, y2, &cy1, &cy2))
+		continue;
+
+	    cb->x = (uint16_t) clip->x1 + host_x;
+	    cb->y = (uint16_t) cy1 + host_y;
+	    cb->z = 0;
+	    cb->srcx = (uint16_t) clip->x1;
+	    cb->srcy = (uint16_t) cy1;
+	    cb->srcz = 0;
+	    cb->w = (uint16_t) (clip->x2 - clip->x1);
+	    cb->h = (uint16_t) (cy2 - cy1);
+	    cb->d = 1;
 #if 0
-	LogMessage(X_INFO, "DMA! x: %u y: %u srcx: %u srcy: %u w: %u h: %u %s\n",
-		   cb->x, cb->y, cb->srcx, cb->srcy, cb->w, cb->h,
-		   to_surface ? "to" : "from");
+	    LogMessage(X_INFO, "DMA! x: %u y: %u srcx: %u srcy: %u w: %u h: %u %s\n",
+		       cb->x, cb->y, cb->srcx, cb->srcy, cb->w, cb->h,
+		       to_surface ? "to" : "from");
 #endif
+	    cb++;
+	    n++;
+	}
 
-    }
-
-    memset(&arg, 0, sizeof(arg));
-    memset(&rep, 0, sizeof(rep));
-
-    rep.error = -EFAULT;
-    arg.fence_rep = ((to_surface) ? 0UL : (unsigned long)&rep);
-    arg.commands = (unsigned long)cmd;
-    arg.command_size = size;
-    arg.throttle_us = 0;
-    arg.version = DRM_VMW_EXECBUF_VERSION;
-
-    ret = drmCommandWrite(ibuf->drm_fd, DRM_VMW_EXECBUF, &arg, sizeof(arg));
-    if (ret) {
-	LogMessage(X_ERROR, "DMA error %s.\n", strerror(-ret));
+	if (n == 0)
+	    continue;
+
+	size = sizeof(*cmd) + (n - 1) * sizeof(cmd->cb) + sizeof(*suffix);
+	cmd->header.size = sizeof(cmd->body) + n * sizeof(cmd->cb) +
+	    sizeof(*suffix);
+
+	suffix = (SVGA3dCmdSurfaceDMASuffix *) cb;
+	suffix->suffixSize = sizeof(*suffix);
+	suffix->maximumOffset = (uint32_t) -1;
+	suffix->flags.discard = 0;
+	suffix->flags.unsynchronized = 0;
+	suffix->flags.reserved = 0;
+
+	/*
+	 * The fence slot still holds the band submitted two bands ago.
+	 * Wait for it, which bounds the number of bands in flight.
+	 */
+	(void) vmwgfx_dma_fence_wait(ibuf->drm_fd, cur_rep);
+
+	/*
+	 * Unbanded uploads don't need a fence unless the caller keeps
+	 * it. Readbacks always need one, and banded transfers use them
+	 * to bound the number of bands in flight.
+	 */
+	if (vmwgfx_dma_submit(ibuf->drm_fd, cmd, size,
+			      (to_surface && !banded && !fence) ?
+			      NULL : cur_rep) != 0)
+	    break;
+	submitted++;
     }
 
     free(cmd);
 
-    if (rep.error == 0) {
-	ret = vmwgfx_fence_wait(ibuf->drm_fd, rep.handle, TRUE);
-	if (ret) {
-	    LogMessage(X_ERROR, "DMA from host fence wait error %s.\n",
-		       strerror(-ret));
-	    vmwgfx_fence_unref(ibuf->drm_fd, rep.handle);
+    /*
+     * Sync readbacks to avoid racing with Xorg SW rendering. Fences
+     * signal in order, so waiting for the older band first doesn't add
+     * any delay, and the fence of the last band covers the whole upload.
+     */
+    if (!to_surface) {
+	(void) vmwgfx_dma_fence_wait(ibuf->drm_fd, &rep[submitted & 1]);
+	(void) vmwgfx_dma_fence_wait(ibuf->drm_fd, &rep[(submitted + 1) & 1]);
+    } else {
+	if (fence && submitted > 0) {
+	    *fence = rep[(submitted - 1) & 1];
+	    rep[(submitted - 1) & 1].error = -EFAULT;
 	}
+	vmwgfx_dma_fence_release(ibuf->drm_fd, &rep[0]);
+	vmwgfx_dma_fence_release(ibuf->drm_fd, &rep[1]);
     }
 
     return 0;
@@ -36,12 +36,25 @@
 
 struct vmwgfx_dma_ctx;
 
+extern int
+vmwgfx_fence_emit(int drm_fd, uint32_t *handle);
+
+extern int
+vmwgfx_fence_signaled(int drm_fd, uint32_t handle);
+
+extern int
+vmwgfx_fence_wait(int drm_fd, uint32_t handle, Bool unref);
+
+extern void
+vmwgfx_fence_unref(int drm_fd, uint32_t handle);
+
 extern int
 vmwgfx_present_readback(int drm_fd, uint32_t fb_id, RegionPtr region);
 
 extern int
 vmwgfx_present(int drm_fd, uint32_t fb_id, unsigned int dst_x,
-	       unsigned int dst_y, RegionPtr region, uint32_t handle);
+	       unsigned int dst_y, BoxPtr clips, unsigned int num_clips,
+	       uint32_t handle);
 
 struct vmwgfx_dmabuf {
   uint32_t handle;
@@ -61,8 +74,9 @@ vmwgfx_dmabuf_unmap(struct vmwgfx_dmabuf *buf);
 
 extern int
 vmwgfx_dma(int host_x, int host_y,
-	   RegionPtr region, struct vmwgfx_dmabuf *buf,
-	   uint32_t buf_pitch, uint32_t surface_handle, int to_surface);
+	   BoxPtr clips, unsigned int num_clips, struct vmwgfx_dmabuf *buf,
+	   uint32_t buf_pitch, uint32_t surface_handle, int to_surface,
+	   struct drm_vmw_fence_rep *fence, unsigned int band_size);
 
 extern int
 vmwgfx_num_streams(int drm_fd, uint32_t *ntot, uint32_t *nfree);
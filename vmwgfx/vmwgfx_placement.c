@@ -0,0 +1,437 @@
+/*
+ * Copyright 2013 VMWare, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL TUNGSTEN GRAPHICS AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Pixmap placement heuristics. We keep a short, exponentially decaying
+ * history of how each pixmap is used: read by software, written by
+ * software or used by hardware acceleration. Based on that history we
+ * classify pixmaps as hardware, software or mixed, and let the
+ * classification steer the migration decisions of the accelerated paths,
+ * rather than deciding per operation based only on where the
+ * pixmap contents currently are.
+ *
+ * We also account for the memory used by pixmap storage in each location,
+ * and keep hardware surfaces on a least-recently-used list, so that idle
+ * surfaces can be evicted to their GMR or malloc backing store when the
+ * surface budget is exceeded or surface creation fails.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <xorg-server.h>
+#include <os.h>
+#include "vmwgfx_saa_priv.h"
+
+/*
+ * Usage history half-life in milliseconds.
+ */
+#define VMWGFX_USAGE_HALF_LIFE 250
+
+/*
+ * Weight of a single usage event, and saturation value.
+ */
+#define VMWGFX_USAGE_WEIGHT 256
+#define VMWGFX_USAGE_MAX    (VMWGFX_USAGE_WEIGHT << 8)
+
+/*
+ * Minimum total history weight needed to classify a pixmap, and the
+ * factor by which one side needs to dominate the other.
+ */
+#define VMWGFX_USAGE_MIN       (VMWGFX_USAGE_WEIGHT * 4)
+#define VMWGFX_USAGE_DOMINANCE 4
+
+/*
+ * Time in milliseconds a hardware surface needs to be unused before it
+ * may be evicted.
+ */
+#define VMWGFX_EVICT_IDLE 1000
+
+static const char *vmwgfx_placement_names[] = {
+    [VMWGFX_PLACE_UNKNOWN] = "unknown",
+    [VMWGFX_PLACE_SW] = "software",
+    [VMWGFX_PLACE_HW] = "hardware",
+    [VMWGFX_PLACE_MIXED] = "mixed"
+};
+
+static void
+vmwgfx_usage_decay(struct vmwgfx_saa_pixmap *vpix, CARD32 now)
+{
+    CARD32 periods = (now - vpix->usage_time) / VMWGFX_USAGE_HALF_LIFE;
+    int i;
+
+    if (!periods)
+	return;
+
+    vpix->usage_time += periods * VMWGFX_USAGE_HALF_LIFE;
+    for (i = 0; i < VMWGFX_USAGE_NUM; ++i)
+	vpix->usage[i] = (periods < 32) ? vpix->usage[i] >> periods : 0;
+}
+
+static enum vmwgfx_placement
+vmwgfx_placement_classify(const struct vmwgfx_saa_pixmap *vpix)
+{
+    unsigned int sw = vpix->usage[VMWGFX_USAGE_SW_READ] +
+	vpix->usage[VMWGFX_USAGE_SW_WRITE];
+    unsigned int hw = vpix->usage[VMWGFX_USAGE_HW];
+
+    if (sw + hw < VMWGFX_USAGE_MIN)
+	return VMWGFX_PLACE_UNKNOWN;
+    if (hw >= sw * VMWGFX_USAGE_DOMINANCE)
+	return VMWGFX_PLACE_HW;
+    if (sw >= hw * VMWGFX_USAGE_DOMINANCE)
+	return VMWGFX_PLACE_SW;
+
+    return VMWGFX_PLACE_MIXED;
+}
+
+/**
+ * vmwgfx_placement_record - Record a usage event for a pixmap.
+ *
+ * @vsaa: Pointer to the vmwgfx saa struct.
+ * @pixmap: The pixmap.
+ * @usage: The kind of usage.
+ *
+ * Updates the usage history and the placement class of the pixmap.
+ * Returns the new placement class.
+ */
+enum vmwgfx_placement
+vmwgfx_placement_record(struct vmwgfx_saa *vsaa, PixmapPtr pixmap,
+			enum vmwgfx_usage usage)
+{
+    struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
+    enum vmwgfx_placement placement;
+
+    vmwgfx_usage_decay(vpix, GetTimeInMillis());
+    vpix->usage[usage] += VMWGFX_USAGE_WEIGHT;
+    if (vpix->usage[usage] > VMWGFX_USAGE_MAX)
+	vpix->usage[usage] = VMWGFX_USAGE_MAX;
+
+    placement = vmwgfx_placement_classify(vpix);
+    if (placement != vpix->placement) {
+	LogMessageVerb(X_INFO, 7, "Pixmap %p %dx%d placement %s -> %s.\n",
+		       pixmap, pixmap->drawable.width,
+		       pixmap->drawable.height,
+		       vmwgfx_placement_names[vpix->placement],
+		       vmwgfx_placement_names[placement]);
+	vsaa->placement_stats.changes++;
+	vpix->placement = placement;
+    }
+
+    return placement;
+}
+
+/**
+ * vmwgfx_placement_get - Return the current placement class of a pixmap.
+ *
+ * Pixmaps that SAA has pinned because they kept migrating are classified
+ * according to the pin. Callers check software placement through
+ * vmwgfx_placement_avoid_hw().
+ */
+enum vmwgfx_placement
+vmwgfx_placement_get(PixmapPtr pixmap)
+{
+    struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
+
+    switch (saa_pixmap_get_pin(pixmap)) {
+    case saa_pin_sw:
+	return VMWGFX_PLACE_SW;
+    case saa_pin_hw:
+	return VMWGFX_PLACE_HW;
+    default:
+	break;
+    }
+
+    vmwgfx_usage_decay(vpix, GetTimeInMillis());
+    vpix->placement = vmwgfx_placement_classify(vpix);
+    return vpix->placement;
+}
+
+/**
+ * vmwgfx_placement_prefer_hw - Whether a pixmap should be migrated to
+ * hardware even if its contents currently are in software.
+ *
+ * @vsaa: Pointer to the vmwgfx saa struct.
+ * @pixmap: The pixmap.
+ *
+ * Returns TRUE if the pixmap is mostly used by hardware, and either
+ * already has a hardware surface or one fits within the hardware budget.
+ */
+Bool
+vmwgfx_placement_prefer_hw(struct vmwgfx_saa *vsaa, PixmapPtr pixmap)
+{
+    struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
+
+    if (vmwgfx_placement_get(pixmap) != VMWGFX_PLACE_HW)
+	return FALSE;
+
+    if (vpix->hw)
+	return TRUE;
+
+    return (vsaa->hw_budget == 0 ||
+	    vmwgfx_hw_bytes(vsaa) + vmwgfx_placement_hw_size(pixmap) <=
+	    vsaa->hw_budget);
+}
+
+/**
+ * vmwgfx_placement_avoid_hw - Whether hardware acceleration should be
+ * avoided for a pixmap unless its contents are only in hardware.
+ */
+Bool
+vmwgfx_placement_avoid_hw(PixmapPtr pixmap)
+{
+    return (vmwgfx_placement_get(pixmap) == VMWGFX_PLACE_SW);
+}
+
+/**
+ * vmwgfx_placement_sw_access - Record software access to a pixmap and
+ * migrate it to software if it's no longer used by hardware.
+ *
+ * @vsaa: Pointer to the vmwgfx saa struct.
+ * @pixmap: The pixmap.
+ * @access: The access mode.
+ *
+ * Called once per new software access, before the pixmap is mapped.
+ * When a pixmap that is mostly used by software is written, its hardware
+ * surface is released. This reads back the hardware contents once,
+ * instead of bouncing them back and forth, and frees up hardware
+ * resources. Scanout, dri2, hosted and directly presented pixmaps are
+ * left alone.
+ */
+void
+vmwgfx_placement_sw_access(struct vmwgfx_saa *vsaa, PixmapPtr pixmap,
+			   saa_access_t access)
+{
+    struct saa_pixmap *spix = saa_get_saa_pixmap(pixmap);
+    struct vmwgfx_saa_pixmap *vpix = to_vmwgfx_saa_pixmap(spix);
+
+    if (access & SAA_ACCESS_R)
+	(void) vmwgfx_placement_record(vsaa, pixmap, VMWGFX_USAGE_SW_READ);
+    if (access & SAA_ACCESS_W)
+	(void) vmwgfx_placement_record(vsaa, pixmap, VMWGFX_USAGE_SW_WRITE);
+
+    /*
+     * A pixmap that is already mapped for the other access mode keeps
+     * its storage until it is unmapped.
+     */
+    if (!(access & SAA_ACCESS_W) || !vpix->hw || spix->mapped_access ||
+	vmwgfx_placement_get(pixmap) != VMWGFX_PLACE_SW)
+	return;
+
+    if (!WSBMLISTEMPTY(&vpix->scanout_list) || vpix->hw_is_dri2_fronts ||
+	vpix->hw_is_hosted || vpix->dirty_present ||
+	!(vpix->backing & (VMWGFX_PIX_MALLOC | VMWGFX_PIX_GMR)))
+	return;
+
+    LogMessageVerb(X_INFO, 7, "Pixmap %p migrating to software.\n", pixmap);
+    if (vmwgfx_hw_kill(vsaa, spix))
+	vsaa->placement_stats.hw_kills++;
+}
+
+/**
+ * vmwgfx_placement_hw_size - Estimated size of a hardware surface for
+ * a pixmap.
+ */
+size_t
+vmwgfx_placement_hw_size(PixmapPtr pixmap)
+{
+    return (size_t) pixmap->drawable.width * pixmap->drawable.height *
+	((pixmap->drawable.bitsPerPixel + 7) / 8);
+}
+
+/**
+ * vmwgfx_placement_account - Update the memory accounting after pixmap
+ * storage was allocated, resized or freed.
+ *
+ * @vsaa: Pointer to the vmwgfx saa struct.
+ * @pixmap: The pixmap.
+ *
+ * Also adds pixmaps that got a hardware surface to the LRU list, and
+ * removes pixmaps that lost it. A surface shared between pixmaps is
+ * accounted once per pixmap, which errs on the side of evicting early.
+ */
+void
+vmwgfx_placement_account(struct vmwgfx_saa *vsaa, PixmapPtr pixmap)
+{
+    struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
+    size_t size;
+
+    size = (vpix->malloc) ?
+	(size_t) pixmap->devKind * pixmap->drawable.height : 0;
+    vsaa->malloc_bytes -= vpix->malloc_size;
+    vsaa->malloc_bytes += size;
+    vpix->malloc_size = size;
+
+    size = (vpix->gmr) ? vpix->gmr->size : 0;
+    vsaa->gmr_bytes -= vpix->gmr_size;
+    vsaa->gmr_bytes += size;
+    vpix->gmr_size = size;
+
+    size = (vpix->hw) ? vmwgfx_placement_hw_size(pixmap) : 0;
+    vsaa->hw_bytes -= vpix->hw_size;
+    vsaa->hw_bytes += size;
+    vpix->hw_size = size;
+
+    if (!vpix->hw) {
+	WSBMLISTDELINIT(&vpix->lru_head);
+	WSBMLISTDELINIT(&vpix->cow_head);
+	vpix->hw_exported = FALSE;
+    } else if (WSBMLISTEMPTY(&vpix->lru_head))
+	WSBMLISTADDTAIL(&vpix->lru_head, &vsaa->hw_lru);
+}
+
+/**
+ * vmwgfx_placement_touch - Mark the hardware surface of a pixmap as
+ * recently used.
+ *
+ * @vsaa: Pointer to the vmwgfx saa struct.
+ * @pixmap: The pixmap.
+ *
+ * Should be called whenever a hardware surface is about to be used by
+ * an accelerated operation, so that it isn't evicted under our feet.
+ */
+void
+vmwgfx_placement_touch(struct vmwgfx_saa *vsaa, PixmapPtr pixmap)
+{
+    struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
+
+    vpix->hw_used = GetTimeInMillis();
+    if (vpix->hw) {
+	WSBMLISTDELINIT(&vpix->lru_head);
+	WSBMLISTADDTAIL(&vpix->lru_head, &vsaa->hw_lru);
+    }
+}
+
+/*
+ * vmwgfx_placement_evictable - Whether the hardware surface of a pixmap
+ * may be evicted.
+ */
+static Bool
+vmwgfx_placement_evictable(struct vmwgfx_saa_pixmap *vpix, CARD32 now)
+{
+    if (now - vpix->hw_used < VMWGFX_EVICT_IDLE ||
+	vpix->base.read_access || vpix->base.write_access)
+	return FALSE;
+
+    if (!WSBMLISTEMPTY(&vpix->scanout_list) || vpix->hw_is_dri2_fronts ||
+	vpix->hw_is_hosted || vpix->dirty_present ||
+	!(vpix->backing & (VMWGFX_PIX_MALLOC | VMWGFX_PIX_GMR)))
+	return FALSE;
+
+    return (saa_pixmap_get_pin(vpix->base.pixmap) != saa_pin_hw);
+}
+
+/**
+ * vmwgfx_placement_evict - Evict idle hardware surfaces.
+ *
+ * @vsaa: Pointer to the vmwgfx saa struct.
+ * @size: Size of the hardware surface about to be created.
+ * @force: Evict until @size bytes have been freed, regardless of the
+ * surface budget.
+ *
+ * Releases cached surfaces of destroyed pixmaps, and then evicts least
+ * recently used idle surfaces to their software backing store, until a
+ * surface of size @size fits within the budget, or if @force is set,
+ * until @size bytes have been freed.
+ * Returns TRUE if any surface was released or evicted.
+ */
+Bool
+vmwgfx_placement_evict(struct vmwgfx_saa *vsaa, size_t size, Bool force)
+{
+    struct _WsbmListHead *list, *next;
+    CARD32 now = GetTimeInMillis();
+    size_t freed = 0;
+
+    if (force)
+	freed = vmwgfx_cache_release_hw(&vsaa->cache, size);
+    else if (vsaa->hw_budget != 0 &&
+	     vmwgfx_hw_bytes(vsaa) + size > vsaa->hw_budget)
+	freed = vmwgfx_cache_release_hw(&vsaa->cache,
+					vmwgfx_hw_bytes(vsaa) + size -
+					vsaa->hw_budget);
+
+    WSBMLISTFOREACHSAFE(list, next, &vsaa->hw_lru) {
+	struct vmwgfx_saa_pixmap *vpix =
+	    WSBMLISTENTRY(list, struct vmwgfx_saa_pixmap, lru_head);
+	size_t hw_size = vpix->hw_size;
+
+	if (force) {
+	    if (freed >= size)
+		break;
+	} else if (vsaa->hw_budget == 0 ||
+		   vmwgfx_hw_bytes(vsaa) + size <= vsaa->hw_budget)
+	    break;
+
+	if (!vmwgfx_placement_evictable(vpix, now))
+	    continue;
+
+	LogMessageVerb(X_INFO, 7, "Evicting pixmap %p surface.\n",
+		       vpix->base.pixmap);
+	if (!vmwgfx_hw_kill(vsaa, &vpix->base))
+	    continue;
+
+	freed += hw_size;
+	vsaa->placement_stats.evictions++;
+    }
+
+    return (freed != 0);
+}
+
+/**
+ * vmwgfx_placement_report - Log placement statistics.
+ */
+void
+vmwgfx_placement_report(struct vmwgfx_saa *vsaa)
+{
+    LogMessageVerb(X_INFO, 3, "Pixmap placement: %lu class changes, "
+		   "%lu migrations to software, %lu migrations to hardware, "
+		   "%lu accelerations declined, %lu surfaces evicted, "
+		   "%lu surface creation failures, %lu surfaces shared, "
+		   "%lu shared surfaces copied.\n",
+		   vsaa->placement_stats.changes,
+		   vsaa->placement_stats.hw_kills,
+		   vsaa->placement_stats.hw_promotions,
+		   vsaa->placement_stats.hw_declines,
+		   vsaa->placement_stats.evictions,
+		   vsaa->placement_stats.hw_failures,
+		   vsaa->placement_stats.shares,
+		   vsaa->placement_stats.unshares);
+}
+
+/**
+ * vmwgfx_saa_mem_stats - Return pixmap memory usage statistics.
+ *
+ * @pScreen: The screen.
+ * @stats: Filled in with the statistics.
+ */
+void
+vmwgfx_saa_mem_stats(ScreenPtr pScreen, struct vmwgfx_mem_stats *stats)
+{
+    struct vmwgfx_saa *vsaa = to_vmwgfx_saa(saa_get_driver(pScreen));
+
+    stats->malloc_bytes = vsaa->malloc_bytes;
+    stats->gmr_bytes = vsaa->gmr_bytes + vsaa->cache.gmr_bytes;
+    stats->hw_bytes = vmwgfx_hw_bytes(vsaa);
+    stats->hw_budget = vsaa->hw_budget;
+    stats->evictions = vsaa->placement_stats.evictions;
+}
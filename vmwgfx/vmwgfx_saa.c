@@ -25,6 +25,11 @@
  * Author: Thomas Hellstrom <thellstrom@vmware.com>
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
 #include <xorg-server.h>
 #include <xorgVersion.h>
 #include <mi.h>
@@ -35,6 +40,17 @@
 #include "vmwgfx_drmi.h"
 #include "vmwgfx_saa_priv.h"
 
+/*
+ * Smallest image, in bytes, written directly to a hardware surface by
+ * PutImage. Smaller images are cheaper to batch through the shadow.
+ */
+#define VMWGFX_PUT_IMAGE_MIN_BYTES (16 * 1024)
+
+/*
+ * Smallest GMR allocated for image transfers.
+ */
+#define VMWGFX_XFER_GMR_MIN (64 * 1024)
+
 /*
  * Damage to be added as soon as we attach storage to the pixmap.
  */
@@ -64,6 +80,7 @@ vmwgfx_pixmap_add_damage(PixmapPtr pixmap)
 	REGION_RESET(draw->pScreen, &spix->dirty_shadow, &box);
 	REGION_EMPTY(draw->pScreen, &spix->dirty_hw);
     }
+    saa_pixmap_tiles_invalidate(pixmap);
 
     return TRUE;
 }
@@ -94,10 +111,8 @@ vmwgfx_pixmap_remove_present(struct vmwgfx_saa_pixmap *vpix)
 	REGION_DESTROY(pixmap->drawable.pScreen, vpix->dirty_present);
     if (vpix->present_damage)
 	REGION_DESTROY(pixmap->drawable.pScreen, vpix->present_damage);
-    if (vpix->pending_update)
-	REGION_DESTROY(pixmap->drawable.pScreen, vpix->pending_update);
-    if (vpix->pending_present)
-	REGION_DESTROY(pixmap->drawable.pScreen, vpix->pending_present);
+    free(vpix->pending_update);
+    free(vpix->pending_present);
     vpix->dirty_present = NULL;
     vpix->present_damage = NULL;
     vpix->pending_update = NULL;
@@ -119,16 +134,17 @@ vmwgfx_pixmap_add_present(PixmapPtr pixmap, Bool present_opt)
 	if (!vpix->present_damage)
 	    goto out_no_present_damage;
     }
-    vpix->pending_update = REGION_CREATE(pScreen, NULL, 0);
+    vpix->pending_update = calloc(1, sizeof(*vpix->pending_update));
     if (!vpix->pending_update)
 	goto out_no_pending_update;
-    vpix->pending_present = REGION_CREATE(pScreen, NULL, 0);
+    vpix->pending_present = calloc(1, sizeof(*vpix->pending_present));
     if (!vpix->pending_present)
 	goto out_no_pending_present;
 
     return TRUE;
   out_no_pending_present:
-    REGION_DESTROY(pScreen, vpix->pending_update);
+    free(vpix->pending_update);
+    vpix->pending_update = NULL;
   out_no_pending_update:
     if (vpix->present_damage)
 	REGION_DESTROY(pScreen, vpix->present_damage);
@@ -141,6 +157,8 @@ vmwgfx_pixmap_add_present(PixmapPtr pixmap, Bool present_opt)
 static void
 vmwgfx_pixmap_free_storage(struct vmwgfx_saa_pixmap *vpix)
 {
+    PixmapPtr pixmap = vpix->base.pixmap;
+
     if (!(vpix->backing & VMWGFX_PIX_MALLOC) && vpix->malloc) {
 	free(vpix->malloc);
 	vpix->malloc = NULL;
@@ -153,6 +171,155 @@ vmwgfx_pixmap_free_storage(struct vmwgfx_saa_pixmap *vpix)
 	vmwgfx_dmabuf_destroy(vpix->gmr);
 	vpix->gmr = NULL;
     }
+    vmwgfx_placement_account
+	(to_vmwgfx_saa(saa_get_driver(pixmap->drawable.pScreen)), pixmap);
+}
+
+/**
+ * vmwgfx_close_deferred - Close an XA operation left open across
+ * saa_driver calls, without submitting it.
+ *
+ * @vsaa: Pointer to the vmwgfx saa struct.
+ *
+ * vmwgfx_composite_done() and vmwgfx_copy_done() don't close the XA
+ * composite or copy, so that a following operation with the same state
+ * may keep adding rects to it. This function must be called before the
+ * XA context is used for anything else, and before hardware surfaces
+ * bound to it are destroyed or redefined.
+ */
+void
+vmwgfx_close_deferred(struct vmwgfx_saa *vsaa)
+{
+    if (vsaa->comp_open) {
+	xa_composite_done(vsaa->xa_ctx);
+	vsaa->comp_open = FALSE;
+    }
+    if (vsaa->copy_open) {
+	xa_copy_done(vsaa->xa_ctx);
+	vsaa->copy_open = FALSE;
+    }
+}
+
+/**
+ * vmwgfx_flush_deferred - Submit deferred XA rendering.
+ *
+ * @vsaa: Pointer to the vmwgfx saa struct.
+ *
+ * Accelerated composites and copies are not submitted when the
+ * operation is done, but batched until their results are needed. This
+ * function must be called before hardware surface contents are read
+ * outside of the XA context, by the CPU, the kernel or the host, and
+ * before we wait for clients.
+ */
+void
+vmwgfx_flush_deferred(struct vmwgfx_saa *vsaa)
+{
+    vmwgfx_close_deferred(vsaa);
+    if (!vsaa->xa_dirty)
+	return;
+
+    xa_context_flush(vsaa->xa_ctx);
+    vsaa->xa_dirty = FALSE;
+    vsaa->flush_stats.flushes++;
+    vsaa->flush_stats.rects += vsaa->batch_rects;
+    if (vsaa->batch_rects > vsaa->flush_stats.max_rects)
+	vsaa->flush_stats.max_rects = vsaa->batch_rects;
+    vsaa->batch_rects = 0;
+}
+
+/**
+ * vmwgfx_saa_flush_deferred - Submit any deferred rendering of a screen.
+ *
+ * @pScreen: The screen.
+ */
+void
+vmwgfx_saa_flush_deferred(ScreenPtr pScreen)
+{
+    vmwgfx_flush_deferred(to_vmwgfx_saa(saa_get_driver(pScreen)));
+}
+
+static void
+vmwgfx_copy_stride(uint8_t *dst, uint8_t *src, unsigned int dst_pitch,
+		   unsigned int src_pitch, unsigned int y1, unsigned int y2)
+{
+    unsigned int i;
+    unsigned int pitch = (dst_pitch < src_pitch) ? dst_pitch : src_pitch;
+
+    dst += y1 * dst_pitch;
+    src += y1 * src_pitch;
+
+    if (dst_pitch == src_pitch) {
+	memcpy(dst, src, (y2 - y1) * pitch);
+	return;
+    }
+
+    for(i=y1; i<y2; ++i) {
+	memcpy(dst, src, pitch);
+	dst += dst_pitch;
+	src += src_pitch;
+    }
+}
+
+/*
+ * vmwgfx_copy_shadow - Copy the software shadow contents of a pixmap.
+ *
+ * @pScreen: The screen.
+ * @dst: Destination shadow.
+ * @src: Source shadow.
+ * @dst_pitch: Destination pitch.
+ * @src_pitch: Source pitch.
+ * @width: Width of the contents to copy.
+ * @height: Number of rows to copy.
+ * @dirty_hw: Region where the source contents are stale.
+ *
+ * Rows that lie entirely within @dirty_hw are read back from hardware
+ * before they are accessed, and are not copied. Shadow pages are
+ * allocated by the kernel on first touch, so skipping them keeps shadows
+ * of pixmaps mostly rendered by hardware from being populated.
+ */
+static void
+vmwgfx_copy_shadow(ScreenPtr pScreen, uint8_t *dst, uint8_t *src,
+		   unsigned int dst_pitch, unsigned int src_pitch,
+		   unsigned int width, unsigned int height,
+		   RegionPtr dirty_hw)
+{
+    RegionRec valid;
+    BoxRec box;
+    BoxPtr boxes;
+    int n;
+    int y1 = 0, y2 = 0;
+
+    if (!REGION_NOTEMPTY(pScreen, dirty_hw)) {
+	vmwgfx_copy_stride(dst, src, dst_pitch, src_pitch, 0, height);
+	return;
+    }
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = width;
+    box.y2 = height;
+    REGION_INIT(pScreen, &valid, &box, 1);
+    REGION_SUBTRACT(pScreen, &valid, &valid, dirty_hw);
+
+    /*
+     * The region is y-banded, so the boxes come sorted on y1. Merge
+     * their row spans and copy each merged span once.
+     */
+    boxes = REGION_RECTS(&valid);
+    n = REGION_NUM_RECTS(&valid);
+    for (; n > 0; --n, ++boxes) {
+	if (boxes->y1 > y2) {
+	    if (y2 > y1)
+		vmwgfx_copy_stride(dst, src, dst_pitch, src_pitch, y1, y2);
+	    y1 = boxes->y1;
+	}
+	if (boxes->y2 > y2)
+	    y2 = boxes->y2;
+    }
+    if (y2 > y1)
+	vmwgfx_copy_stride(dst, src, dst_pitch, src_pitch, y1, y2);
+
+    REGION_UNINIT(pScreen, &valid);
 }
 
 static Bool
@@ -161,22 +328,43 @@ vmwgfx_pixmap_create_gmr(struct vmwgfx_saa *vsaa, PixmapPtr pixmap)
     struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
     size_t size;
     struct vmwgfx_dmabuf *gmr;
+    Bool recycled;
     void *addr;
 
     if (vpix->gmr)
 	return TRUE;
 
     size = pixmap->devKind * pixmap->drawable.height;
-    gmr = vmwgfx_dmabuf_alloc(vsaa->drm_fd, size);
+    gmr = vmwgfx_cache_get_gmr(&vsaa->cache, size, FALSE);
+    recycled = (gmr != NULL);
+    if (!gmr)
+	gmr = vmwgfx_dmabuf_alloc(vsaa->drm_fd, size);
     if (!gmr)
 	return FALSE;
 
+    /*
+     * A recycled GMR holds the contents of a destroyed pixmap. Clear it,
+     * unless the shadow copy below overwrites all of it.
+     */
+    if (recycled &&
+	(!vpix->malloc || REGION_NOTEMPTY(vsaa->pScreen,
+					  &vpix->base.dirty_hw))) {
+	addr = vmwgfx_dmabuf_map(gmr);
+	if (!addr)
+	    goto out_no_transfer;
+	memset(addr, 0, gmr->size);
+	vmwgfx_dmabuf_unmap(gmr);
+    }
+
     if (vpix->malloc) {
 
 	addr = vmwgfx_dmabuf_map(gmr);
 	if (!addr)
 	    goto out_no_transfer;
-	memcpy(addr, vpix->malloc, size);
+	vmwgfx_copy_shadow(vsaa->pScreen, addr, vpix->malloc,
+			   pixmap->devKind, pixmap->devKind,
+			   pixmap->drawable.width, pixmap->drawable.height,
+			   &vpix->base.dirty_hw);
 	vmwgfx_dmabuf_unmap(gmr);
 
     } else if (!vmwgfx_pixmap_add_damage(pixmap))
@@ -209,6 +397,7 @@ vmwgfx_pixmap_create_sw(struct vmwgfx_saa *vsaa, PixmapPtr pixmap)
 	    goto out_no_malloc;
 	if (!vmwgfx_pixmap_add_damage(pixmap))
 	    goto out_no_damage;
+	vmwgfx_placement_account(vsaa, pixmap);
     } else if (vpix->backing & VMWGFX_PIX_GMR)
 	return vmwgfx_pixmap_create_gmr(vsaa, pixmap);
 
@@ -221,6 +410,81 @@ vmwgfx_pixmap_create_sw(struct vmwgfx_saa *vsaa, PixmapPtr pixmap)
     return FALSE;
 }
 
+/*
+ * vmwgfx_hw_unshare_copy - Replace a shared hardware surface with a
+ * private copy.
+ *
+ * @vsaa: Pointer to the vmwgfx saa struct.
+ * @pixmap: The pixmap.
+ * @width: Width of the shared contents to copy.
+ * @height: Height of the shared contents to copy.
+ *
+ * The new surface is sized after the pixmap, which may differ from the
+ * size of the shared surface if the pixmap is being resized.
+ */
+static Bool
+vmwgfx_hw_unshare_copy(struct vmwgfx_saa *vsaa, PixmapPtr pixmap,
+		       int width, int height)
+{
+    struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
+    enum xa_formats format = xa_surface_format(vpix->hw);
+    struct xa_surface *hw;
+
+    hw = vmwgfx_cache_get_hw(&vsaa->cache,
+			     pixmap->drawable.width,
+			     pixmap->drawable.height,
+			     format, vpix->xa_flags);
+    if (hw == NULL)
+	hw = xa_surface_create(vsaa->xat,
+			       pixmap->drawable.width,
+			       pixmap->drawable.height,
+			       0,
+			       xa_type_other,
+			       format,
+			       vpix->xa_flags);
+    if (hw == NULL)
+	return FALSE;
+
+    vmwgfx_close_deferred(vsaa);
+    if (xa_copy_prepare(vsaa->xa_ctx, hw, vpix->hw) != XA_ERR_NONE) {
+	xa_surface_destroy(hw);
+	return FALSE;
+    }
+    xa_copy(vsaa->xa_ctx, 0, 0, 0, 0, width, height);
+    xa_copy_done(vsaa->xa_ctx);
+    vsaa->xa_dirty = TRUE;
+
+    xa_surface_destroy(vpix->hw);
+    vpix->hw = hw;
+    WSBMLISTDELINIT(&vpix->cow_head);
+    vsaa->placement_stats.unshares++;
+    vmwgfx_placement_account(vsaa, pixmap);
+
+    return TRUE;
+}
+
+/**
+ * vmwgfx_hw_unshare - Make sure a pixmap doesn't share its hardware surface
+ * with other pixmaps.
+ *
+ * @vsaa: Pointer to the vmwgfx saa struct.
+ * @pixmap: The pixmap.
+ *
+ * Must be called before the hardware surface of a pixmap is written to,
+ * redefined or handed out to other processes.
+ */
+Bool
+vmwgfx_hw_unshare(struct vmwgfx_saa *vsaa, PixmapPtr pixmap)
+{
+    struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
+
+    if (!vpix->hw || WSBMLISTEMPTY(&vpix->cow_head))
+	return TRUE;
+
+    return vmwgfx_hw_unshare_copy(vsaa, pixmap, pixmap->drawable.width,
+				  pixmap->drawable.height);
+}
+
 
 /**
  *
@@ -263,6 +527,7 @@ vmwgfx_pixmap_present_readback(struct vmwgfx_saa *vsaa,
     if (!vmwgfx_pixmap_create_gmr(vsaa, pixmap))
 	goto out_err;
 
+    vmwgfx_flush_deferred(vsaa);
     if (vmwgfx_present_readback(vsaa->drm_fd, vpix->fb_id,
 				&intersection) != 0)
 	goto out_err;
@@ -278,6 +543,64 @@ vmwgfx_pixmap_present_readback(struct vmwgfx_saa *vsaa,
     return FALSE;
 }
 
+/**
+ * vmwgfx_xa_dma - DMA a region between system memory and a surface
+ * using the XA transfer path.
+ *
+ * Large transfers are split into row bands of at most
+ * vsaa->dma_band_size bytes. Uploaded bands are flushed one by one,
+ * so that the host may process band N while we copy band N + 1.
+ */
+static int
+vmwgfx_xa_dma(struct vmwgfx_saa *vsaa, struct xa_surface *srf,
+	      uint8_t *data, uint32_t pitch, Bool to_hw, RegionPtr reg)
+{
+    BoxPtr extents = REGION_EXTENTS(vsaa->pScreen, reg);
+    int band_rows = extents->y2 - extents->y1;
+    RegionRec band_reg;
+    BoxRec band;
+    int ret = 0;
+
+    if (vsaa->dma_band_size == 0 ||
+	(size_t) band_rows * pitch <= vsaa->dma_band_size) {
+	ret = xa_surface_dma(vsaa->xa_ctx, srf, data, pitch, (int) to_hw,
+			     (struct xa_box *) REGION_RECTS(reg),
+			     REGION_NUM_RECTS(reg));
+	if (to_hw)
+	    xa_context_flush(vsaa->xa_ctx);
+	return ret;
+    }
+
+    band_rows = vsaa->dma_band_size / pitch;
+    if (band_rows == 0)
+	band_rows = 1;
+
+    REGION_NULL(vsaa->pScreen, &band_reg);
+    band.x1 = extents->x1;
+    band.x2 = extents->x2;
+    for (band.y1 = extents->y1; band.y1 < extents->y2; band.y1 = band.y2) {
+	band.y2 = band.y1 + band_rows;
+	if (band.y2 > extents->y2)
+	    band.y2 = extents->y2;
+
+	REGION_RESET(vsaa->pScreen, &band_reg, &band);
+	REGION_INTERSECT(vsaa->pScreen, &band_reg, &band_reg, reg);
+	if (!REGION_NOTEMPTY(vsaa->pScreen, &band_reg))
+	    continue;
+
+	ret = xa_surface_dma(vsaa->xa_ctx, srf, data, pitch, (int) to_hw,
+			     (struct xa_box *) REGION_RECTS(&band_reg),
+			     REGION_NUM_RECTS(&band_reg));
+	if (ret)
+	    break;
+	if (to_hw)
+	    xa_context_flush(vsaa->xa_ctx);
+    }
+    REGION_UNINIT(vsaa->pScreen, &band_reg);
+
+    return ret;
+}
+
 static Bool
 vmwgfx_saa_dma(struct vmwgfx_saa *vsaa,
 	       PixmapPtr pixmap,
@@ -289,19 +612,41 @@ vmwgfx_saa_dma(struct vmwgfx_saa *vsaa,
 {
     struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
 
+    if (to_hw && (!srf || srf == vpix->hw) &&
+	!vmwgfx_hw_unshare(vsaa, pixmap))
+	goto out_err;
+
     if (!srf)
 	srf = vpix->hw;
 
     if (!srf || (!vpix->gmr && !vpix->malloc))
 	return TRUE;
 
+    vmwgfx_flush_deferred(vsaa);
     if (vpix->gmr && vsaa->can_optimize_dma) {
 	uint32_t handle, dummy;
+	BoxPtr boxes;
+	unsigned int num_boxes;
 
 	if (_xa_surface_handle(srf, &handle, &dummy) != 0)
 	    goto out_err;
-	if (vmwgfx_dma(dx, dy, reg, vpix->gmr, pixmap->devKind, handle,
-		       to_hw) != 0)
+
+	/*
+	 * Merged boxes transfer extra pixels. That's only OK within our
+	 * own surface, and where the source of the transfer isn't stale.
+	 */
+	if (srf == vpix->hw)
+	    vmwgfx_box_optimize(&vsaa->dma_boxes, reg,
+				(to_hw) ? &vpix->base.dirty_hw :
+				&vpix->base.dirty_shadow,
+				vsaa->box_cost, &boxes, &num_boxes);
+	else {
+	    boxes = REGION_RECTS(reg);
+	    num_boxes = REGION_NUM_RECTS(reg);
+	}
+
+	if (vmwgfx_dma(dx, dy, boxes, num_boxes, vpix->gmr, pixmap->devKind,
+		       handle, to_hw, NULL, vsaa->dma_band_size) != 0)
 	    goto out_err;
     } else {
 	uint8_t *data = (uint8_t *) vpix->malloc;
@@ -319,12 +664,7 @@ vmwgfx_saa_dma(struct vmwgfx_saa *vsaa,
 		     dy * pixmap->devKind);
 	}
 
-	ret = xa_surface_dma(vsaa->xa_ctx, srf, data, pixmap->devKind,
-			     (int) to_hw,
-			     (struct xa_box *) REGION_RECTS(reg),
-			     REGION_NUM_RECTS(reg));
-	if (to_hw)
-	    xa_context_flush(vsaa->xa_ctx);
+	ret = vmwgfx_xa_dma(vsaa, srf, data, pixmap->devKind, to_hw, reg);
 	if (vpix->gmr)
 	    vmwgfx_dmabuf_unmap(vpix->gmr);
 	if (dx || dy)
@@ -396,16 +736,25 @@ vmwgfx_release_from_cpu(struct saa_driver *driver, PixmapPtr pixmap, saa_access_
 static void *
 vmwgfx_sync_for_cpu(struct saa_driver *driver, PixmapPtr pixmap, saa_access_t access)
 {
+    struct vmwgfx_saa *vsaa = to_vmwgfx_saa(driver);
+
     /*
      * Errors in this functions will turn up in subsequent map
      * calls.
      */
 
-    (void) vmwgfx_pixmap_create_sw(to_vmwgfx_saa(driver), pixmap);
+    (void) vmwgfx_pixmap_create_sw(vsaa, pixmap);
 
     return NULL;
 }
 
+static void
+vmwgfx_sw_access(struct saa_driver *driver, PixmapPtr pixmap,
+		 saa_access_t access)
+{
+    vmwgfx_placement_sw_access(to_vmwgfx_saa(driver), pixmap, access);
+}
+
 static void *
 vmwgfx_map(struct saa_driver *driver, PixmapPtr pixmap, saa_access_t access)
 {
@@ -444,6 +793,8 @@ vmwgfx_create_pixmap(struct saa_driver *driver, struct saa_pixmap *spix,
     WSBMINITLISTHEAD(&vpix->sync_x_head);
     WSBMINITLISTHEAD(&vpix->scanout_list);
     WSBMINITLISTHEAD(&vpix->pixmap_list);
+    WSBMINITLISTHEAD(&vpix->lru_head);
+    WSBMINITLISTHEAD(&vpix->cow_head);
 
     return TRUE;
 }
@@ -465,8 +816,10 @@ vmwgfx_hw_kill(struct vmwgfx_saa *vsaa,
 				 &spix->dirty_hw))
 	return FALSE;
 
+    vmwgfx_close_deferred(vsaa);
     xa_surface_destroy(vpix->hw);
     vpix->hw = NULL;
+    vmwgfx_placement_account(vsaa, spix->pixmap);
 
     /*
      * Remove damage tracking if this is not a scanout pixmap.
@@ -489,6 +842,7 @@ vmwgfx_flush_dri2(ScreenPtr pScreen)
     if (!pScrn->vtSema)
 	return;
 
+    vmwgfx_flush_deferred(vsaa);
     WSBMLISTFOREACHSAFE(list, next, &vsaa->sync_x_list) {
 	struct vmwgfx_saa_pixmap *vpix =
 	    WSBMLISTENTRY(list, struct vmwgfx_saa_pixmap, sync_x_head);
@@ -503,14 +857,44 @@ vmwgfx_flush_dri2(ScreenPtr pScreen)
 }
 
 
+/*
+ * vmwgfx_pixmap_recycle - Hand over the storage of a pixmap about to be
+ * destroyed to the storage cache.
+ *
+ * Surfaces whose handles have been handed out to clients or other
+ * processes, or that are shared with other pixmaps, may still be in use
+ * elsewhere and are never recycled.
+ */
+static void
+vmwgfx_pixmap_recycle(struct vmwgfx_saa *vsaa, PixmapPtr pixmap)
+{
+    struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
+
+    if (!WSBMLISTEMPTY(&vpix->scanout_list))
+	return;
+
+    if (vpix->hw && !vpix->hw_exported && !vpix->hw_is_dri2_fronts &&
+	!vpix->hw_is_hosted && WSBMLISTEMPTY(&vpix->cow_head) &&
+	vmwgfx_cache_put_hw(&vsaa->cache, vpix->hw, pixmap->drawable.width,
+			    pixmap->drawable.height, vpix->xa_flags,
+			    vpix->hw_size))
+	vpix->hw = NULL;
+
+    if (vpix->gmr && vmwgfx_cache_put_gmr(&vsaa->cache, vpix->gmr, NULL))
+	vpix->gmr = NULL;
+}
+
 static void
 vmwgfx_destroy_pixmap(struct saa_driver *driver, PixmapPtr pixmap)
 {
-    ScreenPtr pScreen = to_vmwgfx_saa(driver)->pScreen;
+    struct vmwgfx_saa *vsaa = to_vmwgfx_saa(driver);
+    ScreenPtr pScreen = vsaa->pScreen;
     struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
     (void) pScreen;
 
+    vmwgfx_close_deferred(vsaa);
     vpix->backing = 0;
+    vmwgfx_pixmap_recycle(vsaa, pixmap);
     vmwgfx_pixmap_free_storage(vpix);
 
     /*
@@ -534,22 +918,6 @@ vmwgfx_destroy_pixmap(struct saa_driver *driver, PixmapPtr pixmap)
  * Makes sure we have a surface with valid contents.
  */
 
-static void
-vmwgfx_copy_stride(uint8_t *dst, uint8_t *src, unsigned int dst_pitch,
-		   unsigned int src_pitch, unsigned int dst_height,
-		   unsigned int src_height)
-{
-    unsigned int i;
-    unsigned int height = (dst_height < src_height) ? dst_height : src_height;
-    unsigned int pitch = (dst_pitch < src_pitch) ? dst_pitch : src_pitch;
-
-    for(i=0; i<height; ++i) {
-	memcpy(dst, src, pitch);
-	dst += dst_pitch;
-	src += src_pitch;
-    }
-}
-
 
 static Bool
 vmwgfx_pix_resize(PixmapPtr pixmap, unsigned int old_pitch,
@@ -575,9 +943,9 @@ vmwgfx_pix_resize(PixmapPtr pixmap, unsigned int old_pitch,
 	if (!new_malloc)
 	    return FALSE;
 
-	vmwgfx_copy_stride(new_malloc, vpix->malloc, pixmap->devKind,
-			   old_pitch, draw->height,
-			   old_height);
+	vmwgfx_copy_shadow(pScreen, new_malloc, vpix->malloc,
+			   pixmap->devKind, old_pitch, old_width,
+			   min(old_height, draw->height), &spix->dirty_hw);
 	free(vpix->malloc);
 	vpix->malloc = new_malloc;
     }
@@ -595,9 +963,10 @@ vmwgfx_pix_resize(PixmapPtr pixmap, unsigned int old_pitch,
 	old_addr = vmwgfx_dmabuf_map(vpix->gmr);
 
 	if (new_addr && old_addr)
-	    vmwgfx_copy_stride(new_addr, old_addr, pixmap->devKind,
-			       old_pitch, draw->height,
-			       old_height);
+	    vmwgfx_copy_shadow(pScreen, new_addr, old_addr,
+			       pixmap->devKind, old_pitch, old_width,
+			       min(old_height, draw->height),
+			       &spix->dirty_hw);
 	else
 	    LogMessage(X_ERROR, "Failed pixmap resize copy.\n");
 
@@ -610,12 +979,24 @@ vmwgfx_pix_resize(PixmapPtr pixmap, unsigned int old_pitch,
     }
 
     if (vpix->hw) {
-	if (xa_surface_redefine(vpix->hw, draw->width, draw->height,
-				draw->depth, xa_type_argb,
-				xa_format_unknown, vpix->xa_flags, 1) != 0)
+	vmwgfx_close_deferred(vsaa);
+	if (!WSBMLISTEMPTY(&vpix->cow_head)) {
+	    if (!vmwgfx_hw_unshare_copy(vsaa, pixmap,
+					min(old_width, draw->width),
+					min(old_height, draw->height)))
+		return FALSE;
+	} else if (xa_surface_redefine(vpix->hw, draw->width, draw->height,
+				       draw->depth, xa_type_argb,
+				       xa_format_unknown, vpix->xa_flags,
+				       1) != 0)
 	    return FALSE;
     }
 
+    /*
+     * The shadow storage was reallocated above, even without a surface.
+     */
+    vmwgfx_placement_account(vsaa, pixmap);
+
     b_box.x1 = 0;
     b_box.x2 = draw->width;
     b_box.y1 = 0;
@@ -629,11 +1010,9 @@ vmwgfx_pix_resize(PixmapPtr pixmap, unsigned int old_pitch,
 	REGION_INTERSECT(pScreen, vpix->dirty_present, vpix->dirty_present,
 			 &b_reg);
     if (vpix->pending_update)
-	REGION_INTERSECT(pScreen, vpix->pending_update, vpix->pending_update,
-			 &b_reg);
+	vmwgfx_damage_clip(vpix->pending_update, &b_box);
     if (vpix->pending_present)
-	REGION_INTERSECT(pScreen, vpix->pending_present,
-			 vpix->pending_present, &b_reg);
+	vmwgfx_damage_clip(vpix->pending_present, &b_box);
     if (vpix->present_damage)
 	REGION_INTERSECT(pScreen, vpix->present_damage, vpix->present_damage,
 			 &b_reg);
@@ -803,6 +1182,7 @@ vmwgfx_create_hw(struct vmwgfx_saa *vsaa,
     struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
     struct xa_surface *hw;
     uint32_t new_flags;
+    size_t size;
 
     if (!vsaa->xat)
 	return FALSE;
@@ -813,15 +1193,47 @@ vmwgfx_create_hw(struct vmwgfx_saa *vsaa,
     new_flags = (vpix->xa_flags & ~vpix->staging_remove_flags) |
 	vpix->staging_add_flags | XA_FLAG_SHARED;
 
-    hw = xa_surface_create(vsaa->xat,
-			   pixmap->drawable.width,
-			   pixmap->drawable.height,
-			   0,
-			   xa_type_other,
-			   vpix->staging_format,
-			   new_flags);
+    /*
+     * Make room within the surface budget, and if surface creation
+     * fails, release cached and idle surfaces and retry once before
+     * giving up.
+     */
+    size = vmwgfx_placement_hw_size(pixmap);
+    if (vsaa->hw_budget && vmwgfx_hw_bytes(vsaa) + size > vsaa->hw_budget)
+	(void) vmwgfx_placement_evict(vsaa, size, FALSE);
+
+    hw = vmwgfx_cache_get_hw(&vsaa->cache,
+			     pixmap->drawable.width,
+			     pixmap->drawable.height,
+			     vpix->staging_format,
+			     new_flags);
     if (hw == NULL)
+	hw = xa_surface_create(vsaa->xat,
+			       pixmap->drawable.width,
+			       pixmap->drawable.height,
+			       0,
+			       xa_type_other,
+			       vpix->staging_format,
+			       new_flags);
+    if (hw == NULL) {
+	Bool released = vmwgfx_cache_expire(&vsaa->cache, TRUE);
+
+	if (vmwgfx_placement_evict(vsaa, size, TRUE) || released)
+	    hw = xa_surface_create(vsaa->xat,
+				   pixmap->drawable.width,
+				   pixmap->drawable.height,
+				   0,
+				   xa_type_other,
+				   vpix->staging_format,
+				   new_flags);
+    }
+    if (hw == NULL) {
+	if (vsaa->placement_stats.hw_failures++ == 0)
+	    LogMessage(X_WARNING, "Failed to create a %dx%d surface. "
+		       "Falling back to software rendering.\n",
+		       pixmap->drawable.width, pixmap->drawable.height);
 	return FALSE;
+    }
 
     vpix->xa_flags = new_flags;
 
@@ -896,6 +1308,88 @@ vmwgfx_hw_validate(PixmapPtr pixmap, RegionPtr region)
     return TRUE;
 }
 
+#ifdef VMWGFX_COPY_SHARE
+/*
+ * vmwgfx_share_allowed - Whether the hardware surface of a pixmap may be
+ * shared. Surfaces that are scanned out, presented from or visible to
+ * other processes must stay private.
+ */
+static Bool
+vmwgfx_share_allowed(struct vmwgfx_saa_pixmap *vpix)
+{
+    return (WSBMLISTEMPTY(&vpix->scanout_list) && !vpix->hw_is_dri2_fronts &&
+	    !vpix->hw_is_hosted && !vpix->hw_exported && !vpix->dirty_present);
+}
+
+/**
+ * vmwgfx_copy_share - Copy the full contents of a pixmap by sharing its
+ * hardware surface.
+ *
+ * @driver: The saa driver.
+ * @src_pixmap: The source pixmap.
+ * @dst_pixmap: The destination pixmap, of the same size and format.
+ *
+ * Instead of copying, the destination takes a reference on the source
+ * surface. Pixmaps sharing a surface are linked through their cow_head
+ * members, and vmwgfx_hw_unshare() gives a pixmap a private copy before
+ * its surface is modified. Returns FALSE if the copy should be done
+ * the usual way.
+ */
+static Bool
+vmwgfx_copy_share(struct saa_driver *driver,
+		  PixmapPtr src_pixmap,
+		  PixmapPtr dst_pixmap)
+{
+    struct vmwgfx_saa *vsaa = to_vmwgfx_saa(driver);
+    struct vmwgfx_saa_pixmap *src_vpix = vmwgfx_saa_pixmap(src_pixmap);
+    struct vmwgfx_saa_pixmap *dst_vpix = vmwgfx_saa_pixmap(dst_pixmap);
+
+    if (!vsaa->xat || !vsaa->is_master || !src_vpix->hw ||
+	src_vpix->hw == dst_vpix->hw)
+	return FALSE;
+
+    if (!vmwgfx_share_allowed(src_vpix) || !vmwgfx_share_allowed(dst_vpix))
+	return FALSE;
+
+    if (dst_vpix->base.mapped_access || dst_vpix->base.read_access ||
+	dst_vpix->base.write_access)
+	return FALSE;
+
+    /*
+     * Only share if the source surface holds all of the source contents.
+     */
+    if (!vmwgfx_hw_validate(src_pixmap, NULL))
+	return FALSE;
+
+    if (!vmwgfx_pixmap_add_damage(dst_pixmap))
+	return FALSE;
+
+    /*
+     * The old destination contents are overwritten entirely and
+     * need no readback.
+     */
+    vmwgfx_close_deferred(vsaa);
+    if (dst_vpix->hw) {
+	xa_surface_destroy(dst_vpix->hw);
+	dst_vpix->hw = NULL;
+	WSBMLISTDELINIT(&dst_vpix->cow_head);
+    }
+
+    dst_vpix->hw = xa_surface_ref(src_vpix->hw);
+    dst_vpix->xa_flags = src_vpix->xa_flags;
+    dst_vpix->staging_format = xa_surface_format(src_vpix->hw);
+    dst_vpix->backing |= VMWGFX_PIX_SURFACE;
+    WSBMLISTADDTAIL(&dst_vpix->cow_head, &src_vpix->cow_head);
+    vmwgfx_placement_account(vsaa, dst_pixmap);
+    vmwgfx_placement_touch(vsaa, src_pixmap);
+    vmwgfx_placement_touch(vsaa, dst_pixmap);
+    vmwgfx_prefer_gmr(vsaa, dst_pixmap);
+    vsaa->placement_stats.shares++;
+
+    return TRUE;
+}
+#endif /* VMWGFX_COPY_SHARE */
+
 static Bool
 vmwgfx_copy_prepare(struct saa_driver *driver,
 		    PixmapPtr src_pixmap,
@@ -930,6 +1424,7 @@ vmwgfx_copy_prepare(struct saa_driver *driver,
 
 	if (!vmwgfx_hw_accel_validate(src_pixmap, 0, 0, 0, src_reg))
 	    return FALSE;
+	vmwgfx_flush_deferred(vsaa);
 	if (vmwgfx_present_prepare(vsaa, src_vpix, dst_vpix)) {
 	    vsaa->present_copy = TRUE;
 	    return TRUE;
@@ -940,14 +1435,28 @@ vmwgfx_copy_prepare(struct saa_driver *driver,
     vsaa->present_copy = FALSE;
     if (src_vpix != dst_vpix) {
 
+	Bool promoted = FALSE;
+
 	/*
 	 * Use hardware acceleration either if source is partially only
 	 * in hardware, or if source is entirely in hardware and destination
-	 * has a hardware surface.
+	 * has a hardware surface that isn't mostly used by software.
+	 * Also migrate to hardware if both pixmaps are mostly used by
+	 * hardware.
 	 */
 
-	if (!has_dirty_hw && !(has_valid_hw && (dst_vpix->hw != NULL)))
-	    return FALSE;
+	if (!has_dirty_hw) {
+	    if (has_valid_hw && (dst_vpix->hw != NULL)) {
+		if (vmwgfx_placement_avoid_hw(dst_pixmap)) {
+		    vsaa->placement_stats.hw_declines++;
+		    return FALSE;
+		}
+	    } else if (vmwgfx_placement_prefer_hw(vsaa, src_pixmap) &&
+		       vmwgfx_placement_prefer_hw(vsaa, dst_pixmap))
+		promoted = TRUE;
+	    else
+		return FALSE;
+	}
 
 	/*
 	 * Determine surface formats.
@@ -979,24 +1488,39 @@ vmwgfx_copy_prepare(struct saa_driver *driver,
 	    return FALSE;
 	if (!vmwgfx_hw_commit(dst_pixmap))
 	    return FALSE;
+	if (!vmwgfx_hw_unshare(vsaa, dst_pixmap))
+	    return FALSE;
 
 	/*
 	 * Migrate data.
 	 */
 
 	if (!vmwgfx_hw_validate(src_pixmap, src_reg)) {
-	    xa_copy_done(vsaa->xa_ctx);
-	    xa_context_flush(vsaa->xa_ctx);
+	    vmwgfx_flush_deferred(vsaa);
 	    return FALSE;
 	}
 
 	/*
-	 * Setup copy state.
+	 * Setup copy state, unless the previous copy between the same
+	 * surfaces is still open.
 	 */
 
-	if (xa_copy_prepare(vsaa->xa_ctx, dst_vpix->hw, src_vpix->hw) !=
-	    XA_ERR_NONE)
-	    return FALSE;
+	if (!vsaa->copy_open || vsaa->copy_src != src_vpix->hw ||
+	    vsaa->copy_dst != dst_vpix->hw) {
+	    vmwgfx_close_deferred(vsaa);
+	    if (xa_copy_prepare(vsaa->xa_ctx, dst_vpix->hw, src_vpix->hw) !=
+		XA_ERR_NONE)
+		return FALSE;
+	    vsaa->copy_open = TRUE;
+	    vsaa->copy_src = src_vpix->hw;
+	    vsaa->copy_dst = dst_vpix->hw;
+	}
+	vsaa->xa_dirty = TRUE;
+
+	if (promoted)
+	    vsaa->placement_stats.hw_promotions++;
+	(void) vmwgfx_placement_record(vsaa, src_pixmap, VMWGFX_USAGE_HW);
+	(void) vmwgfx_placement_record(vsaa, dst_pixmap, VMWGFX_USAGE_HW);
 
 	return TRUE;
     }
@@ -1017,7 +1541,9 @@ vmwgfx_present_done(struct vmwgfx_saa *vsaa)
 
     (void) vmwgfx_present(vsaa->drm_fd, dst_vpix->fb_id,
 			  vsaa->xdiff, vsaa->ydiff,
-			  &vsaa->present_region, vsaa->src_handle);
+			  REGION_RECTS(&vsaa->present_region),
+			  REGION_NUM_RECTS(&vsaa->present_region),
+			  vsaa->src_handle);
 
     REGION_TRANSLATE(pScreen, &vsaa->present_region, vsaa->xdiff, vsaa->ydiff);
     REGION_UNION(pScreen, dst_vpix->present_damage, dst_vpix->present_damage,
@@ -1075,6 +1601,7 @@ vmwgfx_copy(struct saa_driver *driver,
 	return;
     }
     xa_copy(vsaa->xa_ctx, dst_x, dst_y, src_x, src_y, w, h);
+    vsaa->batch_rects++;
 }
 
 static void
@@ -1086,8 +1613,478 @@ vmwgfx_copy_done(struct saa_driver *driver)
 	vmwgfx_present_done(vsaa);
 	return;
     }
-    xa_copy_done(vsaa->xa_ctx);
-    xa_context_flush(vsaa->xa_ctx);
+
+    /*
+     * The copy is left open for the next operation, see
+     * vmwgfx_flush_deferred().
+     */
+}
+
+static Bool
+vmwgfx_solid_prepare(struct saa_driver *driver,
+		     PixmapPtr pixmap,
+		     int alu,
+		     Pixel plane_mask,
+		     Pixel fg)
+{
+    struct vmwgfx_saa *vsaa = to_vmwgfx_saa(driver);
+    struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
+    Bool promoted = FALSE;
+
+    /*
+     * XA interprets the fill color as a8r8g8b8, so only 32 bpp pixmaps
+     * can be filled with their pixel values.
+     */
+    if (!vsaa->xat || !SAA_PM_IS_SOLID(&pixmap->drawable, plane_mask) ||
+	alu != GXcopy || !vsaa->is_master ||
+	pixmap->drawable.bitsPerPixel != 32 ||
+	vmwgfx_is_present_hw(pixmap))
+	return FALSE;
+
+    /*
+     * The fill doesn't read the destination, so use hardware if the
+     * pixmap has a surface that isn't mostly used by software, or if
+     * the pixmap is mostly used by hardware.
+     */
+    if (vpix->hw != NULL) {
+	if (vmwgfx_placement_avoid_hw(pixmap)) {
+	    vsaa->placement_stats.hw_declines++;
+	    return FALSE;
+	}
+    } else if (vmwgfx_placement_prefer_hw(vsaa, pixmap))
+	promoted = TRUE;
+    else
+	return FALSE;
+
+    if (vpix->base.dst_format == 0) {
+	if (!vmwgfx_hw_accel_stage(pixmap, 0, XA_FLAG_RENDER_TARGET, 0))
+	    return FALSE;
+    } else {
+	if (PICT_FORMAT_TYPE(vpix->base.dst_format) != PICT_TYPE_ARGB ||
+	    !vmwgfx_hw_composite_dst_stage(pixmap, vpix->base.dst_format))
+	    return FALSE;
+    }
+
+    if (!vmwgfx_hw_commit(pixmap))
+	return FALSE;
+    if (!vmwgfx_hw_unshare(vsaa, pixmap))
+	return FALSE;
+
+    /*
+     * Keep the unused alpha channel of depth 24 pixmaps opaque.
+     */
+    if (pixmap->drawable.depth == 24)
+	fg |= 0xff000000;
+
+    vmwgfx_close_deferred(vsaa);
+    if (xa_solid_prepare(vsaa->xa_ctx, vpix->hw, fg) != XA_ERR_NONE)
+	return FALSE;
+    vsaa->xa_dirty = TRUE;
+
+    if (promoted)
+	vsaa->placement_stats.hw_promotions++;
+    (void) vmwgfx_placement_record(vsaa, pixmap, VMWGFX_USAGE_HW);
+
+    return TRUE;
+}
+
+static void
+vmwgfx_solid(struct saa_driver *driver, int x1, int y1, int x2, int y2)
+{
+    struct vmwgfx_saa *vsaa = to_vmwgfx_saa(driver);
+
+    xa_solid(vsaa->xa_ctx, x1, y1, x2 - x1, y2 - y1);
+    vsaa->batch_rects++;
+}
+
+static void
+vmwgfx_solid_done(struct saa_driver *driver)
+{
+    struct vmwgfx_saa *vsaa = to_vmwgfx_saa(driver);
+
+    /*
+     * Only close the fill. Submitting it is left to
+     * vmwgfx_flush_deferred().
+     */
+    xa_solid_done(vsaa->xa_ctx);
+}
+
+/*
+ * vmwgfx_xfer_gmr_get - Get a GMR for transferring image data.
+ *
+ * Sizes are rounded up to a power of two, so that transfers of similar
+ * size can reuse each other's GMRs through the storage cache.
+ */
+static struct vmwgfx_dmabuf *
+vmwgfx_xfer_gmr_get(struct vmwgfx_saa *vsaa, size_t size)
+{
+    size_t alloc = VMWGFX_XFER_GMR_MIN;
+    struct vmwgfx_dmabuf *gmr;
+
+    while (alloc < size)
+	alloc <<= 1;
+
+    gmr = vmwgfx_cache_get_gmr(&vsaa->cache, alloc, FALSE);
+    if (!gmr)
+	gmr = vmwgfx_dmabuf_alloc(vsaa->drm_fd, alloc);
+
+    /*
+     * Out of GMR memory. Wait for a cached GMR that is still busy with
+     * an earlier upload.
+     */
+    if (!gmr)
+	gmr = vmwgfx_cache_get_gmr(&vsaa->cache, alloc, TRUE);
+
+    return gmr;
+}
+
+/*
+ * vmwgfx_xfer_gmr_put - Return a transfer GMR to the storage cache.
+ *
+ * If @fence is non-NULL, it is the fence of an upload still reading from
+ * the GMR. The cache then doesn't hand out the GMR again until the fence
+ * has signaled.
+ */
+static void
+vmwgfx_xfer_gmr_put(struct vmwgfx_saa *vsaa, struct vmwgfx_dmabuf *gmr,
+		    struct drm_vmw_fence_rep *fence)
+{
+    uint32_t *handle = (fence && fence->error == 0) ? &fence->handle : NULL;
+
+    if (vmwgfx_cache_put_gmr(&vsaa->cache, gmr, handle))
+	return;
+
+    /*
+     * The kernel keeps the GMR alive until the upload is done.
+     */
+    if (handle)
+	vmwgfx_fence_unref(vsaa->drm_fd, *handle);
+    vmwgfx_dmabuf_destroy(gmr);
+}
+
+/*
+ * vmwgfx_put_image - Write client image data straight into the hardware
+ * surface of a pixmap.
+ *
+ * With GMR DMA available, the covered image rows are copied into a pooled
+ * GMR and transferred with a single surface DMA. Otherwise the image is
+ * handed directly to xa_surface_dma(). Either way, the software shadow is
+ * left alone.
+ */
+static Bool
+vmwgfx_put_image(struct saa_driver *driver, PixmapPtr pixmap,
+		 RegionPtr region, int x, int y, char *bits, int pitch)
+{
+    struct vmwgfx_saa *vsaa = to_vmwgfx_saa(driver);
+    struct vmwgfx_saa_pixmap *vpix = vmwgfx_saa_pixmap(pixmap);
+    int cpp = pixmap->drawable.bitsPerPixel / 8;
+    BoxRec ext = *REGION_EXTENTS(vsaa->pScreen, region);
+    unsigned int w = ext.x2 - ext.x1;
+    unsigned int h = ext.y2 - ext.y1;
+    uint8_t *src = (uint8_t *) bits + (ext.y1 - y) * pitch +
+	(ext.x1 - x) * cpp;
+    int ret;
+
+    if (!vsaa->xat || !vsaa->is_master || !vpix->hw ||
+	vmwgfx_is_present_hw(pixmap))
+	return FALSE;
+
+    if ((size_t) w * h * cpp < VMWGFX_PUT_IMAGE_MIN_BYTES)
+	return FALSE;
+
+    if (vmwgfx_placement_avoid_hw(pixmap)) {
+	vsaa->placement_stats.hw_declines++;
+	return FALSE;
+    }
+
+    if (!vmwgfx_hw_unshare(vsaa, pixmap))
+	return FALSE;
+
+    vmwgfx_flush_deferred(vsaa);
+    if (vsaa->can_optimize_dma) {
+	struct vmwgfx_dmabuf *gmr;
+	struct drm_vmw_fence_rep fence;
+	unsigned int gmr_pitch = w * cpp;
+	uint32_t handle, dummy;
+	void *addr;
+
+	if (_xa_surface_handle(vpix->hw, &handle, &dummy) != 0)
+	    return FALSE;
+
+	gmr = vmwgfx_xfer_gmr_get(vsaa, (size_t) gmr_pitch * h);
+	if (!gmr)
+	    return FALSE;
+
+	addr = vmwgfx_dmabuf_map(gmr);
+	if (!addr) {
+	    vmwgfx_xfer_gmr_put(vsaa, gmr, NULL);
+	    return FALSE;
+	}
+	vmwgfx_copy_stride(addr, src, gmr_pitch, pitch, 0, h);
+	vmwgfx_dmabuf_unmap(gmr);
+
+	/*
+	 * Don't wait for the upload. Its fence goes back to the cache
+	 * with the GMR, which isn't handed out again until it signals.
+	 */
+	REGION_TRANSLATE(vsaa->pScreen, region, -ext.x1, -ext.y1);
+	ret = vmwgfx_dma(ext.x1, ext.y1, REGION_RECTS(region),
+			 REGION_NUM_RECTS(region), gmr, gmr_pitch, handle,
+			 1, &fence, vsaa->dma_band_size);
+	REGION_TRANSLATE(vsaa->pScreen, region, ext.x1, ext.y1);
+	vmwgfx_xfer_gmr_put(vsaa, gmr, &fence);
+    } else {
+	/*
+	 * xa_surface_dma() addresses the data with surface coordinates,
+	 * so the image needs to cover the surface origin.
+	 */
+	if (x > 0 || y > 0)
+	    return FALSE;
+
+	ret = vmwgfx_xa_dma(vsaa, vpix->hw,
+			    (uint8_t *) bits - (y * pitch + x * cpp), pitch,
+			    TRUE, region);
+    }
+
+    if (ret) {
+	LogMessage(X_ERROR, "DMA to surface failed.\n");
+	return FALSE;
+    }
+
+    (void) vmwgfx_placement_record(vsaa, pixmap, VMWGFX_USAGE_HW);
+    return TRUE;
+}
+
+/*
+ * vmwgfx_copy_boxes - Copy the boxes of a region between two images
+ * with the same pixel size. @dst and @src point at region coordinate
+ * (0, 0) of the respective image.
+ */
+static void
+vmwgfx_copy_boxes(uint8_t *dst, unsigned int dst_pitch,
+		  const uint8_t *src, unsigned int src_pitch,
+		  int cpp, RegionPtr region)
+{
+    BoxPtr box = REGION_RECTS(region);
+    int n = REGION_NUM_RECTS(region);
+
+    for (; n > 0; --n, ++box) {
+	uint8_t *d = dst + box->y1 * dst_pitch + box->x1 * cpp;
+	const uint8_t *s = src + box->y1 * src_pitch + box->x1 * cpp;
+	unsigned int bytes = (box->x2 - box->x1) * cpp;
+	int y;
+
+	for (y = box->y1; y < box->y2; ++y) {
+	    memcpy(d, s, bytes);
+	    d += dst_pitch;
+	    s += src_pitch;
+	}
+    }
+}
+
+/*
+ * vmwgfx_get_image - Read a box of a pixmap straight into client image
+ * data.
+ *
+ * Parts of the box that are dirty in hardware are read back, into a
+ * pooled GMR with GMR DMA available and directly into @d otherwise. The
+ * rest is copied from the software shadow. Neither the dirty regions nor
+ * placement state are changed, so repeated reads of a hardware-rendered
+ * area, like screen captures, keep the pixmap in hardware.
+ */
+static Bool
+vmwgfx_get_image(struct saa_driver *driver, PixmapPtr pixmap,
+		 BoxPtr box, char *d, int pitch)
+{
+    struct vmwgfx_saa *vsaa = to_vmwgfx_saa(driver);
+    ScreenPtr pScreen = vsaa->pScreen;
+    struct saa_pixmap *spix = saa_get_saa_pixmap(pixmap);
+    struct vmwgfx_saa_pixmap *vpix = to_vmwgfx_saa_pixmap(spix);
+    int cpp = pixmap->drawable.bitsPerPixel / 8;
+    uint8_t *dst = (uint8_t *) d;
+    RegionRec hw_reg, sw_reg;
+    Bool ret = FALSE;
+
+    if (!vsaa->xat || !vsaa->is_master || !vpix->hw)
+	return FALSE;
+
+    REGION_INIT(pScreen, &hw_reg, box, 1);
+    REGION_NULL(pScreen, &sw_reg);
+
+    if (vpix->malloc || vpix->gmr) {
+	REGION_SUBTRACT(pScreen, &sw_reg, &hw_reg, &spix->dirty_hw);
+	REGION_INTERSECT(pScreen, &hw_reg, &hw_reg, &spix->dirty_hw);
+    } else if (RECT_IN_REGION(pScreen, &spix->dirty_shadow, box) != rgnOUT)
+	goto out;
+
+    /*
+     * If nothing needs to be read back, the software path is as cheap.
+     * Presented contents live in the framebuffer, not in the surface.
+     */
+    if (!REGION_NOTEMPTY(pScreen, &hw_reg) ||
+	(vpix->dirty_present &&
+	 RECT_IN_REGION(pScreen, vpix->dirty_present, box) != rgnOUT))
+	goto out;
+
+    /*
+     * xa_surface_dma() addresses the data with surface coordinates,
+     * so without GMR DMA, the box needs to start at the surface origin.
+     */
+    if (!vsaa->can_optimize_dma && (box->x1 != 0 || box->y1 != 0))
+	goto out;
+
+    /*
+     * From here on, the regions are relative to @d.
+     */
+    REGION_TRANSLATE(pScreen, &hw_reg, -box->x1, -box->y1);
+    REGION_TRANSLATE(pScreen, &sw_reg, -box->x1, -box->y1);
+
+    vmwgfx_flush_deferred(vsaa);
+    if (vsaa->can_optimize_dma) {
+	BoxRec ext = *REGION_EXTENTS(pScreen, &hw_reg);
+	unsigned int gmr_pitch = (ext.x2 - ext.x1) * cpp;
+	struct vmwgfx_dmabuf *gmr;
+	uint32_t handle, dummy;
+	uint8_t *addr;
+	int err;
+
+	if (_xa_surface_handle(vpix->hw, &handle, &dummy) != 0)
+	    goto out;
+
+	gmr = vmwgfx_xfer_gmr_get(vsaa,
+				  (size_t) gmr_pitch * (ext.y2 - ext.y1));
+	if (!gmr)
+	    goto out;
+
+	REGION_TRANSLATE(pScreen, &hw_reg, -ext.x1, -ext.y1);
+	err = vmwgfx_dma(box->x1 + ext.x1, box->y1 + ext.y1,
+			 REGION_RECTS(&hw_reg),
+			 REGION_NUM_RECTS(&hw_reg), gmr, gmr_pitch, handle,
+			 0, NULL, vsaa->dma_band_size);
+	addr = (err) ? NULL : (uint8_t *) vmwgfx_dmabuf_map(gmr);
+	if (addr) {
+	    vmwgfx_copy_boxes(dst + ext.y1 * pitch + ext.x1 * cpp, pitch,
+			      addr, gmr_pitch, cpp, &hw_reg);
+	    vmwgfx_dmabuf_unmap(gmr);
+	}
+	vmwgfx_xfer_gmr_put(vsaa, gmr, NULL);
+	if (!addr)
+	    goto out_err;
+    } else if (vmwgfx_xa_dma(vsaa, vpix->hw, dst, pitch, FALSE, &hw_reg))
+	goto out_err;
+
+    if (REGION_NOTEMPTY(pScreen, &sw_reg)) {
+	uint8_t *shadow = (uint8_t *) vpix->malloc;
+
+	if (vpix->gmr) {
+	    shadow = (uint8_t *) vmwgfx_dmabuf_map(vpix->gmr);
+	    if (!shadow)
+		goto out;
+	}
+	vmwgfx_copy_boxes(dst, pitch, shadow + box->y1 * pixmap->devKind +
+			  box->x1 * cpp, pixmap->devKind, cpp, &sw_reg);
+	if (vpix->gmr)
+	    vmwgfx_dmabuf_unmap(vpix->gmr);
+    }
+
+    ret = TRUE;
+    goto out;
+
+  out_err:
+    LogMessage(X_ERROR, "DMA from surface failed.\n");
+  out:
+    REGION_UNINIT(pScreen, &sw_reg);
+    REGION_UNINIT(pScreen, &hw_reg);
+    return ret;
+}
+
+/*
+ * vmwgfx_comp_key_pict - Fill in the composite state key of a picture.
+ * The key must be zero-filled on entry.
+ */
+static void
+vmwgfx_comp_key_pict(struct vmwgfx_comp_key_pict *key,
+		     PicturePtr pict, PixmapPtr pix)
+{
+    key->pixmap = pix;
+    key->hw = (pix) ? vmwgfx_saa_pixmap(pix)->hw : NULL;
+    key->format = pict->format;
+    key->repeat = pict->repeat;
+    key->repeat_type = pict->repeatType;
+    key->filter = pict->filter;
+    key->component_alpha = pict->componentAlpha;
+    if (pict->transform) {
+	key->has_transform = TRUE;
+	key->transform = *pict->transform;
+    }
+    if (pict->pSourcePict) {
+	key->has_source = TRUE;
+	key->source_type = pict->pSourcePict->type;
+	if (key->source_type == SourcePictTypeSolidFill)
+	    key->solid_color = pict->pSourcePict->solidFill.color;
+    }
+}
+
+static void
+vmwgfx_comp_key(struct vmwgfx_comp_key *key, CARD8 op,
+		PicturePtr src_pict, PicturePtr mask_pict,
+		PicturePtr dst_pict, PixmapPtr src_pix,
+		PixmapPtr mask_pix, PixmapPtr dst_pix)
+{
+    memset(key, 0, sizeof(*key));
+    key->op = op;
+    vmwgfx_comp_key_pict(&key->src, src_pict, src_pix);
+    if (mask_pict) {
+	key->has_mask = TRUE;
+	vmwgfx_comp_key_pict(&key->mask, mask_pict, mask_pix);
+    }
+    vmwgfx_comp_key_pict(&key->dst, dst_pict, dst_pix);
+}
+
+/*
+ * vmwgfx_comp_region_valid - Check that a hardware surface holds valid
+ * contents for the region of a composite operation.
+ */
+static Bool
+vmwgfx_comp_region_valid(struct vmwgfx_saa *vsaa, PixmapPtr pix,
+			 RegionPtr region)
+{
+    Bool dirty_hw, valid_hw;
+
+    vmwgfx_check_hw_contents(vsaa, vmwgfx_saa_pixmap(pix), region,
+			     &dirty_hw, &valid_hw);
+    return valid_hw;
+}
+
+/*
+ * vmwgfx_composite_reuse - Check whether a composite operation may be
+ * added to the composite left open by the previous one.
+ *
+ * That requires the same state, down to the hardware surfaces, and that
+ * the surfaces already hold valid contents for the operation, since
+ * we're not going to migrate any data.
+ */
+static Bool
+vmwgfx_composite_reuse(struct vmwgfx_saa *vsaa,
+		       const struct vmwgfx_comp_key *key,
+		       PixmapPtr src_pix, PixmapPtr mask_pix,
+		       PixmapPtr dst_pix, RegionPtr src_region,
+		       RegionPtr mask_region, RegionPtr dst_region)
+{
+    if (!vsaa->comp_open ||
+	memcmp(key, &vsaa->comp_key, sizeof(*key)) != 0)
+	return FALSE;
+
+    if (src_pix && !vmwgfx_comp_region_valid(vsaa, src_pix, src_region))
+	return FALSE;
+    if (key->has_mask && mask_pix &&
+	!vmwgfx_comp_region_valid(vsaa, mask_pix, mask_region))
+	return FALSE;
+    if (saa_op_reads_destination(key->op) &&
+	!vmwgfx_comp_region_valid(vsaa, dst_pix, dst_region))
+	return FALSE;
+
+    return TRUE;
 }
 
 static Bool
@@ -1107,12 +2104,29 @@ vmwgfx_composite_prepare(struct saa_driver *driver, CARD8 op,
     Bool tmp_valid_hw;
     Bool dirty_hw;
     Bool valid_hw;
+    Bool promoted = FALSE;
     RegionRec empty;
     struct xa_composite *xa_comp;
+    enum vmwgfx_comp_reject reason;
+    struct vmwgfx_comp_key key;
 
+    reason = VMWGFX_COMP_REJECT_NOT_MASTER;
     if (!vsaa->is_master)
-	return FALSE;
+	goto out_err;
+
+    /*
+     * If nothing changed since the previous composite operation, keep
+     * adding rects to the composite it left open.
+     */
+    vmwgfx_comp_key(&key, op, src_pict, mask_pict, dst_pict,
+		    src_pix, mask_pix, dst_pix);
+    if (vmwgfx_composite_reuse(vsaa, &key, src_pix, mask_pix, dst_pix,
+			       src_region, mask_region, dst_region)) {
+	vsaa->comp_reuses++;
+	goto out_record;
+    }
 
+    vmwgfx_close_deferred(vsaa);
     REGION_NULL(pScreen, &empty);
 
     /*
@@ -1147,17 +2161,29 @@ vmwgfx_composite_prepare(struct saa_driver *driver, CARD8 op,
 
     /*
      * In rendercheck mode we try to accelerate all supported
-     * composite operations.
+     * composite operations. Otherwise let the usage history of the
+     * destination override the policy above, unless there are dirty
+     * hw regions.
      */
 
-    if (!valid_hw && !dirty_hw && !vsaa->rendercheck)
-	goto out_err;
+    reason = VMWGFX_COMP_REJECT_PLACEMENT;
+    if (!dirty_hw && !vsaa->rendercheck) {
+	if (!valid_hw) {
+	    if (!vmwgfx_placement_prefer_hw(vsaa, dst_pix))
+		goto out_err;
+	    promoted = TRUE;
+	} else if (vmwgfx_placement_avoid_hw(dst_pix)) {
+	    vsaa->placement_stats.hw_declines++;
+	    goto out_err;
+	}
+    }
 
     /*
      * Then, setup most of the XA composite state (except hardware surfaces)
      * and check whether XA can accelerate.
      */
 
+    reason = VMWGFX_COMP_REJECT_UNSUPPORTED;
     xa_comp = vmwgfx_xa_setup_comp(vsaa->vcomp, op,
 				   src_pict, mask_pict, dst_pict);
     if (!xa_comp)
@@ -1169,6 +2195,7 @@ vmwgfx_composite_prepare(struct saa_driver *driver, CARD8 op,
     /*
      * Check that we can create the needed hardware surfaces.
      */
+    reason = VMWGFX_COMP_REJECT_STAGE;
     if (src_pix && !vmwgfx_hw_composite_src_stage(src_pix, src_pict->format))
 	goto out_err;
     if (mask_pict && mask_pix &&
@@ -1180,11 +2207,12 @@ vmwgfx_composite_prepare(struct saa_driver *driver, CARD8 op,
     /*
      * Seems OK. Commit the changes, creating hardware surfaces.
      */
+    reason = VMWGFX_COMP_REJECT_COMMIT;
     if (src_pix && !vmwgfx_hw_commit(src_pix))
 	goto out_err;
     if (mask_pict && mask_pix && !vmwgfx_hw_commit(mask_pix))
 	goto out_err;
-    if (!vmwgfx_hw_commit(dst_pix))
+    if (!vmwgfx_hw_commit(dst_pix) || !vmwgfx_hw_unshare(vsaa, dst_pix))
 	goto out_err;
 
     /*
@@ -1197,6 +2225,7 @@ vmwgfx_composite_prepare(struct saa_driver *driver, CARD8 op,
     /*
      * Migrate data to surfaces.
      */
+    reason = VMWGFX_COMP_REJECT_VALIDATE;
     if (src_pix && src_region && !vmwgfx_hw_validate(src_pix, NULL))
 	goto out_err;
     if (mask_pict && mask_pix && mask_region &&
@@ -1210,12 +2239,32 @@ vmwgfx_composite_prepare(struct saa_driver *driver, CARD8 op,
      * Bind the XA state. This must be done after data migration, since
      * migration may change the hardware surfaces.
      */
+    reason = VMWGFX_COMP_REJECT_PREPARE;
     if (xa_composite_prepare(vsaa->xa_ctx, xa_comp))
 	goto out_err;
 
+    /*
+     * Hardware surfaces may have been created or replaced above.
+     */
+    vmwgfx_comp_key(&vsaa->comp_key, op, src_pict, mask_pict, dst_pict,
+		    src_pix, mask_pix, dst_pix);
+    vsaa->comp_open = TRUE;
+    vsaa->xa_dirty = TRUE;
+
+    if (promoted)
+	vsaa->placement_stats.hw_promotions++;
+  out_record:
+    if (src_pix)
+	(void) vmwgfx_placement_record(vsaa, src_pix, VMWGFX_USAGE_HW);
+    if (mask_pict && mask_pix)
+	(void) vmwgfx_placement_record(vsaa, mask_pix, VMWGFX_USAGE_HW);
+    (void) vmwgfx_placement_record(vsaa, dst_pix, VMWGFX_USAGE_HW);
+
     return TRUE;
 
   out_err:
+    vsaa->comp_rejects[reason]++;
+    VMWGFX_PROBE1(composite_reject, reason);
     return FALSE;
 }
 
@@ -1229,15 +2278,60 @@ vmwgfx_composite(struct saa_driver *driver,
 
     xa_composite_rect(vsaa->xa_ctx, src_x, src_y, mask_x, mask_y,
 		      dst_x, dst_y, width, height);
+    vsaa->batch_rects++;
 }
 
+/*
+ * vmwgfx_composite_done - The composite is left open for the next
+ * operation, see vmwgfx_close_deferred().
+ */
 static void
 vmwgfx_composite_done(struct saa_driver *driver)
 {
-   struct vmwgfx_saa *vsaa = to_vmwgfx_saa(driver);
+}
+
+static const char *vmwgfx_comp_reject_names[VMWGFX_COMP_REJECT_NUM] = {
+    "not master", "placement policy", "unsupported by XA",
+    "surface staging failed", "surface creation failed",
+    "data migration failed", "XA prepare failed"
+};
+
+/*
+ * vmwgfx_comp_reject_report - Log why composite operations were left to
+ * software. The cost of the resulting fallbacks is accounted for by SAA.
+ */
+static void
+vmwgfx_comp_reject_report(struct vmwgfx_saa *vsaa, int verb, Bool reset)
+{
+    int i;
+
+    for (i = 0; i < VMWGFX_COMP_REJECT_NUM; ++i) {
+	if (!vsaa->comp_rejects[i])
+	    continue;
+
+	LogMessageVerb(X_INFO, verb, "Composite rejected, %s: %lu times.\n",
+		       vmwgfx_comp_reject_names[i], vsaa->comp_rejects[i]);
+    }
+
+    if (reset)
+	memset(vsaa->comp_rejects, 0, sizeof(vsaa->comp_rejects));
+}
+
+/**
+ * vmwgfx_saa_fallback_report - Log software fallback and composite
+ * rejection statistics.
+ *
+ * @pScreen: The screen.
+ * @verb: Log verbosity of the messages.
+ * @reset: Clear the statistics after logging them.
+ */
+void
+vmwgfx_saa_fallback_report(ScreenPtr pScreen, int verb, Bool reset)
+{
+    struct vmwgfx_saa *vsaa = to_vmwgfx_saa(saa_get_driver(pScreen));
 
-   xa_composite_done(vsaa->xa_ctx);
-   xa_context_flush(vsaa->xa_ctx);
+    saa_fallback_report(pScreen, verb, reset);
+    vmwgfx_comp_reject_report(vsaa, verb, reset);
 }
 
 static void
@@ -1245,8 +2339,20 @@ vmwgfx_takedown(struct saa_driver *driver)
 {
     struct vmwgfx_saa *vsaa = to_vmwgfx_saa(driver);
 
+    vmwgfx_flush_deferred(vsaa);
+    vmwgfx_comp_reject_report(vsaa, 3, FALSE);
+    LogMessageVerb(X_INFO, 3, "Composite state reused %lu times.\n",
+		   vsaa->comp_reuses);
+    LogMessageVerb(X_INFO, 3, "Deferred XA flushes: %lu, %lu rects, "
+		   "at most %lu rects per flush.\n",
+		   vsaa->flush_stats.flushes, vsaa->flush_stats.rects,
+		   vsaa->flush_stats.max_rects);
+    vmwgfx_placement_report(vsaa);
+    vmwgfx_cache_report(&vsaa->cache);
+    (void) vmwgfx_cache_expire(&vsaa->cache, TRUE);
     if (vsaa->vcomp)
 	vmwgfx_free_composite(vsaa->vcomp);
+    vmwgfx_box_list_fini(&vsaa->dma_boxes);
     free(vsaa);
 }
 
@@ -1337,35 +2443,17 @@ vmwgfx_dirty(struct saa_driver *driver, PixmapPtr pixmap,
 			 vpix->dirty_present, damage);
 	    REGION_EMPTY(vsaa->pScreen, vpix->present_damage);
 	} else {
-	    if (REGION_NOTEMPTY(vsaa->pScreen, vpix->pending_update)) {
-		RegionRec reg;
-
-		REGION_NULL(vsaa->pScreen, &reg);
-		REGION_INTERSECT(vsaa->pScreen, &reg, vpix->pending_update,
-				 damage);
-		if (REGION_NOTEMPTY(vsaa->pScreen, &reg))
-		    vsaa->present_flush(vsaa->pScreen);
-		REGION_UNINIT(pScreen, &reg);
-	    }
-	    REGION_UNION(vsaa->pScreen, vpix->pending_present,
-			 vpix->pending_present, damage);
+	    if (vmwgfx_damage_intersects(vpix->pending_update, damage))
+		vsaa->present_flush(vsaa->pScreen);
+	    vmwgfx_damage_add_region(vpix->pending_present, damage);
 	    if (vpix->dirty_present)
 		REGION_SUBTRACT(vsaa->pScreen, vpix->dirty_present,
 				vpix->dirty_present, damage);
 	}
     } else {
-	    if (REGION_NOTEMPTY(vsaa->pScreen, vpix->pending_present)) {
-		RegionRec reg;
-
-		REGION_NULL(vsaa->pScreen, &reg);
-		REGION_INTERSECT(vsaa->pScreen, &reg, vpix->pending_present,
-				 damage);
-		if (REGION_NOTEMPTY(vsaa->pScreen, &reg))
-		    vsaa->present_flush(vsaa->pScreen);
-		REGION_UNINIT(pScreen, &reg);
-	    }
-	    REGION_UNION(vsaa->pScreen, vpix->pending_update,
-			 vpix->pending_update, damage);
+	    if (vmwgfx_damage_intersects(vpix->pending_present, damage))
+		vsaa->present_flush(vsaa->pScreen);
+	    vmwgfx_damage_add_region(vpix->pending_update, damage);
 	    if (vpix->dirty_present)
 		REGION_SUBTRACT(vsaa->pScreen, vpix->dirty_present,
 				vpix->dirty_present, damage);
@@ -1396,6 +2484,16 @@ static const struct saa_driver vmwgfx_saa_driver = {
     .composite = vmwgfx_composite,
     .composite_done = vmwgfx_composite_done,
     .takedown = vmwgfx_takedown,
+#ifdef VMWGFX_COPY_SHARE
+    .copy_share = vmwgfx_copy_share,
+#endif
+    .solid_prepare = vmwgfx_solid_prepare,
+    .solid = vmwgfx_solid,
+    .solid_done = vmwgfx_solid_done,
+    .put_image = vmwgfx_put_image,
+    .get_image = vmwgfx_get_image,
+    .sw_access = vmwgfx_sw_access,
+    .flags = SAA_DRIVER_CA_OVER_TWO_PASS,
 };
 
 
@@ -1404,7 +2502,11 @@ vmwgfx_saa_init(ScreenPtr pScreen, int drm_fd, struct xa_tracker *xat,
 		void (*present_flush)(ScreenPtr pScreen),
 		Bool direct_presents,
 		Bool only_hw_presents,
-		Bool rendercheck)
+		Bool rendercheck,
+		unsigned int dma_band_size,
+		unsigned int box_cost,
+		size_t hw_budget,
+		size_t cache_size)
 {
     struct vmwgfx_saa *vsaa;
 
@@ -1427,10 +2529,16 @@ vmwgfx_saa_init(ScreenPtr pScreen, int drm_fd, struct xa_tracker *xat,
     vsaa->use_present_opt = direct_presents;
     vsaa->only_hw_presents = only_hw_presents;
     vsaa->rendercheck = rendercheck;
+    vsaa->dma_band_size = dma_band_size;
+    vsaa->box_cost = box_cost;
+    vsaa->hw_budget = hw_budget;
+    vmwgfx_box_list_init(&vsaa->dma_boxes);
     vsaa->is_master = TRUE;
     vsaa->known_prime_format = FALSE;
     WSBMINITLISTHEAD(&vsaa->sync_x_list);
     WSBMINITLISTHEAD(&vsaa->pixmaps);
+    WSBMINITLISTHEAD(&vsaa->hw_lru);
+    vmwgfx_cache_init(&vsaa->cache, drm_fd, cache_size);
 
     vsaa->driver = vmwgfx_saa_driver;
     vsaa->vcomp = vmwgfx_alloc_composite();
@@ -1471,14 +2579,15 @@ vmwgfx_scanout_refresh(PixmapPtr pixmap)
     box.x2 = pixmap->drawable.width;
     box.y2 = pixmap->drawable.height;
 
-    REGION_RESET(vsaa->pScreen, vpix->pending_present, &box);
-    if (vpix->dirty_present)
-	REGION_SUBTRACT(vsaa->pScreen, vpix->pending_present,
-			vpix->pending_present, vpix->dirty_present);
-    REGION_SUBTRACT(vsaa->pScreen, vpix->pending_present,
-		    vpix->pending_present, &vpix->base.dirty_shadow);
-    REGION_COPY(vsaa->pScreen, vpix->pending_update,
-		&vpix->base.dirty_shadow);
+    /*
+     * Stale parts of the surface, and parts of the screen that are
+     * newer than the surface are removed from the present at flush time.
+     */
+    vmwgfx_damage_empty(vpix->pending_present);
+    vmwgfx_damage_add_box(vpix->pending_present, &box);
+    vmwgfx_damage_empty(vpix->pending_update);
+    vmwgfx_damage_add_region(vpix->pending_update,
+			     &vpix->base.dirty_shadow);
 }
 
 /*
@@ -1569,7 +2678,7 @@ vmwgfx_scanout_unref(struct vmwgfx_screen_entry *entry)
     WSBMLISTDELINIT(&entry->scanout_head);
 
     if (WSBMLISTEMPTY(&vpix->scanout_list)) {
-	REGION_EMPTY(vsaa->pScreen, vpix->pending_update);
+	vmwgfx_damage_empty(vpix->pending_update);
 	drmModeRmFB(vsaa->drm_fd, vpix->fb_id);
 	vpix->fb_id = -1;
 	vmwgfx_pixmap_present_readback(vsaa, pixmap, NULL);
@@ -1590,6 +2699,23 @@ vmwgfx_saa_set_master(ScreenPtr pScreen)
     vmwgfx_flush_dri2(pScreen);
 }
 
+/**
+ * vmwgfx_saa_expire_cache - Release old entries of the pixmap storage cache.
+ *
+ * @pScreen: The screen.
+ * @close: Release all entries and disable the cache, since the screen is
+ * about to be closed.
+ */
+void
+vmwgfx_saa_expire_cache(ScreenPtr pScreen, Bool close)
+{
+    struct vmwgfx_saa *vsaa = to_vmwgfx_saa(saa_get_driver(pScreen));
+
+    (void) vmwgfx_cache_expire(&vsaa->cache, close);
+    if (close)
+	vsaa->cache.max_bytes = 0;
+}
+
 void
 vmwgfx_saa_drop_master(ScreenPtr pScreen)
 {
@@ -1598,6 +2724,7 @@ vmwgfx_saa_drop_master(ScreenPtr pScreen)
     struct vmwgfx_saa_pixmap *vpix;
     struct saa_pixmap *spix;
 
+    vmwgfx_flush_deferred(vsaa);
     WSBMLISTFOREACH(list, &vsaa->pixmaps) {
 	vpix = WSBMLISTENTRY(list, struct vmwgfx_saa_pixmap, pixmap_list);
 	spix = &vpix->base;
@@ -1724,6 +2851,7 @@ vmwgfx_saa_copy_to_surface(DrawablePtr pDraw, uint32_t surface_fd,
 	goto out_no_copy;
     }
 
+    vmwgfx_flush_deferred(vsaa);
     if (xa_copy_prepare(vsaa->xa_ctx, dst, vpix->hw) != XA_ERR_NONE) {
 	ret = FALSE;
 	goto out_no_copy;
@@ -31,6 +31,7 @@
 #include "saa.h"
 #include <xa_composite.h>
 #include "vmwgfx_drmi.h"
+#include "vmwgfx_box.h"
 #include "wsbm_util.h"
 
 
@@ -39,20 +40,42 @@
 #define VMWGFX_FLAG_AVOID_HWACCEL (1 << 2) /* Avoid Hardware acceleration on this pixmap */
 #define VMWGFX_FLAG_USE_PRESENT   (1 << 3) /* Use presents when copying to this pixmap */
 
+/*
+ * Kinds of pixmap usage tracked by the placement heuristics.
+ */
+enum vmwgfx_usage {
+    VMWGFX_USAGE_SW_READ,
+    VMWGFX_USAGE_SW_WRITE,
+    VMWGFX_USAGE_HW,
+    VMWGFX_USAGE_NUM
+};
+
+/*
+ * Placement classes, based on usage history.
+ */
+enum vmwgfx_placement {
+    VMWGFX_PLACE_UNKNOWN,
+    VMWGFX_PLACE_SW,
+    VMWGFX_PLACE_HW,
+    VMWGFX_PLACE_MIXED
+};
+
 struct vmwgfx_saa_pixmap {
     struct saa_pixmap base;
     RegionPtr dirty_present;
     RegionPtr present_damage;
-    RegionPtr pending_update;
-    RegionPtr pending_present;
+    struct vmwgfx_damage *pending_update;
+    struct vmwgfx_damage *pending_present;
     uint32_t usage_flags;
     uint32_t backing;
     void *malloc;
     struct vmwgfx_dmabuf *gmr;
     struct xa_surface *hw;
     uint32_t fb_id;
+    CARD32 present_time;
     int hw_is_dri2_fronts;
     Bool hw_is_hosted;
+    Bool hw_exported;
     struct _WsbmListHead sync_x_head;
     struct _WsbmListHead scanout_list;
     struct _WsbmListHead pixmap_list;
@@ -61,6 +84,32 @@ struct vmwgfx_saa_pixmap {
     uint32_t staging_add_flags;
     uint32_t staging_remove_flags;
     enum xa_formats staging_format;
+
+    /* Placement heuristics, see vmwgfx_placement.c */
+    CARD32 usage_time;
+    unsigned int usage[VMWGFX_USAGE_NUM];
+    enum vmwgfx_placement placement;
+
+    /* Memory accounting, see vmwgfx_placement.c */
+    size_t malloc_size;
+    size_t gmr_size;
+    size_t hw_size;
+    CARD32 hw_used;
+    struct _WsbmListHead lru_head;
+
+    /* Pixmaps sharing the hardware surface, see vmwgfx_copy_share() */
+    struct _WsbmListHead cow_head;
+};
+
+/*
+ * Pixmap memory usage, in bytes.
+ */
+struct vmwgfx_mem_stats {
+    size_t malloc_bytes;
+    size_t gmr_bytes;
+    size_t hw_bytes;
+    size_t hw_budget;
+    unsigned long evictions;
 };
 
 struct vmwgfx_screen_entry {
@@ -85,7 +134,20 @@ vmwgfx_saa_init(ScreenPtr pScreen, int drm_fd, struct xa_tracker *xat,
 		void (*present_flush)(ScreenPtr pScreen),
 		Bool direct_presents,
 		Bool only_hw_presents,
-		Bool rendercheck);
+		Bool rendercheck,
+		unsigned int dma_band_size,
+		unsigned int box_cost,
+		size_t hw_budget,
+		size_t cache_size);
+
+extern void
+vmwgfx_saa_expire_cache(ScreenPtr pScreen, Bool close);
+
+extern void
+vmwgfx_saa_mem_stats(ScreenPtr pScreen, struct vmwgfx_mem_stats *stats);
+
+extern void
+vmwgfx_saa_fallback_report(ScreenPtr pScreen, int verb, Bool reset);
 
 extern uint32_t
 vmwgfx_scanout_ref(struct vmwgfx_screen_entry *box);
@@ -102,6 +164,9 @@ vmwgfx_remove_dri2_list(struct vmwgfx_saa_pixmap *vpix);
 extern void
 vmwgfx_flush_dri2(ScreenPtr pScreen);
 
+extern void
+vmwgfx_saa_flush_deferred(ScreenPtr pScreen);
+
 extern Bool
 vmwgfx_hw_dri2_validate(PixmapPtr pixmap, unsigned int depth);
 
@@ -132,6 +197,7 @@ vmwgfx_saa_copy_to_surface(DrawablePtr pDraw, uint32_t surface_fd,
 #define xa_surface_destroy(_a) xa_surface_unref(_a)
 #define _xa_surface_handle(_a, _b, _c)		\
     xa_surface_handle(_a, xa_handle_type_shared, _b, _c)
+#define VMWGFX_COPY_SHARE
 
 #endif /*  (XA_TRACKER_VERSION_MAJOR <= 1) */
 #endif
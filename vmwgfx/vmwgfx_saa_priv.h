@@ -34,6 +34,91 @@
 #include <xorg-server.h>
 #include <picturestr.h>
 #include "vmwgfx_saa.h"
+#include "vmwgfx_box.h"
+
+struct vmwgfx_placement_stats {
+    unsigned long changes;
+    unsigned long hw_kills;
+    unsigned long hw_promotions;
+    unsigned long hw_declines;
+    unsigned long evictions;
+    unsigned long hw_failures;
+    unsigned long shares;
+    unsigned long unshares;
+};
+
+/*
+ * Submissions of deferred XA rendering, see vmwgfx_flush_deferred().
+ */
+struct vmwgfx_flush_stats {
+    unsigned long flushes;
+    unsigned long rects;
+    unsigned long max_rects;
+};
+
+/*
+ * Reasons for vmwgfx_composite_prepare() to reject a composite operation
+ * and leave it to a software fallback.
+ */
+enum vmwgfx_comp_reject {
+    VMWGFX_COMP_REJECT_NOT_MASTER,
+    VMWGFX_COMP_REJECT_PLACEMENT,
+    VMWGFX_COMP_REJECT_UNSUPPORTED,
+    VMWGFX_COMP_REJECT_STAGE,
+    VMWGFX_COMP_REJECT_COMMIT,
+    VMWGFX_COMP_REJECT_VALIDATE,
+    VMWGFX_COMP_REJECT_PREPARE,
+    VMWGFX_COMP_REJECT_NUM
+};
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define VMWGFX_PROBE1(name, a) DTRACE_PROBE1(vmwgfx, name, a)
+#else
+#define VMWGFX_PROBE1(name, a)
+#endif
+
+/*
+ * The composite state that vmwgfx_composite_prepare() bound to the XA
+ * context, see vmwgfx_comp_key_pict(). Zero-filled before use so that
+ * keys can be compared with memcmp().
+ */
+struct vmwgfx_comp_key_pict {
+    PixmapPtr pixmap;
+    struct xa_surface *hw;
+    PictFormatShort format;
+    unsigned int repeat;
+    unsigned int repeat_type;
+    unsigned int filter;
+    unsigned int component_alpha;
+    Bool has_transform;
+    PictTransform transform;
+    Bool has_source;
+    unsigned int source_type;
+    CARD32 solid_color;
+};
+
+struct vmwgfx_comp_key {
+    CARD8 op;
+    Bool has_mask;
+    struct vmwgfx_comp_key_pict src;
+    struct vmwgfx_comp_key_pict mask;
+    struct vmwgfx_comp_key_pict dst;
+};
+
+/*
+ * Cache of backing storage of destroyed pixmaps, see vmwgfx_cache.c
+ */
+struct vmwgfx_cache {
+    struct _WsbmListHead entries;
+    int drm_fd;
+    size_t bytes;
+    size_t hw_bytes;
+    size_t gmr_bytes;
+    size_t max_bytes;
+    unsigned long hits;
+    unsigned long misses;
+};
 
 struct vmwgfx_saa {
     struct saa_driver driver;
@@ -55,11 +140,31 @@ struct vmwgfx_saa {
     Bool only_hw_presents;
     Bool rendercheck;
     Bool is_master;
+    unsigned int dma_band_size;
+    unsigned int box_cost;
+    struct vmwgfx_box_list dma_boxes;
     Bool known_prime_format;
     void (*present_flush) (ScreenPtr pScreen);
     struct _WsbmListHead sync_x_list;
     struct _WsbmListHead pixmaps;
     struct vmwgfx_composite *vcomp;
+    size_t malloc_bytes;
+    size_t gmr_bytes;
+    size_t hw_bytes;
+    size_t hw_budget;
+    struct _WsbmListHead hw_lru;
+    struct vmwgfx_cache cache;
+    struct vmwgfx_placement_stats placement_stats;
+    unsigned long comp_rejects[VMWGFX_COMP_REJECT_NUM];
+    Bool comp_open;
+    struct vmwgfx_comp_key comp_key;
+    unsigned long comp_reuses;
+    Bool copy_open;
+    struct xa_surface *copy_src;
+    struct xa_surface *copy_dst;
+    Bool xa_dirty;
+    unsigned long batch_rects;
+    struct vmwgfx_flush_stats flush_stats;
 };
 
 static inline struct vmwgfx_saa *
@@ -67,6 +172,15 @@ to_vmwgfx_saa(struct saa_driver *driver) {
     return (struct vmwgfx_saa *) driver;
 }
 
+/*
+ * Hardware surface memory charged to the budget, including cached
+ * surfaces of destroyed pixmaps.
+ */
+static inline size_t
+vmwgfx_hw_bytes(struct vmwgfx_saa *vsaa) {
+    return vsaa->hw_bytes + vsaa->cache.hw_bytes;
+}
+
 /*
  * In vmwgfx_saa.c
  */
@@ -77,7 +191,64 @@ vmwgfx_hw_kill(struct vmwgfx_saa *vsaa,
 Bool
 vmwgfx_create_hw(struct vmwgfx_saa *vsaa,
 		 PixmapPtr pixmap);
+Bool
+vmwgfx_hw_unshare(struct vmwgfx_saa *vsaa, PixmapPtr pixmap);
+void
+vmwgfx_close_deferred(struct vmwgfx_saa *vsaa);
+void
+vmwgfx_flush_deferred(struct vmwgfx_saa *vsaa);
+
 
+/*
+ * vmwgfx_placement.c
+ */
+
+enum vmwgfx_placement
+vmwgfx_placement_record(struct vmwgfx_saa *vsaa, PixmapPtr pixmap,
+			enum vmwgfx_usage usage);
+enum vmwgfx_placement
+vmwgfx_placement_get(PixmapPtr pixmap);
+Bool
+vmwgfx_placement_prefer_hw(struct vmwgfx_saa *vsaa, PixmapPtr pixmap);
+Bool
+vmwgfx_placement_avoid_hw(PixmapPtr pixmap);
+void
+vmwgfx_placement_sw_access(struct vmwgfx_saa *vsaa, PixmapPtr pixmap,
+			   saa_access_t access);
+size_t
+vmwgfx_placement_hw_size(PixmapPtr pixmap);
+void
+vmwgfx_placement_account(struct vmwgfx_saa *vsaa, PixmapPtr pixmap);
+void
+vmwgfx_placement_touch(struct vmwgfx_saa *vsaa, PixmapPtr pixmap);
+Bool
+vmwgfx_placement_evict(struct vmwgfx_saa *vsaa, size_t size, Bool force);
+void
+vmwgfx_placement_report(struct vmwgfx_saa *vsaa);
+
+/*
+ * vmwgfx_cache.c
+ */
+
+void
+vmwgfx_cache_init(struct vmwgfx_cache *cache, int drm_fd, size_t max_bytes);
+Bool
+vmwgfx_cache_expire(struct vmwgfx_cache *cache, Bool all);
+size_t
+vmwgfx_cache_release_hw(struct vmwgfx_cache *cache, size_t size);
+Bool
+vmwgfx_cache_put_hw(struct vmwgfx_cache *cache, struct xa_surface *hw,
+		    int width, int height, uint32_t flags, size_t size);
+struct xa_surface *
+vmwgfx_cache_get_hw(struct vmwgfx_cache *cache, int width, int height,
+		    enum xa_formats format, uint32_t flags);
+Bool
+vmwgfx_cache_put_gmr(struct vmwgfx_cache *cache, struct vmwgfx_dmabuf *gmr,
+		     const uint32_t *fence);
+struct vmwgfx_dmabuf *
+vmwgfx_cache_get_gmr(struct vmwgfx_cache *cache, size_t size, Bool wait);
+void
+vmwgfx_cache_report(struct vmwgfx_cache *cache);
 
 /*
  * vmwgfx_xa_surface.c
@@ -523,6 +523,10 @@ display_video(ScreenPtr pScreen, struct xorg_xv_port_priv *pPriv, int id,
 
    DamageRegionAppend(&pPixmap->drawable, dstRegion);
 
+   /*
+    * We share the XA context with the accelerated rendering.
+    */
+   vmwgfx_saa_flush_deferred(pScreen);
    blit_ret = xa_yuv_planar_blit(pPriv->r, src_x, src_y, src_w, src_h,
 				 dst_x, dst_y, dst_w, dst_h,
 				 (struct xa_box *)REGION_RECTS(dstRegion),
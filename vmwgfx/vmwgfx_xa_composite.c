@@ -151,7 +151,8 @@ vmwgfx_xa_setup_pict(PicturePtr pict,
 	return FALSE;
 
     /*
-     * Saa doesn't let drivers accelerate alpha maps.
+     * Saa doesn't let drivers accelerate alpha maps. It stages source
+     * and mask alpha maps into plain pictures before calling us.
      */
     xa_pict->alpha_map = NULL;
     xa_pict->component_alpha = pict->componentAlpha;
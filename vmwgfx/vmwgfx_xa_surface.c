@@ -323,6 +323,16 @@ vmwgfx_hw_commit(PixmapPtr pixmap)
 	if (vpix->staging_format != xa_surface_format(vpix->hw))
 	    LogMessage(X_INFO, "Changing hardware format.\n");
 
+	/*
+	 * Redefining a shared surface would change it for all pixmaps
+	 * sharing it.
+	 */
+	if ((vpix->staging_format != xa_surface_format(vpix->hw) ||
+	     new_flags != vpix->xa_flags) &&
+	    !vmwgfx_hw_unshare(vsaa, pixmap))
+	    return FALSE;
+
+	vmwgfx_close_deferred(vsaa);
 	if (xa_surface_redefine(vpix->hw,
 				pixmap->drawable.width,
 				pixmap->drawable.height,
@@ -332,25 +342,37 @@ vmwgfx_hw_commit(PixmapPtr pixmap)
 				new_flags, 1) != XA_ERR_NONE)
 	    return FALSE;
 	vpix->xa_flags = new_flags;
+	vmwgfx_placement_account(vsaa, pixmap);
     } else if (!vmwgfx_create_hw(vsaa, pixmap))
 	return FALSE;
 
+    vmwgfx_placement_touch(vsaa, pixmap);
     return TRUE;
 }
 
 /*
  * Create an accel surface if there is none, and make sure the region
  * given by @region is valid. If @region is NULL, the whole surface
- * will be valid. This is a utility convenience function only.
+ * will be valid. Surfaces that are to be rendered to or scanned out are
+ * made private to the pixmap. This is a utility convenience function only.
  */
 Bool
 vmwgfx_hw_accel_validate(PixmapPtr pixmap, unsigned int depth,
 			 uint32_t add_flags, uint32_t remove_flags,
 			 RegionPtr region)
 {
-    return (vmwgfx_hw_accel_stage(pixmap, depth, add_flags, remove_flags) &&
-	    vmwgfx_hw_commit(pixmap) &&
-	    vmwgfx_hw_validate(pixmap, region));
+    struct vmwgfx_saa *vsaa =
+	to_vmwgfx_saa(saa_get_driver(pixmap->drawable.pScreen));
+
+    if (!vmwgfx_hw_accel_stage(pixmap, depth, add_flags, remove_flags) ||
+	!vmwgfx_hw_commit(pixmap))
+	return FALSE;
+
+    if ((add_flags & (XA_FLAG_RENDER_TARGET | XA_FLAG_SCANOUT)) &&
+	!vmwgfx_hw_unshare(vsaa, pixmap))
+	return FALSE;
+
+    return vmwgfx_hw_validate(pixmap, region);
 }
 
 
@@ -370,5 +392,6 @@ vmwgfx_hw_dri2_validate(PixmapPtr pixmap, unsigned int depth)
 
     return (vmwgfx_hw_dri2_stage(pixmap, depth) &&
 	    vmwgfx_hw_commit(pixmap) &&
+	    vmwgfx_hw_unshare(vsaa, pixmap) &&
 	    vmwgfx_hw_validate(pixmap, NULL));
 }
@@ -62,6 +62,7 @@ vmwgfx_create_window_buffer(struct xwl_window *xwl_window,
      * surface.
      */
     vpix->hw_is_hosted = TRUE;
+    vpix->hw_exported = TRUE;
     if (xa_surface_handle(vpix->hw, &name, &pitch) != XA_ERR_NONE)
 	return BadDrawable;
 